@@ -557,20 +557,18 @@ private:
 		Heap<BranchSt>* heap = new Heap<BranchSt>(heapSize); //Heap<BranchSt>* heap = new Heap<BranchSt>(size_);
 		
 		if (result.capacity_ < size_ / 8) {
-			BalancedTree<int>* checked(new BalancedTree<int>(NULL));
+			FlatSet<int> checked;
 
 			int checks = 0;
 			for (int i = 0; i < trees_; ++i) {
-				findNN<with_removed>(tree_roots_[i], result, vec, checks, maxChecks, heap, &checked);
+				findNN<with_removed>(tree_roots_[i], result, vec, checks, maxChecks, heap, checked);
 			}
 
 			BranchSt branch;
 			while (heap->popMin(branch) && (checks < maxChecks || !result.full())) {
 				NodePtr node = branch.node;
-				findNN<with_removed>(node, result, vec, checks, maxChecks, heap, &checked);
+				findNN<with_removed>(node, result, vec, checks, maxChecks, heap, checked);
 			}
-
-			checked->~BalancedTree<int>();
 		}
 		else {
 			DynamicBitset checked(size_);
@@ -604,7 +602,7 @@ private:
 
 	template<bool with_removed>
 	void findNN(NodePtr node, ResultSet<DistanceType>& result, const ElementType* vec, int& checks, int maxChecks,
-		Heap<BranchSt>* heap, BalancedTree<int>** checked) const
+		Heap<BranchSt>* heap, FlatSet<int>& checked) const
 	{
 		if (node->childs.empty()) {
 			if (checks >= maxChecks) {
@@ -616,10 +614,10 @@ private:
 				if (with_removed) {
 					if (removed_points_.test(pointInfo.index)) continue;
 				}
-				if ((*checked)->search(pointInfo.index)) continue;
+				if (checked.search(pointInfo.index)) continue;
 				DistanceType dist = distance_(pointInfo.point, vec, veclen_);
 				result.addPoint(dist, pointInfo.index);
-				(*checked)->addNode((void**) checked, pointInfo.index);
+				checked.addNode(pointInfo.index);
 				++checks;
 			}
 		}
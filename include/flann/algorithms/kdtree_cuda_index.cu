@@ -33,6 +33,7 @@
 #include <flann/algorithms/dist.h>
 
 #include "tools/graphic.h"
+#include "tools/utils/profiler.h"
 
 namespace flann
 {
@@ -50,11 +51,16 @@ namespace flann
 
 	template <typename Distance> void KDTreeCudaIndex<Distance>::gpuMemCpyTrees()
 	{
+		utils::Profiler::Phase upload("upload");
+
 		HANDLE_ERROR(cudaMalloc((void**)&devtreeroots, tree_roots_.size() * sizeof(int)));
 		HANDLE_ERROR(cudaMemcpy(devtreeroots, tree_roots_.data(), tree_roots_.size() * sizeof(int), cudaMemcpyHostToDevice));
 
-		HANDLE_ERROR(cudaMalloc((void**)&devpool, std::pow(2, (std::ceil(std::log2(size_)) + 1)) * trees_ * sizeof(KDTreeCudaIndex<Distance>::Node)));
-		HANDLE_ERROR(cudaMemcpy(devpool, pool_.base, std::pow(2, (std::ceil(std::log2(size_)) + 1)) * trees_ * sizeof(KDTreeCudaIndex<Distance>::Node), cudaMemcpyHostToDevice));
+		/* The nodes are copied block by block into one array, so their numbers stay valid on the device. */
+		HANDLE_ERROR(cudaMalloc((void**)&devpool, pool_.usedMemory()));
+		for (size_t b = 0; b < pool_.blocks(); ++b) {
+			HANDLE_ERROR(cudaMemcpy(devpool + pool_.blockOffset(b), pool_.block(b), pool_.blockCount(b) * sizeof(KDTreeCudaIndex<Distance>::Node), cudaMemcpyHostToDevice));
+		}
 	}
 
 	template void KDTreeCudaIndex<flann::L2<float>>::gpuMemCpyData();
@@ -62,8 +68,13 @@ namespace flann
 
 	template <typename Distance> void KDTreeCudaIndex<Distance>::gpuMemCpyData()
 	{
+		utils::Profiler::Phase upload("upload");
+
+		/* The rows of the dataset can be padded, on the device they are packed. */
+		size_t pitch = size_ > 1 ? (char*)points_[1] - (char*)points_[0] : veclen_ * sizeof(ElementType);
+
 		HANDLE_ERROR(cudaMalloc((void**)&devdataset, size_ * veclen_ * sizeof(ElementType)));
-		HANDLE_ERROR(cudaMemcpy(devdataset, points_[0], size_ * veclen_ * sizeof(ElementType), cudaMemcpyHostToDevice));
+		HANDLE_ERROR(cudaMemcpy2D(devdataset, veclen_ * sizeof(ElementType), points_[0], pitch, veclen_ * sizeof(ElementType), size_, cudaMemcpyHostToDevice));
 	}
 
 	template void KDTreeCudaIndex<flann::L2<float>>::knnSearchGpu(const Matrix<ElementType>& queries,
@@ -112,14 +123,25 @@ namespace flann
 		size_t* devindices;
 		DistanceType* devdists;
 
+		utils::Profiler::Phase upload("upload");
+
+		/* The rows of the matrices can be padded like the dataset, on the device they are packed. */
 		HANDLE_ERROR(cudaMalloc((void**)&devqueries, queries.rows * queries.cols * sizeof(ElementType)));
-		HANDLE_ERROR(cudaMemcpy(devqueries, queries.ptr(), queries.rows * queries.cols * sizeof(ElementType), cudaMemcpyHostToDevice));
+		HANDLE_ERROR(cudaMemcpy2D(devqueries, queries.cols * sizeof(ElementType), queries.ptr(), queries.stride, queries.cols * sizeof(ElementType), queries.rows, cudaMemcpyHostToDevice));
 
 		HANDLE_ERROR(cudaMalloc((void**)&devindices, indices.rows * indices.cols * sizeof(size_t)));
-		HANDLE_ERROR(cudaMemcpy(devindices, indices.ptr(), indices.rows * indices.cols * sizeof(size_t), cudaMemcpyHostToDevice));
+		HANDLE_ERROR(cudaMemcpy2D(devindices, indices.cols * sizeof(size_t), indices.ptr(), indices.stride, indices.cols * sizeof(size_t), indices.rows, cudaMemcpyHostToDevice));
 
 		HANDLE_ERROR(cudaMalloc((void**)&devdists, dists.rows * dists.cols * sizeof(DistanceType)));
-		HANDLE_ERROR(cudaMemcpy(devdists, dists.ptr(), dists.rows * dists.cols * sizeof(DistanceType), cudaMemcpyHostToDevice));
+		HANDLE_ERROR(cudaMemcpy2D(devdists, dists.cols * sizeof(DistanceType), dists.ptr(), dists.stride, dists.cols * sizeof(DistanceType), dists.rows, cudaMemcpyHostToDevice));
+
+		SearchStatistics* devstatistics = nullptr;
+#ifdef FLANN_SEARCH_STATISTICS
+		if (params.statistics) {
+			HANDLE_ERROR(cudaMalloc((void**)&devstatistics, queries.rows * sizeof(SearchStatistics)));
+			HANDLE_ERROR(cudaMemset(devstatistics, 0, queries.rows * sizeof(SearchStatistics)));
+		}
+#endif
 
 		//size_t* devHeapNumber;
 		//size_t* heapNumber(new size_t[queries.rows]);
@@ -129,30 +151,48 @@ namespace flann
 		//HANDLE_ERROR(cudaMalloc((void**)&devHeapNumber, queries.rows * sizeof(size_t)));
 		//HANDLE_ERROR(cudaMemcpy(devHeapNumber, heapNumber, queries.rows * sizeof(size_t), cudaMemcpyHostToDevice));
 
+		upload.stop();
+
+		utils::Profiler::Phase kernel("kernel");
+
 		if (std::is_same<Distance, flann::L2<ElementType>>::value) {
 			typedef graphic::L2<ElementType> DistanceGpu;
-			gpuknnSearch<DistanceGpu> search(devdataset, devpool, devtreeroots, devqueries, devindices, devdists/*, devHeapNumber*/, veclen_, size_, tree_roots_.size(), knn);
+			gpuknnSearch<DistanceGpu> search(devdataset, devpool, devtreeroots, devqueries, devindices, devdists/*, devHeapNumber*/, veclen_, size_, tree_roots_.size(), knn, devstatistics);
 			knnSearchGpuKernel<DistanceGpu>(search, queries.rows);
 			//versuchKernelCall<ElementType, DistanceType>(devtreeroots, trees_, veclen_, size_, devpool, devdataset);
 		}
 		else if (std::is_same<Distance, flann::L2_3D<ElementType>>::value) {
 			typedef graphic::L2_3D<ElementType> DistanceGpu;
-			gpuknnSearch<DistanceGpu> search(devdataset, devpool, devtreeroots, devqueries, devindices, devdists/*, devHeapNumber*/, veclen_, size_, tree_roots_.size(), knn);
+			gpuknnSearch<DistanceGpu> search(devdataset, devpool, devtreeroots, devqueries, devindices, devdists/*, devHeapNumber*/, veclen_, size_, tree_roots_.size(), knn, devstatistics);
 			knnSearchGpuKernel<DistanceGpu>(search, queries.rows);
 			//versuchKernelCall<ElementType,DistanceType>(devtreeroots, trees_, veclen_, size_, devpool, devdataset);
 		}
 		else if (std::is_same<Distance, flann::L2_Simple<ElementType>>::value) {
 			typedef graphic::L2_Simple<ElementType> DistanceGpu;
-			gpuknnSearch<DistanceGpu> search(devdataset, devpool, devtreeroots, devqueries, devindices, devdists/*, devHeapNumber*/, veclen_, size_, tree_roots_.size(), knn);
+			gpuknnSearch<DistanceGpu> search(devdataset, devpool, devtreeroots, devqueries, devindices, devdists/*, devHeapNumber*/, veclen_, size_, tree_roots_.size(), knn, devstatistics);
 			knnSearchGpuKernel<DistanceGpu>(search, queries.rows);
 			//versuchKernelCall<ElementType, DistanceType>(devtreeroots, trees_, veclen_, size_, devpool, devdataset);
 		}
 
-		HANDLE_ERROR(cudaMemcpy(indices.ptr(), devindices, indices.rows * indices.cols * sizeof(size_t), cudaMemcpyDeviceToHost));
-		HANDLE_ERROR(cudaMemcpy(dists.ptr(),devdists,dists.rows * dists.cols * sizeof(DistanceType), cudaMemcpyDeviceToHost));
+		/* The kernel runs asynchronously, wait for it to measure its time. */
+		HANDLE_ERROR(cudaDeviceSynchronize());
+		kernel.stop();
+
+		utils::Profiler::Phase download("download");
+
+		HANDLE_ERROR(cudaMemcpy2D(indices.ptr(), indices.stride, devindices, indices.cols * sizeof(size_t), indices.cols * sizeof(size_t), indices.rows, cudaMemcpyDeviceToHost));
+		HANDLE_ERROR(cudaMemcpy2D(dists.ptr(), dists.stride, devdists, dists.cols * sizeof(DistanceType), dists.cols * sizeof(DistanceType), dists.rows, cudaMemcpyDeviceToHost));
 
 		//HANDLE_ERROR(cudaMemcpy(heapNumber,devHeapNumber,queries.rows*sizeof(size_t),cudaMemcpyDeviceToHost));
 
+#ifdef FLANN_SEARCH_STATISTICS
+		if (devstatistics) {
+			params.statistics->resize(queries.rows);
+			HANDLE_ERROR(cudaMemcpy(params.statistics->data(), devstatistics, queries.rows * sizeof(SearchStatistics), cudaMemcpyDeviceToHost));
+			HANDLE_ERROR(cudaFree(devstatistics));
+		}
+#endif
+
 		HANDLE_ERROR(cudaFree(devqueries));
 		HANDLE_ERROR(cudaFree(devindices));
 		HANDLE_ERROR(cudaFree(devdists));
@@ -30,6 +30,8 @@
 #ifndef FLANN_KDTREE_CUDA_INDEX_CUH_
 #define FLANN_KDTREE_CUDA_INDEX_CUH_
 
+#include "flann/util/search_statistics.h"
+
 #include "tools/graphic.h"
 
 //#include "tools/graphic/nodes.cuh"
@@ -120,6 +122,7 @@ namespace flann
 			devqueries = nullptr;
 			devindices = nullptr;
 			devdists = nullptr;
+			devstatistics = nullptr;
 			/*devHeapNumber = nullptr;*/
 
 			veclen = 0;
@@ -135,7 +138,7 @@ namespace flann
 		__device__
 		gpuknnSearch(ElementType* devdataset_, Node* devpool_, int* devtreeroots_, ElementType* devqueries_, size_t* devindices_, DistanceType* devdists_,
 			/*size_t* devHeapNumber_,*/
-			int veclen_, int size_, int trees_, int knn_)
+			int veclen_, int size_, int trees_, int knn_, SearchStatistics* devstatistics_ = nullptr)
 		{
 			devdataset = devdataset_;
 			devpool = devpool_;
@@ -143,6 +146,7 @@ namespace flann
 			devqueries = devqueries_;
 			devindices = devindices_;
 			devdists = devdists_;
+			devstatistics = devstatistics_;
 			/*devHeapNumber = devHeapNumber_;*/
 
 			knn = knn_;
@@ -187,17 +191,28 @@ namespace flann
 			//	dists[i] = 0;
 			//}
 
+			/* The counters are only touched with FLANN_SEARCH_STATISTICS. */
+			SearchStatistics statistics;
+
 			Branch<DistanceType> initialBranch(devtreeroots[0], 0/*, dists*/);
 			heap.add(initialBranch);
+			FLANN_STATISTICS(statistics.pushes++);
 
 			ElementType* vec = &devqueries[index_ * veclen];
 
 			Branch<DistanceType> branch;
 			while (heap.pop(branch)) {
-				searchLevelExact(resultset, heap, branch.nodeIdx, vec, branch.mindist/*, branch.dists*/);
+				FLANN_STATISTICS(statistics.pops++);
+				searchLevelExact(resultset, heap, branch.nodeIdx, vec, branch.mindist/*, branch.dists*/, statistics);
 				//branch.clear();
 			}
 			resultset.copy(&devindices[index_*knn], &devdists[index_*knn]);
+#ifdef FLANN_SEARCH_STATISTICS
+			if (devstatistics) {
+				statistics.queries = 1;
+				devstatistics[index_] = statistics;
+			}
+#endif
 
 			resultset.clear();
 			heap.clear();
@@ -206,13 +221,17 @@ namespace flann
 
 		__device__
 		void searchLevelExact(graphic::KNNResultSet<DistanceType>& resultset_, graphic::Heap<Branch<DistanceType>, 0>& heap_, int nodeIdx_, ElementType* vec_,
-			DistanceType mindist_ /*, DistanceType* dists_*/)
+			DistanceType mindist_ /*, DistanceType* dists_*/, SearchStatistics& statistics_)
 		{
 			if (resultset_.worstDist() != -1 && mindist_ > resultset_.worstDist()) {
+				FLANN_STATISTICS(statistics_.pruned++);
 				return;
 			}
+			FLANN_STATISTICS(statistics_.nodes++);
 
 			if (!devpool[nodeIdx_].child1 && !devpool[nodeIdx_].child2) {
+				FLANN_STATISTICS(statistics_.leaves++);
+				FLANN_STATISTICS(statistics_.distances++);
 				int idx = devpool[nodeIdx_].divfeat;
 					
 				DistanceType dist = distanceFunctor(&devdataset[idx*veclen], vec_, veclen);
@@ -232,6 +251,7 @@ namespace flann
 			//}
 			Branch<DistanceType> bestbranch(bestchild, mindist_/*, bestdistsnew*/);
 			heap_.add(bestbranch);
+			FLANN_STATISTICS(statistics_.pushes++);
 
 			DistanceType newDistsq = mindist_ + distanceFunctor.accum_dist(val,divval,veclen) /*- dists_[devpool[nodeIdx_].divfeat]*/;
 			if (resultset_.worstDist() == -1 || newDistsq < resultset_.worstDist()) {
@@ -244,7 +264,12 @@ namespace flann
 				
 				Branch<DistanceType> otherbranch(otherchild, newDistsq/*, otherdistsnew*/);
 				heap_.add(otherbranch);
+				FLANN_STATISTICS(statistics_.pushes++);
+			}
+			else {
+				FLANN_STATISTICS(statistics_.pruned++);
 			}
+			FLANN_STATISTICS(statistics_.peak_heap = heap_.count > statistics_.peak_heap ? heap_.count : statistics_.peak_heap);
 		}
 
 	private:
@@ -284,7 +309,10 @@ namespace flann
 		*/
 		DistanceType* devdists;
 
-
+		/**
+			Array with the search statistics of every query, nullptr if they are not recorded
+		*/
+		SearchStatistics* devstatistics;
 
 		/*size_t* devHeapNumber;*/
 
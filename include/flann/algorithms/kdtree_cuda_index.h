@@ -53,23 +53,19 @@
 #include "tools/utils/allocator.h" // FILE REPLACE THE ALLOCATOR FUNCTION IN FOLDER!!!
 #include "tools/utils/matrix.h"
 #include "tools/utils/nodes.h"
-
-#ifdef _DEBUG
-	#ifndef DEBUG_NEW
-		#define DEBUG_NEW new(_NORMAL_BLOCK, __FILE__, __LINE__)
-		#define new DEBUG_NEW
-	#endif
-#endif
+#include "tools/utils/profiler.h"
 
 namespace flann
 {
 
 	struct KDTreeCudaIndexParams : public IndexParams
 	{
-		KDTreeCudaIndexParams(int trees = 1)
+		KDTreeCudaIndexParams(int trees = 1, int cores = 1)
 		{
 			(*this)["algorithm"] = FLANN_INDEX_KDTREE_CUDA;
 			(*this)["trees"] = trees;
+			// number of threads building trees in parallel (0 for the number of hardware threads)
+			(*this)["cores"] = cores;
 		}
 	};
 
@@ -99,7 +95,7 @@ namespace flann
 			@param d: distance functor
 		*/
 		KDTreeCudaIndex(const IndexParams& params = KDTreeCudaIndexParams(), Distance d = Distance())
-			: BaseClass(params, d), mean_(NULL), var_(NULL), devtreeroots(nullptr), devpool(nullptr), devdataset(nullptr)
+			: BaseClass(params, d), devtreeroots(nullptr), devpool(nullptr), devdataset(nullptr)
 		{
 			trees_ = get_param(params, "trees", 1);
 			
@@ -114,7 +110,7 @@ namespace flann
 			@param d: distance functor
 		*/
 		KDTreeCudaIndex(const Matrix<ElementType>& inputData, const IndexParams& params = KDTreeCudaIndexParams(),
-			Distance d = Distance()) : BaseClass(params, d), mean_(NULL), var_(NULL), devtreeroots(nullptr), devpool(nullptr), devdataset(nullptr)
+			Distance d = Distance()) : BaseClass(params, d), devtreeroots(nullptr), devpool(nullptr), devdataset(nullptr)
 		{
 			trees_ = get_param(params, "trees", 1);
 
@@ -206,26 +202,41 @@ namespace flann
 		*/
 		void buildIndexImpl()
 		{
-			pool_ = utils::Allocator(std::pow(2, (std::ceil(std::log2(size_)) + 1)) * trees_, sizeof(Node));
-
-			/* Create a permutable array of indices to the input vectors. */
-			std::vector<int> ind(size_);
-			for (size_t i = 0; i < size_; ++i) {
-				ind[i] = int(i);
-			}
-
-			mean_ = new DistanceType[veclen_];
-			var_ = new DistanceType[veclen_];
+			/* A tree has 2*size_-1 nodes, the pool grows if the first block is full. */
+			pool_ = utils::Allocator(2 * size_, sizeof(Node));
 
 			tree_roots_.resize(trees_);
-			/* Construct the randomized trees. */
-			for (int i = 0; i < trees_; i++) {
-				/* Randomize the order of vectors to allow for unbiased sampling. */
-				std::random_shuffle(ind.begin(), ind.end());
-				tree_roots_[i] = divideTree(&ind[0], int(size_));
-			}
-			delete[] mean_;
-			delete[] var_;
+
+			/* Construct the randomized trees, in parallel on the worker pool of the
+			index when more than one core is requested. */
+			int cores = get_param(index_params_, "cores", 1);
+			std::shared_ptr<ThreadPool> workers = getWorkers(cores);
+			int threads = std::min(std::min(ThreadPool::resolveThreads(cores), workers->size()), trees_);
+
+			/* Every tree draws from its own stream of this seed, so the trees do not
+			depend on the number of threads. */
+			uint64_t seed = random_engine()();
+
+			utils::Profiler::Phase phase("trees");
+			workers->run(threads, [&](int thread, int) {
+				std::vector<int> ind(size_);
+				std::vector<DistanceType> mean(veclen_);
+				std::vector<DistanceType> var(veclen_);
+				utils::Allocator::Cache cache;
+
+				for (int i = thread; i < trees_; i += threads) {
+					ScopedRandomEngine engine(RandomEngine(seed, i));
+
+					/* Create a permutable array of indices to the input vectors. */
+					for (size_t j = 0; j < size_; ++j) {
+						ind[j] = int(j);
+					}
+					/* Randomize the order of vectors to allow for unbiased sampling. */
+					permute(ind.begin(), ind.end(), random_engine());
+					tree_roots_[i] = divideTree(&ind[0], int(size_), &mean[0], &var[0], cache);
+				}
+			});
+			phase.stop();
 
 			gpuMemCpyTrees();
 		}
@@ -238,9 +249,7 @@ namespace flann
 			if (devpool && devtreeroots) {
 				gpuFreeIndex();
 			}
-			if (pool_.ptr()) {
-				pool_.clear();
-			}
+			pool_.clear();
 		}
 
 		void gpuFreeIndex();
@@ -253,12 +262,13 @@ namespace flann
 			@params: pTree = the new node to create
 			@params: first = index of the first vector
 			@params: last = index of the last vector
+			@params: mean, var = scratch buffers of the building thread
+			@params: cache = allocation cache of the building thread
 		*/
-		int divideTree(int* ind, int count)
+		int divideTree(int* ind, int count, DistanceType* mean, DistanceType* var, utils::Allocator::Cache& cache)
 		{
 			int number;
-			////////////NodePtr node = new(pool_,number) Node(); // allocate memory
-			NodePtr node = (NodePtr) pool_.allocate(number);// allocate memory
+			NodePtr node = (NodePtr) pool_.allocate(number, cache);// allocate memory
 
 			/* If too few exemplars remain, then make this a leaf node. */
 			if (count == 1) {
@@ -269,12 +279,12 @@ namespace flann
 				int idx;
 				int cutfeat;
 				DistanceType cutval;
-				meanSplit(ind, count, idx, cutfeat, cutval);
+				meanSplit(ind, count, idx, cutfeat, cutval, mean, var);
 
 				node->divfeat = cutfeat;
 				node->divval = cutval;
-				node->child1 = divideTree(ind, idx);
-				node->child2 = divideTree(ind + idx, count - idx);
+				node->child1 = divideTree(ind, idx, mean, var, cache);
+				node->child2 = divideTree(ind + idx, count - idx, mean, var, cache);
 			}
 
 			return number;
@@ -286,10 +296,10 @@ namespace flann
 			Make a random choice among those with the highest variance, and use
 			its variance as the threshold value.
 		*/
-		void meanSplit(int* ind, int count, int& index, int& cutfeat, DistanceType& cutval)
+		void meanSplit(int* ind, int count, int& index, int& cutfeat, DistanceType& cutval, DistanceType* mean, DistanceType* var)
 		{
-			memset(mean_, 0, veclen_ * sizeof(DistanceType));
-			memset(var_, 0, veclen_ * sizeof(DistanceType));
+			memset(mean, 0, veclen_ * sizeof(DistanceType));
+			memset(var, 0, veclen_ * sizeof(DistanceType));
 
 			/* Compute mean values.  Only the first SAMPLE_MEAN values need to be
 			sampled to get a good estimate.
@@ -298,25 +308,25 @@ namespace flann
 			for (int j = 0; j < cnt; ++j) {
 				ElementType* v = points_[ind[j]];
 				for (size_t k = 0; k<veclen_; ++k) {
-					mean_[k] += v[k];
+					mean[k] += v[k];
 				}
 			}
 			DistanceType div_factor = DistanceType(1) / cnt;
 			for (size_t k = 0; k<veclen_; ++k) {
-				mean_[k] *= div_factor;
+				mean[k] *= div_factor;
 			}
 
 			/* Compute variances (no need to divide by count). */
 			for (int j = 0; j < cnt; ++j) {
 				ElementType* v = points_[ind[j]];
 				for (size_t k = 0; k<veclen_; ++k) {
-					DistanceType dist = v[k] - mean_[k];
-					var_[k] += dist * dist;
+					DistanceType dist = v[k] - mean[k];
+					var[k] += dist * dist;
 				}
 			}
 			/* Select one of the highest variance indices at random. */
-			cutfeat = selectDivision(var_);
-			cutval = mean_[cutfeat];
+			cutfeat = selectDivision(var);
+			cutval = mean[cutfeat];
 
 			int lim1, lim2;
 			planeSplit(ind, count, cutfeat, cutval, lim1, lim2);
@@ -488,9 +498,6 @@ namespace flann
 		*/
 		int trees_;
 
-		DistanceType* mean_;
-		DistanceType* var_;
-
 		/**
 			Array of k-d trees used to find neighbours.
 		*/
@@ -502,7 +509,7 @@ namespace flann
 		int* devtreeroots;
 
 		/**
-			Pooled memory allocator.
+			Pooled memory allocator, the nodes are addressed by their number.
 		*/
 		utils::Allocator pool_;
 
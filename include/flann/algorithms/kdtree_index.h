@@ -37,6 +37,7 @@
 #include <cstring>
 #include <stdarg.h>
 #include <cmath>
+#include <mutex>
 
 #include "flann/general.h"
 #include "flann/algorithms/nn_index.h"
@@ -47,6 +48,7 @@
 #include "flann/util/allocator.h"
 #include "flann/util/random.h"
 #include "flann/util/saving.h"
+#include "flann/util/mapping.h"
 
 #include "flann/util/datastructures.h"
 
@@ -55,10 +57,12 @@ namespace flann
 
 struct KDTreeIndexParams : public IndexParams
 {
-    KDTreeIndexParams(int trees = 4)
+    KDTreeIndexParams(int trees = 4, int cores = 1)
     {
         (*this)["algorithm"] = FLANN_INDEX_KDTREE;
         (*this)["trees"] = trees;
+        // number of threads building trees in parallel (0 for the number of hardware threads)
+        (*this)["cores"] = cores;
     }
 };
 
@@ -68,6 +72,9 @@ struct KDTreeIndexParams : public IndexParams
  *
  * Contains the k-d trees and other information for indexing a set of points
  * for nearest-neighbor matching.
+ *
+ * Every thread which searches the index keeps a VisitedSet of 4 bytes per
+ * point, which outlives the index until the thread searches smaller indices.
  */
 template <typename Distance>
 class KDTreeIndex : public NNIndex<Distance>
@@ -89,7 +96,7 @@ public:
      *          params = parameters passed to the kdtree algorithm
      */
     KDTreeIndex(const IndexParams& params = KDTreeIndexParams(), Distance d = Distance() ) :
-    	BaseClass(params, d), mean_(NULL), var_(NULL)
+    	BaseClass(params, d)
     {
         trees_ = get_param(index_params_,"trees",4);
     }
@@ -103,7 +110,7 @@ public:
      *          params = parameters passed to the kdtree algorithm
      */
     KDTreeIndex(const Matrix<ElementType>& dataset, const IndexParams& params = KDTreeIndexParams(),
-                Distance d = Distance() ) : BaseClass(params,d ), mean_(NULL), var_(NULL)
+                Distance d = Distance() ) : BaseClass(params,d )
     {
         trees_ = get_param(index_params_,"trees",4);
 
@@ -115,7 +122,7 @@ public:
     {
         tree_roots_.resize(other.tree_roots_.size());
         for (size_t i=0;i<tree_roots_.size();++i) {
-        	copyTree(tree_roots_[i], other.tree_roots_[i]);
+        	tree_roots_[i] = copyTree(other.tree_roots_[i]);
         }
     }
 
@@ -147,7 +154,8 @@ public:
         size_t old_size = size_;
         extendDataset(points);
         
-        if (rebuild_threshold>1 && size_at_build_*rebuild_threshold<size_) {
+        // the nodes of a mapped index are read-only
+        if (mapping_ || (rebuild_threshold>1 && size_at_build_*rebuild_threshold<size_)) {
             buildIndex();
         }
         else {
@@ -205,6 +213,71 @@ public:
     	la & *this;
     }
 
+    /**
+     * Saves the index into a file which can be mapped with mapIndex(). The
+     * nodes are stored uncompressed in the layout of the memory.
+     * @param filename Path of the file
+     */
+    void saveMappedIndex(const std::string& filename)
+    {
+        MappedIndexWriter writer(filename, flann_datatype_value<ElementType>::value, getType(), sizeof(Node));
+        writer.writeBase(*static_cast<NNIndex<Distance>*>(this));
+
+        size_t count = 0;
+        for (size_t i=0;i<tree_roots_.size();++i) {
+            count += countNodes(tree_roots_[i]);
+        }
+
+        std::vector<char> nodes(count*sizeof(Node), 0);
+        std::vector<uint64_t> roots(tree_roots_.size());
+        size_t next = 0;
+        for (size_t i=0;i<tree_roots_.size();++i) {
+            roots[i] = next;
+            flattenTree(tree_roots_[i], (Node*)&nodes[0], next);
+        }
+
+        writer.writeSection(MAPPED_NODES, nodes.empty() ? NULL : &nodes[0], nodes.size());
+        writer.writeSection(MAPPED_ROOTS, roots.empty() ? NULL : &roots[0], roots.size()*sizeof(uint64_t));
+        writer.close();
+    }
+
+    /**
+     * Maps a file of saveMappedIndex() into memory. The nodes are used in
+     * place, so processes which map the same file share its pages and the
+     * index is ready without deserializing the trees. The dataset has to be
+     * given to the constructor unless it has been saved with the index.
+     * @param filename Path of the file
+     * @param prefetch Loads the whole file into memory before returning
+     */
+    void mapIndex(const std::string& filename, bool prefetch = false)
+    {
+        MappedIndexReader reader(filename, flann_datatype_value<ElementType>::value, getType(), sizeof(Node));
+        freeIndex();
+        reader.readBase(*static_cast<NNIndex<Distance>*>(this));
+
+        size_t count = reader.count<Node>(MAPPED_NODES);
+        size_t trees = reader.count<uint64_t>(MAPPED_ROOTS);
+        Node* nodes = reader.section<Node>(MAPPED_NODES, count);
+        const uint64_t* roots = reader.section<uint64_t>(MAPPED_ROOTS, trees);
+
+        tree_roots_.resize(trees);
+        for (size_t i=0;i<trees;++i) {
+            if (roots[i] >= count) {
+                throw FLANNException("Invalid index file, root out of range");
+            }
+            tree_roots_[i] = nodes + roots[i];
+        }
+        trees_ = int(trees);
+        mapping_ = reader.getFile();
+
+        if (prefetch) {
+            reader.prefetch();
+        }
+
+        index_params_["algorithm"] = getType();
+        index_params_["trees"] = trees_;
+    }
+
     /**
      * Computes the inde memory usage
      * Returns: memory used by the index
@@ -253,28 +326,44 @@ protected:
      */
     void buildIndexImpl()
     {
-        // Create a permutable array of indices to the input vectors.
-    	std::vector<int> ind(size_);
-        for (size_t i = 0; i < size_; ++i) {
-            ind[i] = int(i);
-        }
+        tree_roots_.resize(trees_);
 
-        mean_ = new DistanceType[veclen_];
-        var_ = new DistanceType[veclen_];
+        /* Construct the randomized trees, in parallel on the worker pool of the
+           index when more than one core is requested. */
+        int cores = get_param(index_params_,"cores",1);
+        std::shared_ptr<ThreadPool> workers = getWorkers(cores);
+        int threads = std::min(std::min(ThreadPool::resolveThreads(cores), workers->size()), trees_);
 
-        tree_roots_.resize(trees_);
-        /* Construct the randomized trees. */
-        for (int i = 0; i < trees_; i++) {
-            /* Randomize the order of vectors to allow for unbiased sampling. */
-            std::random_shuffle(ind.begin(), ind.end());
-            tree_roots_[i] = divideTree(&ind[0], int(size_) );
-        }
-        delete[] mean_;
-        delete[] var_;
+        /* Every tree draws from its own stream of this seed, so the trees do not
+           depend on the number of threads. */
+        uint64_t seed = random_engine()();
+
+        workers->run(threads, [&](int thread, int) {
+            std::vector<int> ind(size_);
+            std::vector<DistanceType> mean(veclen_);
+            std::vector<DistanceType> var(veclen_);
+
+            for (int i = thread; i < trees_; i += threads) {
+                ScopedRandomEngine engine(RandomEngine(seed, i));
+
+                // Create a permutable array of indices to the input vectors.
+                for (size_t j = 0; j < size_; ++j) {
+                    ind[j] = int(j);
+                }
+                /* Randomize the order of vectors to allow for unbiased sampling. */
+                permute(ind.begin(), ind.end(), random_engine());
+                tree_roots_[i] = divideTree(&ind[0], int(size_), &mean[0], &var[0]);
+            }
+        });
     }
 
     void freeIndex()
     {
+    	if (mapping_) {
+    		// the nodes of a mapped index belong to the file
+    		tree_roots_.clear();
+    		mapping_.reset();
+    	}
 
     	for (size_t i=0;i<tree_roots_.size();++i) {
     		// using placement new, so call destructor explicitly
@@ -302,9 +391,9 @@ private:
          */
         ElementType* point;
 		/**
-		* The child nodes.
+		* The child nodes, relative so that the nodes can be mapped from a file.
 		*/
-		Node* child1, *child2;
+		RelativePtr<Node> child1, child2;
 		Node(){
 			child1 = NULL;
 			child2 = NULL;
@@ -352,9 +441,9 @@ private:
     typedef BranchStruct<NodePtr, DistanceType> BranchSt;
     typedef BranchSt* Branch;
 
-    void copyTree(NodePtr& dst, const NodePtr& src)
+    NodePtr copyTree(const NodePtr src)
     {
-    	dst = new(pool_) Node();
+    	NodePtr dst = new(pool_) Node();
     	dst->divfeat = src->divfeat;
     	dst->divval = src->divval;
     	if (src->child1==NULL && src->child2==NULL) {
@@ -363,9 +452,38 @@ private:
     		dst->child2 = NULL;
     	}
     	else {
-    		copyTree(dst->child1, src->child1);
-    		copyTree(dst->child2, src->child2);
+    		dst->child1 = copyTree(src->child1);
+    		dst->child2 = copyTree(src->child2);
+    	}
+    	return dst;
+    }
+
+    size_t countNodes(const NodePtr node) const
+    {
+    	if (node->child1==NULL && node->child2==NULL) {
+    		return 1;
+    	}
+    	return 1 + countNodes(node->child1) + countNodes(node->child2);
+    }
+
+    /**
+     * Copies a tree in preorder into an array of nodes. Leaves do not keep
+     * the pointer to their point, which is only valid in this process.
+     */
+    NodePtr flattenTree(const NodePtr src, Node* nodes, size_t& next) const
+    {
+    	NodePtr dst = new(&nodes[next++]) Node();
+    	dst->divfeat = src->divfeat;
+    	dst->point = NULL;
+    	if (src->child1==NULL && src->child2==NULL) {
+    		dst->divval = 0;
+    	}
+    	else {
+    		dst->divval = src->divval;
+    		dst->child1 = flattenTree(src->child1, nodes, next);
+    		dst->child2 = flattenTree(src->child2, nodes, next);
     	}
+    	return dst;
     }
 
     /**
@@ -376,10 +494,16 @@ private:
      * Params: pTree = the new node to create
      *                  first = index of the first vector
      *                  last = index of the last vector
+     *                  mean, var = buffers of size veclen_ of the building thread
      */
-    NodePtr divideTree(int* ind, int count)
+    NodePtr divideTree(int* ind, int count, DistanceType* mean, DistanceType* var)
     {
-        NodePtr node = new(pool_) Node(); // allocate memory
+        NodePtr node;
+        {
+            // several trees may be built at the same time
+            std::lock_guard<std::mutex> lock(pool_mutex_);
+            node = new(pool_) Node(); // allocate memory
+        }
 
         /* If too few exemplars remain, then make this a leaf node. */
         if (count == 1) {
@@ -391,12 +515,12 @@ private:
             int idx;
             int cutfeat;
             DistanceType cutval;
-            meanSplit(ind, count, idx, cutfeat, cutval);
+            meanSplit(ind, count, idx, cutfeat, cutval, mean, var);
 
             node->divfeat = cutfeat;
             node->divval = cutval;
-            node->child1 = divideTree(ind, idx);
-            node->child2 = divideTree(ind+idx, count-idx);
+            node->child1 = divideTree(ind, idx, mean, var);
+            node->child2 = divideTree(ind+idx, count-idx, mean, var);
         }
 
         return node;
@@ -408,10 +532,10 @@ private:
      * Make a random choice among those with the highest variance, and use
      * its variance as the threshold value.
      */
-    void meanSplit(int* ind, int count, int& index, int& cutfeat, DistanceType& cutval)
+    void meanSplit(int* ind, int count, int& index, int& cutfeat, DistanceType& cutval, DistanceType* mean, DistanceType* var)
     {
-        memset(mean_,0,veclen_*sizeof(DistanceType));
-        memset(var_,0,veclen_*sizeof(DistanceType));
+        memset(mean,0,veclen_*sizeof(DistanceType));
+        memset(var,0,veclen_*sizeof(DistanceType));
 
         /* Compute mean values.  Only the first SAMPLE_MEAN values need to be
             sampled to get a good estimate.
@@ -420,25 +544,25 @@ private:
         for (int j = 0; j < cnt; ++j) {
             ElementType* v = points_[ind[j]];
             for (size_t k=0; k<veclen_; ++k) {
-                mean_[k] += v[k];
+                mean[k] += v[k];
             }
         }
         DistanceType div_factor = DistanceType(1)/cnt;
         for (size_t k=0; k<veclen_; ++k) {
-            mean_[k] *= div_factor;
+            mean[k] *= div_factor;
         }
 
         /* Compute variances (no need to divide by count). */
         for (int j = 0; j < cnt; ++j) {
             ElementType* v = points_[ind[j]];
             for (size_t k=0; k<veclen_; ++k) {
-                DistanceType dist = v[k] - mean_[k];
-                var_[k] += dist * dist;
+                DistanceType dist = v[k] - mean[k];
+                var[k] += dist * dist;
             }
         }
         /* Select one of the highest variance indices at random. */
-        cutfeat = selectDivision(var_);
-        cutval = mean_[cutfeat];
+        cutfeat = selectDivision(var);
+        cutval = mean[cutfeat];
 
         int lim1, lim2;
         planeSplit(ind, count, cutfeat, cutval, lim1, lim2);
@@ -556,110 +680,37 @@ private:
 			heapSize = size_;
 		}
 		Heap<BranchSt>* heap = new Heap<BranchSt>(heapSize);
-		if(result.capacity_ < size_/ 8) {
-			BalancedTree<int>* checked(new BalancedTree<int>(NULL));
-
-			/* Search once through each tree down to root. */
-			for (i = 0; i < trees_; ++i) {
-				DistanceType* dists = new DistanceType[veclen_];
-				for (int i = 0; i < veclen_; i++) {
-					dists[i] = 0;
-				} 
-				
-				searchLevel<with_removed>(result, vec, dists, tree_roots_[i], 0, checkCount, maxCheck, epsError, heap, &checked);
-				delete[] dists;
-			}
-
-			/* Keep searching other branches from heap until finished. */
-			while (heap->popMin(branch)) {
-				if (checkCount < maxCheck || !result.full()) {
-					searchLevel<with_removed>(result, vec, branch.dists, branch.node, branch.mindist, checkCount, maxCheck, epsError, heap, &checked);
-				}
-				branch.clear();
-			}
-
-			checked->~BalancedTree<int>();
-		}
-		else {
-			DynamicBitset checked(size_);
 
-			/* Search once through each tree down to root. */
-			for (i = 0; i < trees_; ++i) {
-				DistanceType* dists = new DistanceType[veclen_];
-				for (int i = 0; i < veclen_; i++) {
-					dists[i] = 0;
-				}
-				searchLevel<with_removed>(result, vec, dists, tree_roots_[i], 0, checkCount, maxCheck, epsError, heap, checked);
-				delete[] dists;
-			}
-
-			/* Keep searching other branches from heap until finished. */
-			while (heap->popMin(branch)) {
-				if (checkCount < maxCheck || !result.full()) {
-					searchLevel<with_removed>(result, vec, branch.dists, branch.node, branch.mindist, checkCount, maxCheck, epsError, heap, checked);
-				}
-				branch.clear();
-			}
-		}
-		delete heap;
-    }
-
-	/**
-	*  Search starting from a given node of the tree.  Based on any mismatches at
-	*  higher levels, all exemplars below this level must have a distance of
-	*  at least "mindistsq".
-	*/
-	template<bool with_removed>
-	void searchLevel(ResultSet<DistanceType>& result_set, const ElementType* vec, DistanceType* dists_, NodePtr node, DistanceType mindist, int& checkCount, int maxCheck,
-		float epsError, Heap<BranchSt>* heap, BalancedTree<int>** checked) const
-	{
+		/* The distance vectors of the branches are taken from a pool which lives
+		as long as this query, so pushing a branch does not call the system
+		allocator. All vectors are released at once when the pool is destroyed.
+		*/
+		PooledAllocator distsPool(distsBlockSize());
 
-		if (result_set.worstDist()<mindist) {
-			//			printf("Ignoring branch, too far\n");
-			return;
-		}
+		/* Points which have already been checked in another tree. The set
+		belongs to the calling thread and starts a new epoch for every query,
+		so it is neither allocated nor cleared here.
+		*/
+		VisitedSet& checked = VisitedSet::local();
+		checked.reset(size_);
 
-		/* If this is a leaf node, then do check and return. */
-		if ((node->child1 == NULL) && (node->child2 == NULL)) {
-			int index = node->divfeat;
-			if (with_removed) {
-				if (removed_points_.test(index)) return;
-			}
-			/*  Do not check same node more than once when searching multiple trees. */
-			if ((*checked)->search(index) || ((checkCount >= maxCheck) && result_set.full())) return;
-			(*checked)->addNode((void**)checked, node->divfeat);
-			checkCount++;
+		/* Search once through each tree down to root. */
+		for (i = 0; i < trees_; ++i) {
+			DistanceType* dists = distsPool.allocate<DistanceType>(veclen_);
+			std::fill(dists, dists + veclen_, DistanceType(0));
 
-			result_set.addPoint(distance_(node->point, vec, veclen_), index);
-			return;
+			searchLevel<with_removed>(result, vec, dists, tree_roots_[i], 0, checkCount, maxCheck, epsError, heap, distsPool, checked);
 		}
 
-		/* Which child branch should be taken first? */
-		ElementType val = vec[node->divfeat];
-		DistanceType diff = val - node->divval;
-		NodePtr bestChild = (diff < 0) ? node->child1 : node->child2;
-		NodePtr otherChild = (diff < 0) ? node->child2 : node->child1;
-		/* Create a branch record for the branch not taken.  Add distance
-		of this feature boundary (we don't attempt to correct for any
-		use of this feature in a parent node, which is unlikely to
-		happen and would have only a small effect).  Don't bother
-		adding more branches to heap after halfway point, as cost of
-		adding exceeds their value.
-		*/
-
-		DistanceType new_distsq = mindist + distance_.accum_dist(val, node->divval, node->divfeat) -dists_[node->divfeat];
-		if ((new_distsq*epsError < result_set.worstDist()) || !result_set.full()){
-			DistanceType* dists = new DistanceType[veclen_];
-			for (int i = 0; i < veclen_; i++) {
-				dists[i] = dists_[i];
+		/* Keep searching other branches from heap until finished. */
+		while (heap->popMin(branch)) {
+			FLANN_STATISTICS(SearchStatistics::local().pops++);
+			if (checkCount < maxCheck || !result.full()) {
+				searchLevel<with_removed>(result, vec, branch.dists, branch.node, branch.mindist, checkCount, maxCheck, epsError, heap, distsPool, checked);
 			}
-			dists[node->divfeat] = distance_.accum_dist(val, node->divval, node->divfeat);
-			heap->insert(BranchSt(otherChild, new_distsq, dists));
 		}
-
-		/* Call recursively to search next level down. */
-		searchLevel<with_removed>(result_set, vec, dists_, bestChild, mindist, checkCount, maxCheck, epsError, heap, checked);
-	}
+		delete heap;
+    }
 
     /**
      *  Search starting from a given node of the tree.  Based on any mismatches at
@@ -668,15 +719,18 @@ private:
      */
     template<bool with_removed>
     void searchLevel(ResultSet<DistanceType>& result_set, const ElementType* vec, DistanceType* dists_, NodePtr node, DistanceType mindist, int& checkCount, int maxCheck,
-                     float epsError, Heap<BranchSt>* heap, DynamicBitset& checked) const
+                     float epsError, Heap<BranchSt>* heap, PooledAllocator& distsPool, VisitedSet& checked) const
     {
         if (result_set.worstDist()<mindist) {
             //			printf("Ignoring branch, too far\n");
+            FLANN_STATISTICS(SearchStatistics::local().pruned++);
             return;
         }
+        FLANN_STATISTICS(SearchStatistics::local().nodes++);
 
         /* If this is a leaf node, then do check and return. */
         if ((node->child1 == NULL)&&(node->child2 == NULL)) {
+            FLANN_STATISTICS(SearchStatistics::local().leaves++);
             int index = node->divfeat;
             if (with_removed) {
             	if (removed_points_.test(index)) return;
@@ -686,7 +740,8 @@ private:
             checked.set(index);
             checkCount++;
 
-            result_set.addPoint(distance_(node->point, vec, veclen_),index);
+            FLANN_STATISTICS(SearchStatistics::local().distances++);
+            result_set.addPoint(distance_(points_[index], vec, veclen_),index);
             return;
         }
 
@@ -707,16 +762,19 @@ private:
 		DistanceType new_distsq = mindist + distance_.accum_dist(val, node->divval, node->divfeat) - dists_[node->divfeat];
 		if ((new_distsq*epsError < result_set.worstDist()) || !result_set.full())
 		{
-			DistanceType* dists = new DistanceType[veclen_];
-			for (int i = 0; i < veclen_; i++) {
-				dists[i] = dists_[i];
-			}
+			DistanceType* dists = distsPool.allocate<DistanceType>(veclen_);
+			std::copy(dists_, dists_ + veclen_, dists);
 			dists[node->divfeat] = distance_.accum_dist(val, node->divval, node->divfeat);
 			heap->insert(BranchSt(otherChild, new_distsq, dists));
+			FLANN_STATISTICS(SearchStatistics::local().pushes++);
+			FLANN_STATISTICS(SearchStatistics::local().peak_heap = std::max(SearchStatistics::local().peak_heap, size_t(heap->size())));
+		}
+		else {
+			FLANN_STATISTICS(SearchStatistics::local().pruned++);
 		}
 
 		/* Call recursively to search next level down. */
-		searchLevel<with_removed>(result_set, vec, dists_, bestChild, mindist, checkCount, maxCheck, epsError, heap, checked);
+		searchLevel<with_removed>(result_set, vec, dists_, bestChild, mindist, checkCount, maxCheck, epsError, heap, distsPool, checked);
 
     }
 
@@ -727,13 +785,17 @@ private:
     void searchLevelExact(ResultSet<DistanceType>& result_set, const ElementType* vec, std::vector<ElementType> vecadd,
 		const NodePtr node, DistanceType mindist, const float epsError) const
     {
+        FLANN_STATISTICS(SearchStatistics::local().nodes++);
+
         /* If this is a leaf node, then do check and return. */
         if ((node->child1 == NULL)&&(node->child2 == NULL)) {
+            FLANN_STATISTICS(SearchStatistics::local().leaves++);
             int index = node->divfeat;
             if (with_removed) {
             	if (removed_points_.test(index)) return; // ignore removed points
             }
-            DistanceType dist = distance_(node->point, vec, veclen_);
+            FLANN_STATISTICS(SearchStatistics::local().distances++);
+            DistanceType dist = distance_(points_[index], vec, veclen_);
             result_set.addPoint(dist,index);
 
             return;
@@ -762,6 +824,9 @@ private:
 			vecadd[node->divfeat] = node->divval;
             searchLevelExact<with_removed>(result_set, vec, otherChild, new_distsq, epsError);
         }
+        else {
+            FLANN_STATISTICS(SearchStatistics::local().pruned++);
+        }
     }
 
 	/**
@@ -770,13 +835,17 @@ private:
 	template<bool with_removed>
 	void searchLevelExact(ResultSet<DistanceType>& result_set, const ElementType* vec, const NodePtr node, DistanceType mindist, const float epsError) const
 	{
+		FLANN_STATISTICS(SearchStatistics::local().nodes++);
+
 		/* If this is a leaf node, then do check and return. */
 		if ((node->child1 == NULL) && (node->child2 == NULL)) {
+			FLANN_STATISTICS(SearchStatistics::local().leaves++);
 			int index = node->divfeat;
 			if (with_removed) {
 				if (removed_points_.test(index)) return; // ignore removed points
 			}
-			DistanceType dist = distance_(node->point, vec, veclen_);
+			FLANN_STATISTICS(SearchStatistics::local().distances++);
+			DistanceType dist = distance_(points_[index], vec, veclen_);
 			result_set.addPoint(dist, index);
 
 			return;
@@ -804,8 +873,21 @@ private:
 		if (mindist*epsError <= result_set.worstDist()) {
 			searchLevelExact<with_removed>(result_set, vec, otherChild, new_distsq, epsError);
 		}
+		else {
+			FLANN_STATISTICS(SearchStatistics::local().pruned++);
+		}
 	}
 
+    /**
+     * Block size of the pool which serves the distance vectors of the branches
+     * during a single query. A block holds at least DISTS_PER_BLOCK vectors.
+     */
+    int distsBlockSize() const
+    {
+        size_t blocksize = DISTS_PER_BLOCK*veclen_*sizeof(DistanceType);
+        return int(std::max(blocksize, BLOCKSIZE));
+    }
+
     void addPointToTree(NodePtr node, int ind)
     {
         ElementType* point = points_[ind];
@@ -859,6 +941,7 @@ private:
     	std::swap(trees_, other.trees_);
     	std::swap(tree_roots_, other.tree_roots_);
     	std::swap(pool_, other.pool_);
+    	std::swap(mapping_, other.mapping_);
     }
 
 private:
@@ -878,7 +961,12 @@ private:
          * selected at random from among the top RAND_DIM dimensions with the
          * highest variance.  A value of 5 works well.
          */
-        RAND_DIM=5
+        RAND_DIM=5,
+        /**
+         * Number of branch distance vectors which fit into one block of the
+         * per-query pool, see distsBlockSize().
+         */
+        DISTS_PER_BLOCK=256
     };
 
 
@@ -887,9 +975,6 @@ private:
      */
     int trees_;
 
-    DistanceType* mean_;
-    DistanceType* var_;
-
     /**
      * Array of k-d trees used to find neighbours.
      */
@@ -904,6 +989,16 @@ private:
      */
     PooledAllocator pool_;
 
+    /**
+     * Serializes the allocations from pool_ of trees which are built in parallel.
+     */
+    std::mutex pool_mutex_;
+
+    /**
+     * File whose nodes are used by the trees of a mapped index.
+     */
+    std::shared_ptr<MappedFile> mapping_;
+
     USING_BASECLASS_SYMBOLS
 };   // class KDTreeIndex
 
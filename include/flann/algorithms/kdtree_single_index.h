@@ -44,6 +44,7 @@
 #include "flann/util/allocator.h"
 #include "flann/util/random.h"
 #include "flann/util/saving.h"
+#include "flann/util/mapping.h"
 
 namespace flann
 {
@@ -116,7 +117,7 @@ public:
             data_ = flann::Matrix<ElementType>(new ElementType[size_*veclen_], size_, veclen_);
             std::copy(other.data_[0], other.data_[0]+size_*veclen_, data_[0]);
         }
-        copyTree(root_node_, other.root_node_);
+        root_node_ = copyTree(other.root_node_);
     }
 
     KDTreeSingleIndex& operator=(KDTreeSingleIndex other)
@@ -199,6 +200,70 @@ public:
         la & *this;
     }
 
+    /**
+     * Saves the index into a file which can be mapped with mapIndex(). The
+     * nodes and the reordered points are stored uncompressed in the layout
+     * of the memory.
+     * @param filename Path of the file
+     */
+    void saveMappedIndex(const std::string& filename)
+    {
+        if (reorder_) index_params_["save_dataset"] = false;
+
+        MappedIndexWriter writer(filename, flann_datatype_value<ElementType>::value, getType(), sizeof(Node));
+        MappedState state(this);
+        writer.writeBase(state);
+
+        std::vector<char> nodes(countNodes(root_node_)*sizeof(Node), 0);
+        uint64_t root = 0;
+        size_t next = 0;
+        flattenTree(root_node_, (Node*)&nodes[0], next);
+
+        writer.writeSection(MAPPED_NODES, &nodes[0], nodes.size());
+        writer.writeSection(MAPPED_ROOTS, &root, sizeof(root));
+        if (reorder_) {
+            writer.writeSection(MAPPED_POINTS, data_.ptr(), size_*veclen_*sizeof(ElementType));
+        }
+        writer.close();
+    }
+
+    /**
+     * Maps a file of saveMappedIndex() into memory. The nodes and the
+     * reordered points are used in place, so processes which map the same
+     * file share its pages and the index is ready without deserializing the
+     * tree. The dataset has to be given to the constructor unless it has
+     * been saved with the index.
+     * @param filename Path of the file
+     * @param prefetch Loads the whole file into memory before returning
+     */
+    void mapIndex(const std::string& filename, bool prefetch = false)
+    {
+        MappedIndexReader reader(filename, flann_datatype_value<ElementType>::value, getType(), sizeof(Node));
+        freeIndex();
+        MappedState state(this);
+        reader.readBase(state);
+
+        size_t count = reader.count<Node>(MAPPED_NODES);
+        Node* nodes = reader.section<Node>(MAPPED_NODES, count);
+        const uint64_t* root = reader.section<uint64_t>(MAPPED_ROOTS, 1);
+        if (*root >= count) {
+            throw FLANNException("Invalid index file, root out of range");
+        }
+        root_node_ = nodes + *root;
+        if (reorder_) {
+            data_ = flann::Matrix<ElementType>(reader.section<ElementType>(MAPPED_POINTS, size_*veclen_), size_, veclen_);
+        }
+        mapping_ = reader.getFile();
+
+        if (prefetch) {
+            reader.prefetch();
+        }
+
+        index_params_["algorithm"] = getType();
+        index_params_["leaf_max_size"] = leaf_max_size_;
+        index_params_["reorder"] = reorder_;
+    }
+
     /**
      * Computes the inde memory usage
      * Returns: memory used by the index
@@ -274,9 +339,9 @@ private:
     	 */
     	DistanceType divlow, divhigh;
         /**
-         * The child nodes.
+         * The child nodes, relative so that the nodes can be mapped from a file.
          */
-        Node* child1, * child2;
+        RelativePtr<Node> child1, child2;
         
         ~Node()
         {
@@ -336,10 +401,38 @@ private:
     typedef BranchStruct<NodePtr, DistanceType> BranchSt;
     typedef BranchSt* Branch;
 
+    /**
+     * State of a mapped index which is not used in place
+     */
+    struct MappedState
+    {
+        MappedState(KDTreeSingleIndex* index) : index(index)
+        {
+        }
+
+        template<typename Archive>
+        void serialize(Archive& ar)
+        {
+            ar & *static_cast<NNIndex<Distance>*>(index);
+
+            ar & index->reorder_;
+            ar & index->leaf_max_size_;
+            ar & index->root_bbox_;
+            ar & index->vind_;
+        }
+
+        KDTreeSingleIndex* index;
+    };
 
     
     void freeIndex()
     {
+        if (mapping_) {
+            // the nodes and points of a mapped index belong to the file
+            data_ = flann::Matrix<ElementType>();
+            root_node_ = NULL;
+            mapping_.reset();
+        }
         if (data_.ptr()) {
             delete[] data_.ptr();
             data_ = flann::Matrix<ElementType>();
@@ -348,14 +441,41 @@ private:
         pool_.free();
     }
     
-    void copyTree(NodePtr& dst, const NodePtr& src)
+    NodePtr copyTree(const NodePtr src)
     {
-        dst = new(pool_) Node();
+        NodePtr dst = new(pool_) Node();
         *dst = *src;
         if (src->child1!=NULL && src->child2!=NULL) {
-            copyTree(dst->child1, src->child1);
-            copyTree(dst->child2, src->child2);
+            dst->child1 = copyTree(src->child1);
+            dst->child2 = copyTree(src->child2);
         }
+        return dst;
+    }
+
+    size_t countNodes(const NodePtr node) const
+    {
+        if (node->child1==NULL && node->child2==NULL) {
+            return 1;
+        }
+        return 1 + countNodes(node->child1) + countNodes(node->child2);
+    }
+
+    /**
+     * Copies the tree in preorder into an array of nodes
+     */
+    NodePtr flattenTree(const NodePtr src, Node* nodes, size_t& next) const
+    {
+        NodePtr dst = new(&nodes[next++]) Node();
+        dst->left = src->left;
+        dst->right = src->right;
+        dst->divfeat = src->divfeat;
+        dst->divlow = src->divlow;
+        dst->divhigh = src->divhigh;
+        if (src->child1!=NULL && src->child2!=NULL) {
+            dst->child1 = flattenTree(src->child1, nodes, next);
+            dst->child2 = flattenTree(src->child2, nodes, next);
+        }
+        return dst;
     }
 
 
@@ -593,13 +713,17 @@ private:
     void searchLevel(ResultSet<DistanceType>& result_set, const ElementType* vec, const NodePtr node, DistanceType mindistsq,
                      std::vector<DistanceType>& dists, const float epsError) const
     {
+        FLANN_STATISTICS(SearchStatistics::local().nodes++);
+
         /* If this is a leaf node, then do check and return. */
         if ((node->child1 == NULL)&&(node->child2 == NULL)) {
+            FLANN_STATISTICS(SearchStatistics::local().leaves++);
             DistanceType worst_dist = result_set.worstDist();
             for (int i=node->left; i<node->right; ++i) {
                 if (with_removed) {
                     if (removed_points_.test(vind_[i])) continue;
                 }
+                FLANN_STATISTICS(SearchStatistics::local().distances++);
                 ElementType* point = reorder_ ? data_[i] : points_[vind_[i]];
                 DistanceType dist = distance_(vec, point, veclen_, worst_dist);
                 if (dist<worst_dist) {
@@ -638,6 +762,9 @@ private:
         if (mindistsq*epsError<=result_set.worstDist()) {
             searchLevel<with_removed>(result_set, vec, otherChild, mindistsq, dists, epsError);
         }
+        else {
+            FLANN_STATISTICS(SearchStatistics::local().pruned++);
+        }
         dists[idx] = dst;
     }
 
@@ -652,6 +779,7 @@ private:
         std::swap(root_node_, other.root_node_);
         std::swap(root_bbox_, other.root_bbox_);
         std::swap(pool_, other.pool_);
+        std::swap(mapping_, other.mapping_);
     }
     
 private:
@@ -689,6 +817,11 @@ private:
      */
     PooledAllocator pool_;
 
+    /**
+     * File whose nodes and points are used by a mapped index.
+     */
+    std::shared_ptr<MappedFile> mapping_;
+
     USING_BASECLASS_SYMBOLS
 
 };   // class KDTreeSingleIndex
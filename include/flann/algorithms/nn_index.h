@@ -31,6 +31,9 @@
 #ifndef FLANN_NNINDEX_H
 #define FLANN_NNINDEX_H
 
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "flann/general.h"
@@ -39,6 +42,9 @@
 #include "flann/util/result_set.h"
 #include "flann/util/dynamic_bitset.h"
 #include "flann/util/saving.h"
+#include "flann/util/schedule.h"
+#include "flann/util/memory_tracker.h"
+#include "flann/util/thread_pool.h"
 
 namespace flann
 {
@@ -324,34 +330,26 @@ public:
     	int count = 0;
 
     	if (use_heap) {
-#pragma omp parallel num_threads(params.cores)
-    		{
-    			KNNResultSet2<DistanceType> resultSet(knn);
-#pragma omp for schedule(static) reduction(+:count)
-    			for (int i = 0; i < (int)queries.rows; i++) {
+    		count = searchBatch(queries.rows, params, KNNResultSet2<DistanceType>(knn),
+    			[&](KNNResultSet2<DistanceType>& resultSet, int i) -> int {
     				resultSet.clear();
     				findNeighbors(resultSet, queries[i], params);
     				size_t n = std::min(resultSet.size(), knn);
 					resultSet.copy(indices[i], dists[i], n, params.sorted);
     				indices_to_ids(indices[i], indices[i], n);
-    				count += n;
-    			}
-    		}
+    				return n;
+    			});
     	}
     	else {
-#pragma omp parallel num_threads(params.cores)
-    		{
-    			KNNSimpleResultSet<DistanceType> resultSet(knn);
-#pragma omp for schedule(static) reduction(+:count)
-    			for (int i = 0; i < (int)queries.rows; i++) {
+    		count = searchBatch(queries.rows, params, KNNSimpleResultSet<DistanceType>(knn),
+    			[&](KNNSimpleResultSet<DistanceType>& resultSet, int i) -> int {
     				resultSet.clear();
     				findNeighbors(resultSet, queries[i], params);
     				size_t n = std::min(resultSet.size(), knn);
     				resultSet.copy(indices[i], dists[i], n, params.sorted);
     				indices_to_ids(indices[i], indices[i], n);
-    				count += n;
-    			}
-    		}
+    				return n;
+    			});
     	}
     	return count;
     }
@@ -412,11 +410,8 @@ public:
 
 		int count = 0;
 		if (use_heap) {
-#pragma omp parallel num_threads(params.cores)
-			{
-				KNNResultSet2<DistanceType> resultSet(knn);
-#pragma omp for schedule(static) reduction(+:count)
-				for (int i = 0; i < (int)queries.rows; i++) {
+			count = searchBatch(queries.rows, params, KNNResultSet2<DistanceType>(knn),
+				[&](KNNResultSet2<DistanceType>& resultSet, int i) -> int {
 					resultSet.clear();
 					findNeighbors(resultSet, queries[i], params);
 					size_t n = std::min(resultSet.size(), knn);
@@ -426,16 +421,12 @@ public:
 						resultSet.copy(&indices[i][0], &dists[i][0], n, params.sorted);
 						indices_to_ids(&indices[i][0], &indices[i][0], n);
 					}
-					count += n;
-				}
-			}
+					return n;
+				});
 		}
 		else {
-#pragma omp parallel num_threads(params.cores)
-			{
-				KNNSimpleResultSet<DistanceType> resultSet(knn);
-#pragma omp for schedule(static) reduction(+:count)
-				for (int i = 0; i < (int)queries.rows; i++) {
+			count = searchBatch(queries.rows, params, KNNSimpleResultSet<DistanceType>(knn),
+				[&](KNNSimpleResultSet<DistanceType>& resultSet, int i) -> int {
 					resultSet.clear();
 					findNeighbors(resultSet, queries[i], params);
 					size_t n = std::min(resultSet.size(), knn);
@@ -445,9 +436,8 @@ public:
 						resultSet.copy(&indices[i][0], &dists[i][0], n, params.sorted);
 						indices_to_ids(&indices[i][0], &indices[i][0], n);
 					}
-					count += n;
-				}
-			}
+					return n;
+				});
 		}
 
 		return count;
@@ -502,30 +492,23 @@ public:
     	else max_neighbors = std::min(max_neighbors,(int)num_neighbors);
 
     	if (max_neighbors==0) {
-#pragma omp parallel num_threads(params.cores)
-    		{
-    			CountRadiusResultSet<DistanceType> resultSet(radius);
-#pragma omp for schedule(static) reduction(+:count)
-    			for (int i = 0; i < (int)queries.rows; i++) {
+    		count = searchBatch(queries.rows, params, CountRadiusResultSet<DistanceType>(radius),
+    			[&](CountRadiusResultSet<DistanceType>& resultSet, int i) -> int {
     				resultSet.clear();
     				findNeighbors(resultSet, queries[i], params);
-    				count += resultSet.size();
-    			}
-    		}
+    				return resultSet.size();
+    			});
     	}
     	else {
     		// explicitly indicated to use unbounded radius result set
     		// and we know there'll be enough room for resulting indices and dists
     		if (params.max_neighbors<0 && (num_neighbors>=size())) {
-#pragma omp parallel num_threads(params.cores)
-    			{
-    				RadiusResultSet<DistanceType> resultSet(radius);
-#pragma omp for schedule(static) reduction(+:count)
-    				for (int i = 0; i < (int)queries.rows; i++) {
+    			count = searchBatch(queries.rows, params, RadiusResultSet<DistanceType>(radius),
+    				[&](RadiusResultSet<DistanceType>& resultSet, int i) -> int {
     					resultSet.clear();
     					findNeighbors(resultSet, queries[i], params);
-    					size_t n = resultSet.size();
-    					count += n;
+    					size_t found = resultSet.size();
+    					size_t n = found;
     					if (n>num_neighbors) n = num_neighbors;
     					resultSet.copy(indices[i], dists[i], n, params.sorted);
 
@@ -533,20 +516,17 @@ public:
     					if (n<indices.cols) indices[i][n] = size_t(-1);
     					if (n<dists.cols) dists[i][n] = std::numeric_limits<DistanceType>::infinity();
     					indices_to_ids(indices[i], indices[i], n);
-    				}
-    			}
+    					return found;
+    				});
     		}
     		else {
     			// number of neighbors limited to max_neighbors
-#pragma omp parallel num_threads(params.cores)
-    			{
-    				KNNRadiusResultSet<DistanceType> resultSet(radius, max_neighbors);
-#pragma omp for schedule(static) reduction(+:count)
-    				for (int i = 0; i < (int)queries.rows; i++) {
+    			count = searchBatch(queries.rows, params, KNNRadiusResultSet<DistanceType>(radius, max_neighbors),
+    				[&](KNNRadiusResultSet<DistanceType>& resultSet, int i) -> int {
     					resultSet.clear();
     					findNeighbors(resultSet, queries[i], params);
-    					size_t n = resultSet.size();
-    					count += n;
+    					size_t found = resultSet.size();
+    					size_t n = found;
     					if ((int)n>max_neighbors) n = max_neighbors;
     					resultSet.copy(indices[i], dists[i], n, params.sorted);
 
@@ -554,8 +534,8 @@ public:
     					if (n<indices.cols) indices[i][n] = size_t(-1);
     					if (n<dists.cols) dists[i][n] = std::numeric_limits<DistanceType>::infinity();
     					indices_to_ids(indices[i], indices[i], n);
-    				}
-    			}
+    					return found;
+    				});
     		}
     	}
         return count;
@@ -608,16 +588,12 @@ public:
     	int count = 0;
     	// just count neighbors
     	if (params.max_neighbors==0) {
-#pragma omp parallel num_threads(params.cores)
-    		{
-    			CountRadiusResultSet<DistanceType> resultSet(radius);
-#pragma omp for schedule(static) reduction(+:count)
-    			for (int i = 0; i < (int)queries.rows; i++) {
+    		count = searchBatch(queries.rows, params, CountRadiusResultSet<DistanceType>(radius),
+    			[&](CountRadiusResultSet<DistanceType>& resultSet, int i) -> int {
     				resultSet.clear();
     				findNeighbors(resultSet, queries[i], params);
-    				count += resultSet.size();
-    			}
-    		}
+    				return resultSet.size();
+    			});
     	}
     	else {
     		if (indices.size() < queries.rows ) indices.resize(queries.rows);
@@ -625,35 +601,28 @@ public:
 
     		if (params.max_neighbors<0) {
     			// search for all neighbors
-#pragma omp parallel num_threads(params.cores)
-    			{
-    				RadiusResultSet<DistanceType> resultSet(radius);
-#pragma omp for schedule(static) reduction(+:count)
-    				for (int i = 0; i < (int)queries.rows; i++) {
+    			count = searchBatch(queries.rows, params, RadiusResultSet<DistanceType>(radius),
+    				[&](RadiusResultSet<DistanceType>& resultSet, int i) -> int {
     					resultSet.clear();
     					findNeighbors(resultSet, queries[i], params);
     					size_t n = resultSet.size();
-    					count += n;
     					indices[i].resize(n);
     					dists[i].resize(n);
     					if (n > 0) {
     						resultSet.copy(&indices[i][0], &dists[i][0], n, params.sorted);
         					indices_to_ids(&indices[i][0], &indices[i][0], n);
     					}
-    				}
-    			}
+    					return n;
+    				});
     		}
     		else {
     			// number of neighbors limited to max_neighbors
-#pragma omp parallel num_threads(params.cores)
-    			{
-    				KNNRadiusResultSet<DistanceType> resultSet(radius, params.max_neighbors);
-#pragma omp for schedule(static) reduction(+:count)
-    				for (int i = 0; i < (int)queries.rows; i++) {
+    			count = searchBatch(queries.rows, params, KNNRadiusResultSet<DistanceType>(radius, params.max_neighbors),
+    				[&](KNNRadiusResultSet<DistanceType>& resultSet, int i) -> int {
     					resultSet.clear();
     					findNeighbors(resultSet, queries[i], params);
-    					size_t n = resultSet.size();
-    					count += n;
+    					size_t found = resultSet.size();
+    					size_t n = found;
     					if ((int)n>params.max_neighbors) n = params.max_neighbors;
     					indices[i].resize(n);
     					dists[i].resize(n);
@@ -661,8 +630,8 @@ public:
     						resultSet.copy(&indices[i][0], &dists[i][0], n, params.sorted);
         					indices_to_ids(&indices[i][0], &indices[i][0], n);
     					}
-    				}
-    			}
+    					return found;
+    				});
     		}
     	}
     	return count;
@@ -698,6 +667,86 @@ public:
 
 protected:
 
+    /**
+     * Runs body(resultSet, i) for every query i of a batch on params.cores threads
+     * of the worker pool of this index (0 for the number of hardware threads).
+     * The queries are distributed among the threads according to params.schedule
+     * and every thread works on its own copy of the given result set.
+     * @param[in] rows Number of queries in the batch
+     * @param[in] params Search parameters
+     * @param[in] resultSet Result set which is copied for every thread
+     * @param[in] body Search of a single query, returns the number of neighbors found
+     * @return Sum of the values returned by body
+     */
+    template <typename ResultSetType, typename Body>
+    int searchBatch(size_t rows, const SearchParams& params, const ResultSetType& resultSet, Body body) const
+    {
+    	std::shared_ptr<ThreadPool> workers = getWorkers(params.cores);
+    	int threads = std::min(ThreadPool::resolveThreads(params.cores), workers->size());
+
+    	BatchScheduler scheduler((int)rows, threads, params.schedule, params.chunk_size);
+    	std::vector<int> counts(threads, 0);
+    	std::vector<double> times(threads, 0);
+    	std::vector<size_t> allocations(threads, 0);
+
+    	FLANN_STATISTICS(if (params.statistics) params.statistics->assign(rows, SearchStatistics()));
+
+    	workers->run(threads, [&](int thread, int) {
+    		ResultSetType threadResultSet(resultSet);
+    		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    		// the copy of the result set is not counted, the queries themselves should not allocate
+    		MemoryTracker::Scope scope;
+
+    		int count = 0;
+    		int begin, end;
+    		while (scheduler.next(thread, begin, end)) {
+    			for (int i = begin; i < end; i++) {
+    				FLANN_STATISTICS(SearchStatistics::local().clear());
+    				count += body(threadResultSet, i);
+    				FLANN_STATISTICS(SearchStatistics::local().queries = 1);
+    				FLANN_STATISTICS(if (params.statistics) (*params.statistics)[i] = SearchStatistics::local());
+    			}
+    		}
+
+    		counts[thread] = count;
+    		allocations[thread] = scope.allocations();
+    		times[thread] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    	});
+
+    	if (params.thread_times) {
+    		*params.thread_times = times;
+    	}
+    	if (params.thread_allocations) {
+    		*params.thread_allocations = allocations;
+    	}
+
+    	int count = 0;
+    	for (int i = 0; i < threads; i++) {
+    		count += counts[i];
+    	}
+    	return count;
+    }
+
+    /**
+     * Returns the worker pool of this index, which is shared by the searches and
+     * the tree builders. The pool is created on first use and is replaced by a
+     * larger one when more threads are requested than it holds. The workers are
+     * pinned to their cores if the index parameter "pin_threads" is true, pinning is
+     * off by default since the pools of several indices would share the same cores.
+     * @param[in] threads Number of threads which are requested, 0 for the number of hardware threads
+     * @return Worker pool with at least the requested number of threads
+     */
+    std::shared_ptr<ThreadPool> getWorkers(int threads) const
+    {
+    	threads = ThreadPool::resolveThreads(threads);
+
+    	std::lock_guard<std::mutex> lock(workers_mutex_);
+    	if (!workers_ || workers_->size() < threads) {
+    		workers_ = std::make_shared<ThreadPool>(threads, get_param(index_params_, "pin_threads", false));
+    	}
+    	return workers_;
+    }
+
     virtual void freeIndex() = 0;
 
     virtual void buildIndexImpl() = 0;
@@ -813,6 +862,7 @@ protected:
     	std::swap(ids_, other.ids_);
     	std::swap(points_, other.points_);
     	std::swap(data_ptr_, other.data_ptr_);
+    	std::swap(workers_, other.workers_);
     }
 
 protected:
@@ -880,6 +930,11 @@ protected:
      */
     ElementType* data_ptr_;
 
+    /**
+     * Worker pool used for batch searches and tree building, see getWorkers()
+     */
+    mutable std::shared_ptr<ThreadPool> workers_;
+    mutable std::mutex workers_mutex_;
 
 };
 
@@ -897,7 +952,8 @@ protected:
 		using NNIndex<Distance>::extendDataset;\
 		using NNIndex<Distance>::setDataset;\
 		using NNIndex<Distance>::cleanRemovedPoints;\
-		using NNIndex<Distance>::indices_to_ids;
+		using NNIndex<Distance>::indices_to_ids;\
+		using NNIndex<Distance>::getWorkers;
 
 
 
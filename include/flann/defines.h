@@ -149,6 +149,14 @@ enum flann_checks_t {
     FLANN_CHECKS_AUTOTUNED = -2,
 };
 
+/* Distribution of the queries of a batch search among the cores */
+enum flann_schedule_t
+{
+    FLANN_SCHEDULE_STATIC       = 0,
+    FLANN_SCHEDULE_DYNAMIC      = 1,
+    FLANN_SCHEDULE_STEALING     = 2
+};
+
 #ifdef __cplusplus
 }
 #endif
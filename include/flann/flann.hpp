@@ -184,6 +184,18 @@ public:
         fclose(fout);
     }
 
+    /**
+     * Save index to file
+     * @param filename
+     * @param params Compression of the file, e.g. independent blocks which
+     *        are compressed in parallel
+     */
+    void save(std::string filename, const serialization::CompressionParams& params)
+    {
+        serialization::ScopedCompressionParams scoped(params);
+        save(filename);
+    }
+
     /**
      * \returns number of features in this index.
      */
@@ -32,7 +32,13 @@
 
 #include <hdf5.h>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
 #include "flann/util/matrix.h"
+#include "flann/util/thread_pool.h"
 
 
 namespace flann
@@ -69,13 +75,67 @@ template<>
 hid_t get_hdf5_type<double>() { return H5T_NATIVE_DOUBLE; }
 template<>
 hid_t get_hdf5_type<long double>() { return H5T_NATIVE_LDOUBLE; }
+
+/**
+ * Closes a hdf5 object when it goes out of scope
+ */
+class ScopedHandle
+{
+public:
+    ScopedHandle(hid_t id, herr_t (*close)(hid_t)) : id_(id), close_(close) {}
+
+    ~ScopedHandle()
+    {
+        if (id_>=0) close_(id_);
+    }
+
+    operator hid_t() const { return id_; }
+
+private:
+    ScopedHandle(const ScopedHandle&);
+    ScopedHandle& operator=(const ScopedHandle&);
+
+    hid_t id_;
+    herr_t (*close_)(hid_t);
+};
+
+hid_t open_dataset(hid_t file_id, const std::string& name)
+{
+#if H5Dopen_vers == 2
+    return H5Dopen2(file_id, name.c_str(), H5P_DEFAULT);
+#else
+    return H5Dopen(file_id, name.c_str());
+#endif
+}
 }
 
 
 #define CHECK_ERROR(x,y) if ((x)<0) throw FLANNException((y));
 
+/**
+ * Storage settings of the datasets created by save_to_file()
+ */
+struct HDF5StorageParams
+{
+    HDF5StorageParams(size_t chunk_rows = 0, int deflate = 0, bool shuffle = false) :
+        chunk_rows(chunk_rows), deflate(deflate), shuffle(shuffle)
+    {
+    }
+
+    /** Number of rows of a chunk, 0 for chunks of about 1MB */
+    size_t chunk_rows;
+    /** Level of the deflate compression in [1,9], 0 to store the chunks uncompressed */
+    int deflate;
+    /** Groups the bytes of the elements by significance before they are compressed */
+    bool shuffle;
+};
+
+
+namespace
+{
+
 template<typename T>
-void save_to_file(const flann::Matrix<T>& dataset, const std::string& filename, const std::string& name)
+void write_dataset(const flann::Matrix<T>& dataset, const std::string& filename, const std::string& name, hid_t plist_id)
 {
 
 #if H5Eset_auto_vers == 2
@@ -101,17 +161,13 @@ void save_to_file(const flann::Matrix<T>& dataset, const std::string& filename,
 
     hid_t dataset_id;
 #if H5Dcreate_vers == 2
-    dataset_id = H5Dcreate2(file_id, name.c_str(), get_hdf5_type<T>(), space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    dataset_id = H5Dcreate2(file_id, name.c_str(), get_hdf5_type<T>(), space_id, H5P_DEFAULT, plist_id, H5P_DEFAULT);
 #else
-    dataset_id = H5Dcreate(file_id, name.c_str(), get_hdf5_type<T>(), space_id, H5P_DEFAULT);
+    dataset_id = H5Dcreate(file_id, name.c_str(), get_hdf5_type<T>(), space_id, plist_id);
 #endif
 
     if (dataset_id<0) {
-#if H5Dopen_vers == 2
-        dataset_id = H5Dopen2(file_id, name.c_str(), H5P_DEFAULT);
-#else
-        dataset_id = H5Dopen(file_id, name.c_str());
-#endif
+        dataset_id = open_dataset(file_id, name);
     }
     CHECK_ERROR(dataset_id,"Error creating or opening dataset in file.");
 
@@ -125,35 +181,260 @@ void save_to_file(const flann::Matrix<T>& dataset, const std::string& filename,
 
 }
 
+/**
+ * Reads the rows [first, first+rows) of a dataset into a matrix
+ */
+template<typename T>
+void read_rows(hid_t dataset_id, hsize_t first, hsize_t rows, const flann::Matrix<T>& dataset, size_t row)
+{
+    if (rows==0) return;
+    if (dataset.stride%sizeof(T)!=0) {
+        throw FLANNException("Unsupported stride of the matrix");
+    }
+
+    ScopedHandle space_id(H5Dget_space(dataset_id), H5Sclose);
+    hsize_t offset[2] = { first, 0 };
+    hsize_t count[2] = { rows, dataset.cols };
+    CHECK_ERROR(H5Sselect_hyperslab(space_id, H5S_SELECT_SET, offset, NULL, count, NULL), "Error selecting rows of dataset");
+
+    hsize_t memory[2] = { rows, dataset.stride/sizeof(T) };
+    hsize_t origin[2] = { 0, 0 };
+    ScopedHandle memspace_id(H5Screate_simple(2, memory, NULL), H5Sclose);
+    CHECK_ERROR(H5Sselect_hyperslab(memspace_id, H5S_SELECT_SET, origin, NULL, count, NULL), "Error selecting rows of matrix");
 
+    herr_t status = H5Dread(dataset_id, get_hdf5_type<T>(), memspace_id, space_id, H5P_DEFAULT, dataset[row]);
+    CHECK_ERROR(status, "Error reading dataset");
+}
+
+/**
+ * Reverses the shuffle filter, which stores the i-th bytes of all elements of
+ * a chunk one after another
+ */
+inline void unshuffle(const std::vector<unsigned char>& src, std::vector<unsigned char>& dst, size_t size)
+{
+    size_t count = src.size()/size;
+    dst.resize(src.size());
+    for (size_t j = 0; j < size; ++j) {
+        const unsigned char* plane = &src[j*count];
+        for (size_t i = 0; i < count; ++i) {
+            dst[i*size+j] = plane[i];
+        }
+    }
+}
+}
+
+
+/**
+ * Saves a dataset into a hdf5 file as contiguous data.
+ * @param dataset Dataset to save
+ * @param filename HDF5 file name
+ * @param name Name of dataset inside file
+ */
 template<typename T>
-void load_from_file(flann::Matrix<T>& dataset, const std::string& filename, const std::string& name)
+void save_to_file(const flann::Matrix<T>& dataset, const std::string& filename, const std::string& name)
 {
-    herr_t status;
-    hid_t file_id = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+    write_dataset(dataset, filename, name, H5P_DEFAULT);
+}
+
+/**
+ * Saves a dataset into a hdf5 file in chunks of rows, which are compressed
+ * if the parameters ask for it. The chunks can be read and decoded in
+ * parallel by load_rows_from_file(). An existing dataset keeps its storage.
+ * @param dataset Dataset to save
+ * @param filename HDF5 file name
+ * @param name Name of dataset inside file
+ * @param params Chunking and compression of the dataset
+ */
+template<typename T>
+void save_to_file(const flann::Matrix<T>& dataset, const std::string& filename, const std::string& name, const HDF5StorageParams& params)
+{
+    size_t row_size = std::max<size_t>(dataset.cols*sizeof(T), 1);
+    hsize_t chunk[2];
+    chunk[0] = params.chunk_rows>0 ? params.chunk_rows : std::max<size_t>((1<<20)/row_size, 1);
+    // chunks are limited to 4GB and should not be larger than the dataset
+    chunk[0] = std::min<hsize_t>(chunk[0], std::max<size_t>(((size_t)1<<31)/row_size, 1));
+    chunk[0] = std::max<hsize_t>(std::min<hsize_t>(chunk[0], dataset.rows), 1);
+    chunk[1] = std::max<size_t>(dataset.cols, 1);
+
+    ScopedHandle plist_id(H5Pcreate(H5P_DATASET_CREATE), H5Pclose);
+    CHECK_ERROR(H5Pset_chunk(plist_id, 2, chunk), "Error setting the chunks of dataset");
+    if (params.shuffle) {
+        CHECK_ERROR(H5Pset_shuffle(plist_id), "Error setting the shuffle filter");
+    }
+    if (params.deflate>0) {
+        CHECK_ERROR(H5Pset_deflate(plist_id, std::min(params.deflate, 9)), "Error setting the deflate filter");
+    }
+    write_dataset(dataset, filename, name, plist_id);
+}
+
+
+/**
+ * Returns the dimensions of a dataset in a hdf5 file, e.g. to allocate the
+ * matrix for load_rows_from_file().
+ * @param filename HDF5 file name
+ * @param name Name of dataset inside file
+ * @param rows Number of rows of the dataset
+ * @param cols Number of columns of the dataset
+ */
+inline void get_dataset_dimensions(const std::string& filename, const std::string& name, size_t& rows, size_t& cols)
+{
+    ScopedHandle file_id(H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose);
     CHECK_ERROR(file_id,"Error opening hdf5 file.");
+    ScopedHandle dataset_id(open_dataset(file_id, name), H5Dclose);
+    CHECK_ERROR(dataset_id,"Error opening dataset in file.");
+    ScopedHandle space_id(H5Dget_space(dataset_id), H5Sclose);
 
-    hid_t dataset_id;
-#if H5Dopen_vers == 2
-    dataset_id = H5Dopen2(file_id, name.c_str(), H5P_DEFAULT);
-#else
-    dataset_id = H5Dopen(file_id, name.c_str());
-#endif
+    hsize_t dims[2];
+    if (H5Sget_simple_extent_ndims(space_id)!=2 || H5Sget_simple_extent_dims(space_id, dims, NULL)<0) {
+        throw FLANNException("Dataset is not a matrix");
+    }
+    rows = dims[0];
+    cols = dims[1];
+}
+
+
+/**
+ * Loads the rows [first_row, first_row+dataset.rows) of a dataset in a hdf5
+ * file into a matrix which has already been allocated, so that a large
+ * dataset can be loaded in tiles.
+ *
+ * The chunks of chunked datasets whose filters are at most the shuffle and
+ * deflate filters of save_to_file() are read by a number of threads. Chunks
+ * without the deflate filter are read raw and decoded concurrently, deflated
+ * chunks are read as hyperslabs of whole chunks through the filter pipeline
+ * of the library. Other datasets are read as one hyperslab.
+ * @param dataset Matrix with the number of rows to load and as many columns as the dataset
+ * @param filename HDF5 file name
+ * @param name Name of dataset inside file
+ * @param first_row First row to load
+ * @param threads Number of threads, 0 for the number of hardware threads
+ */
+template<typename T>
+void load_rows_from_file(const flann::Matrix<T>& dataset, const std::string& filename, const std::string& name, size_t first_row = 0, int threads = 0)
+{
+    ScopedHandle file_id(H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose);
+    CHECK_ERROR(file_id,"Error opening hdf5 file.");
+    ScopedHandle dataset_id(open_dataset(file_id, name), H5Dclose);
     CHECK_ERROR(dataset_id,"Error opening dataset in file.");
 
-    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[2];
+    {
+        ScopedHandle space_id(H5Dget_space(dataset_id), H5Sclose);
+        if (H5Sget_simple_extent_ndims(space_id)!=2 || H5Sget_simple_extent_dims(space_id, dims, NULL)<0) {
+            throw FLANNException("Dataset is not a matrix");
+        }
+    }
+    if (dims[1]!=dataset.cols || first_row+dataset.rows>dims[0]) {
+        throw FLANNException("Rows out of the range of the dataset");
+    }
+    if (dataset.rows==0) return;
+
+#if H5_VERSION_GE(1,10,2)
+    // check if the chunks can be decoded here
+    ScopedHandle plist_id(H5Dget_create_plist(dataset_id), H5Pclose);
+    ScopedHandle type_id(H5Dget_type(dataset_id), H5Tclose);
+    hsize_t chunk[2] = { 0, 0 };
+    bool decode = H5Pget_layout(plist_id)==H5D_CHUNKED && H5Pget_chunk(plist_id, 2, chunk)==2 &&
+            chunk[1]==dims[1] && H5Tequal(type_id, get_hdf5_type<T>())>0;
+
+    // deflated chunks are decoded by the library, so flann does not depend on zlib
+    bool pipeline = false;
+    std::vector<H5Z_filter_t> filters;
+    int nfilters = decode ? H5Pget_nfilters(plist_id) : 0;
+    for (int i = 0; i < nfilters; ++i) {
+        unsigned int flags;
+        size_t cd_nelmts = 0;
+        H5Z_filter_t filter = H5Pget_filter2(plist_id, i, &flags, &cd_nelmts, NULL, 0, NULL, NULL);
+        if (filter==H5Z_FILTER_DEFLATE) {
+            pipeline = true;
+            continue;
+        }
+        if (filter==H5Z_FILTER_SHUFFLE) {
+            filters.push_back(filter);
+            continue;
+        }
+        decode = false;
+    }
 
-    hsize_t dims_out[2];
-    H5Sget_simple_extent_dims(space_id, dims_out, NULL);
+    if (!decode) {
+        read_rows(dataset_id, first_row, dataset.rows, dataset, 0);
+        return;
+    }
 
-    dataset = flann::Matrix<T>(new T[dims_out[0]*dims_out[1]], dims_out[0], dims_out[1]);
+    size_t chunk_rows = chunk[0];
+    size_t row_size = dims[1]*sizeof(T);
+    size_t chunk_size = chunk_rows*row_size;
+    size_t last_row = first_row+dataset.rows;
+    size_t first_chunk = first_row/chunk_rows;
+    size_t last_chunk = (last_row+chunk_rows-1)/chunk_rows;
+
+    // the library is called by one thread at a time, raw chunks are decoded concurrently
+    std::mutex mutex;
+    std::atomic<size_t> next(first_chunk);
+    ThreadPool pool(std::min<size_t>(threads>0 ? threads : std::thread::hardware_concurrency(), last_chunk-first_chunk));
+
+    pool.run(pool.size(), [&](int, int) {
+        std::vector<unsigned char> raw, buffer;
+        for (size_t c = next++; c < last_chunk; c = next++) {
+            size_t begin = std::max(first_row, c*chunk_rows);
+            size_t end = std::min(last_row, (c+1)*chunk_rows);
+            hsize_t offset[2] = { c*chunk_rows, 0 };
+            uint32_t mask = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                hsize_t size = 0;
+                if (pipeline || H5Dget_chunk_storage_size(dataset_id, offset, &size)<0 || size==0) {
+                    // the chunk is deflated or has never been written and holds the fill value
+                    read_rows(dataset_id, begin, end-begin, dataset, begin-first_row);
+                    continue;
+                }
+                raw.resize(size);
+                CHECK_ERROR(H5Dread_chunk(dataset_id, H5P_DEFAULT, offset, &mask, &raw[0]), "Error reading chunk of dataset");
+            }
+
+            for (size_t i = filters.size(); i-- > 0; ) {
+                if (mask & (1u<<i)) continue;
+                unshuffle(raw, buffer, sizeof(T));
+                raw.swap(buffer);
+            }
+            if (raw.size()!=chunk_size) {
+                throw FLANNException("Invalid size of chunk of dataset");
+            }
+
+            for (size_t row = begin; row < end; ++row) {
+                const unsigned char* src = raw.data()+(row-c*chunk_rows)*row_size;
+                std::copy(src, src+row_size, reinterpret_cast<unsigned char*>(dataset[row-first_row]));
+            }
+        }
+    });
+#else
+    // chunks can only be read directly since hdf5 1.10.2
+    read_rows(dataset_id, first_row, dataset.rows, dataset, 0);
+#endif
+}
 
-    status = H5Dread(dataset_id, get_hdf5_type<T>(), H5S_ALL, H5S_ALL, H5P_DEFAULT, dataset[0]);
-    CHECK_ERROR(status, "Error reading dataset");
 
-    H5Sclose(space_id);
-    H5Dclose(dataset_id);
-    H5Fclose(file_id);
+/**
+ * Loads a dataset from a hdf5 file into a newly allocated matrix.
+ * @param dataset Dataset where the data is loaded
+ * @param filename HDF5 file name
+ * @param name Name of dataset inside file
+ */
+template<typename T>
+void load_from_file(flann::Matrix<T>& dataset, const std::string& filename, const std::string& name)
+{
+    size_t rows, cols;
+    get_dataset_dimensions(filename, name, rows, cols);
+
+    flann::Matrix<T> result(new T[rows*cols], rows, cols);
+    try {
+        load_rows_from_file(result, filename, name);
+    }
+    catch (...) {
+        delete[] result.ptr();
+        throw;
+    }
+    dataset = result;
 }
 
 
@@ -31,8 +31,13 @@
 #ifndef FLANN_GROUND_TRUTH_H_
 #define FLANN_GROUND_TRUTH_H_
 
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
 #include "flann/algorithms/dist.h"
 #include "flann/util/matrix.h"
+#include "flann/util/thread_pool.h"
 
 
 namespace flann
@@ -83,13 +88,210 @@ void find_nearest(const Matrix<typename Distance::ElementType>& dataset, typenam
 }
 
 
+/**
+ * Computes the distances of a query to a block of consecutive points. A
+ * worker loads a block into its own tile before it computes the distances
+ * of its queries to the block. This version needs no tile and calls the
+ * distance functor for every point.
+ */
 template <typename Distance>
-void compute_ground_truth(const Matrix<typename Distance::ElementType>& dataset, const Matrix<typename Distance::ElementType>& testset, Matrix<size_t>& matches,
-                          int skip=0, Distance d = Distance())
+class GroundTruthBlock
 {
-    for (size_t i=0; i<testset.rows; ++i) {
-        find_nearest<Distance>(dataset, testset[i], matches[i], matches.cols, skip, d);
+public:
+    typedef typename Distance::ElementType ElementType;
+    typedef typename Distance::ResultType DistanceType;
+
+    GroundTruthBlock(const Matrix<ElementType>& dataset, const Distance& distance) :
+        dataset_(dataset), distance_(distance)
+    {
+    }
+
+    void load(size_t, size_t, std::vector<ElementType>&) const
+    {
     }
+
+    void distances(size_t first, size_t count, const std::vector<ElementType>&, const ElementType* query, DistanceType* dists) const
+    {
+        for (size_t i=0; i<count; ++i) {
+            dists[i] = distance_(dataset_[first+i], query, dataset_.cols);
+        }
+    }
+
+private:
+    const Matrix<ElementType>& dataset_;
+    Distance distance_;
+};
+
+/**
+ * Computes squared Euclidean distances of a query to a block of points. The
+ * tile of a worker holds the coordinates of the block column by column, so
+ * the inner loop runs over consecutive points and is vectorized by the
+ * compiler. The dimensions are summed up in groups of Group in the same
+ * order as the distance functor, so the distances are the same.
+ */
+template <typename T, typename DistanceType, int Group>
+class GroundTruthColumns
+{
+public:
+    GroundTruthColumns(const Matrix<T>& dataset) :
+        dataset_(dataset)
+    {
+    }
+
+    void load(size_t first, size_t count, std::vector<T>& tile) const
+    {
+        size_t cols = dataset_.cols;
+        tile.resize(count*cols);
+        for (size_t i=0; i<count; ++i) {
+            const T* point = dataset_[first+i];
+            for (size_t j=0; j<cols; ++j) {
+                tile[j*count+i] = point[j];
+            }
+        }
+    }
+
+    void distances(size_t, size_t count, const std::vector<T>& tile, const T* query, DistanceType* dists) const
+    {
+        std::fill(dists, dists+count, DistanceType());
+
+        size_t cols = dataset_.cols;
+        size_t j = 0;
+        for (; Group==4 && j+4<=cols; j+=4) {
+            const T* c0 = &tile[j*count];
+            const T* c1 = c0+count;
+            const T* c2 = c1+count;
+            const T* c3 = c2+count;
+            const T q0 = query[j], q1 = query[j+1], q2 = query[j+2], q3 = query[j+3];
+            for (size_t i=0; i<count; ++i) {
+                DistanceType diff0 = (DistanceType)(c0[i] - q0);
+                DistanceType diff1 = (DistanceType)(c1[i] - q1);
+                DistanceType diff2 = (DistanceType)(c2[i] - q2);
+                DistanceType diff3 = (DistanceType)(c3[i] - q3);
+                dists[i] += diff0 * diff0 + diff1 * diff1 + diff2 * diff2 + diff3 * diff3;
+            }
+        }
+        for (; j<cols; ++j) {
+            const T* column = &tile[j*count];
+            const T q = query[j];
+            for (size_t i=0; i<count; ++i) {
+                DistanceType diff = (DistanceType)(column[i] - q);
+                dists[i] += diff * diff;
+            }
+        }
+    }
+
+private:
+    const Matrix<T>& dataset_;
+};
+
+template <typename T>
+class GroundTruthBlock<L2_Simple<T> > : public GroundTruthColumns<T, typename L2_Simple<T>::ResultType, 1>
+{
+public:
+    GroundTruthBlock(const Matrix<T>& dataset, const L2_Simple<T>&) :
+        GroundTruthColumns<T, typename L2_Simple<T>::ResultType, 1>(dataset)
+    {
+    }
+};
+
+template <typename T>
+class GroundTruthBlock<L2<T> > : public GroundTruthColumns<T, typename L2<T>::ResultType, 4>
+{
+public:
+    GroundTruthBlock(const Matrix<T>& dataset, const L2<T>&) :
+        GroundTruthColumns<T, typename L2<T>::ResultType, 4>(dataset)
+    {
+    }
+};
+
+
+/**
+ * Computes the exact nearest neighbors of every query of a test set, like
+ * find_nearest() does for a single query.
+ *
+ * The queries are processed in blocks by a number of threads. A block of
+ * queries runs over the dataset in blocks of points small enough to stay in
+ * the cache. Every worker loads a block of points into its own tile, so the
+ * extra memory does not grow with the dataset. The distances of a query to
+ * a block of points are computed at once and merged into the sorted
+ * neighbors of the query. Ties are resolved
+ * in favor of the lower index as in find_nearest().
+ * @param dataset Points
+ * @param testset Queries
+ * @param matches Indices of the nearest neighbors, as many per query as it has columns
+ * @param skip Number of nearest neighbors to skip, e.g. 1 if the queries are part of the dataset
+ * @param d Distance functor
+ * @param cores Number of threads, 0 for the number of hardware threads
+ */
+template <typename Distance>
+void compute_ground_truth(const Matrix<typename Distance::ElementType>& dataset, const Matrix<typename Distance::ElementType>& testset, Matrix<size_t>& matches,
+                          int skip=0, Distance d = Distance(), int cores = 0)
+{
+    typedef typename Distance::ElementType ElementType;
+    typedef typename Distance::ResultType DistanceType;
+
+    const size_t query_block = 64;
+    const size_t point_block = std::max<size_t>(64, 16384/std::max<size_t>(dataset.cols, 1));
+    const size_t n = matches.cols+skip;
+
+    GroundTruthBlock<Distance> block(dataset, d);
+
+    size_t blocks = (testset.rows+query_block-1)/query_block;
+    std::atomic<size_t> next(0);
+    ThreadPool workers(std::min<size_t>(ThreadPool::resolveThreads(cores), std::max<size_t>(blocks, 1)));
+
+    workers.run(workers.size(), [&](int, int) {
+        std::vector<ElementType> tile;
+        std::vector<DistanceType> dists(point_block);
+        std::vector<DistanceType> best_dists(query_block*n);
+        std::vector<size_t> best_indices(query_block*n);
+        std::vector<size_t> counts(query_block);
+
+        for (size_t b = next++; b<blocks; b = next++) {
+            size_t first_query = b*query_block;
+            size_t queries = std::min(query_block, testset.rows-first_query);
+            std::fill(counts.begin(), counts.end(), 0);
+
+            for (size_t first=0; first<dataset.rows; first+=point_block) {
+                size_t count = std::min(point_block, dataset.rows-first);
+                block.load(first, count, tile);
+                for (size_t q=0; q<queries; ++q) {
+                    block.distances(first, count, tile, testset[first_query+q], &dists[0]);
+
+                    DistanceType* best_dist = &best_dists[q*n];
+                    size_t* best_index = &best_indices[q*n];
+                    size_t& best = counts[q];
+                    for (size_t i=0; i<count; ++i) {
+                        if (best<n) {
+                            best_dist[best] = dists[i];
+                            best_index[best++] = first+i;
+                        }
+                        else if (dists[i] < best_dist[n-1]) {
+                            best_dist[n-1] = dists[i];
+                            best_index[n-1] = first+i;
+                        }
+                        else {
+                            continue;
+                        }
+
+                        // bubble up
+                        size_t j = best-1;
+                        while (j>=1 && best_dist[j]<best_dist[j-1]) {
+                            std::swap(best_dist[j],best_dist[j-1]);
+                            std::swap(best_index[j],best_index[j-1]);
+                            j--;
+                        }
+                    }
+                }
+            }
+
+            for (size_t q=0; q<queries; ++q) {
+                for (size_t i=0; i<matches.cols; ++i) {
+                    matches[first_query+q][i] = i+skip<counts[q] ? best_indices[q*n+i+skip] : size_t(-1);
+                }
+            }
+        }
+    });
 }
 
 
@@ -147,8 +147,8 @@ public:
             wastedMemory += remaining;
 
             /* Allocate new storage. */
-            blocksize = (size + sizeof(void*) + (WORDSIZE-1) > BLOCKSIZE) ?
-                        size + sizeof(void*) + (WORDSIZE-1) : BLOCKSIZE;
+            blocksize = (size + sizeof(void*) + (WORDSIZE-1) > (size_t)this->blocksize) ?
+                        size + sizeof(void*) + (WORDSIZE-1) : this->blocksize;
 
             // use the standard C malloc to allocate memory
             void* m = ::malloc(blocksize);
@@ -30,443 +30,367 @@
 #ifndef DATASTRUCTURES_H_
 #define DATASTRUCTURES_H_
 
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <stdint.h>
+
 namespace flann
 
 {
 
-	template <typename T>
-	class BalancedTree
+	/**
+		Flat set of indices which have been visited during a single query.
+		Every entry stores the epoch of the query which inserted it, so starting
+		a new query increments the epoch instead of clearing the array.
+
+		The set of a thread takes 4 Bytes per point of the largest index it
+		searches. The array shrinks again once SHRINK_QUERIES queries in a row
+		need less than a quarter of it, e.g. after the large index is destroyed.
+	*/
+	class VisitedSet
 	{
 	public:
 
-		/**
-		Every node stores a value. When the node stores a value which is different from NAN
-		occupied becomes true
-		*/
-		T value;
-		bool occupied;
-
-		/**
-		Depth is the maximal depth that a child from this node has
-		*/
-		int depth;
+		enum
+		{
+			/**
+				Number of queries in a row which need less than a quarter of the
+				array before the array shrinks
+			*/
+			SHRINK_QUERIES = 64
+		};
 
 		/**
-		Every node has a pointer to each child and a pointer to the parent
+			Constructor
 		*/
-		BalancedTree<T>* parent;
-		BalancedTree<T>* nodel;
-		BalancedTree<T>* noder;
+		VisitedSet() : epoch(0), small(0)
+		{
+		}
 
 		/**
-		Constructor
+			Starts a new query, afterwards no index is contained in the set
 
-		@param pointer to the parent of this node
+			@param size_ number of indices which can be inserted
 		*/
-		BalancedTree(BalancedTree<T>* parent_) : parent(parent_)
+		void reset(size_t size_)
 		{
-			value = NAN;
+			if (stamps.size() < size_) {
+				stamps.resize(size_, 0);
+			}
 
-			occupied = 0;
-			depth = 0;
+			small = size_ < stamps.size() / 4 ? small + 1 : 0;
+			if (small >= SHRINK_QUERIES) {
+				std::vector<uint32_t>(size_, 0).swap(stamps);
+				small = 0;
+			}
 
-			nodel = NULL;
-			noder = NULL;
+			epoch = epoch + 1;
+			/**
+				After an overflow of the epoch old stamps would become valid again
+			*/
+			if (epoch == 0) {
+				std::fill(stamps.begin(), stamps.end(), 0);
+				epoch = 1;
+			}
 		}
 
 		/**
-		Deconstructor
+			Inserts an index
+
+			@param index_ index which has been visited
 		*/
-		~BalancedTree(void)
+		inline void set(size_t index_)
 		{
-			if (nodel != NULL) { nodel->~BalancedTree(); delete nodel; nodel = NULL; }
-			if (noder != NULL) { noder->~BalancedTree(); delete noder; noder = NULL; }
+			stamps[index_] = epoch;
 		}
 
 		/**
-		Adds a value to the tree
+			Checks whether an index has been inserted during the current query
 
-		@param root_, pointer to root
-		@param value_, the value which should be added
+			@param index_ index which should be searched for
+			@return true when the index has been visited
 		*/
-		bool addNode(void** root_, T value_)
+		inline bool test(size_t index_) const
 		{
-			/**
-				Call addNode() when the respective node exits, otherwise create a node and define the values
-			*/
-			if (!occupied) {
-				value = value_;
-				occupied = 1;
-				return 1;
-			}
-			else if (value > value_) {
-				if (!nodel) {
-					nodel = new BalancedTree<T>(this);
-					nodel->value = value_;
-					nodel->occupied = 1;
-				}
-				else {
-					nodel->addNode(root_, value_);
-				}
-			}
-			else if (value < value_) {
-				if (!noder) {
-					noder = new BalancedTree<T>(this);
-					noder->value = value_;
-					noder->occupied = 1;
-				}
-				else {
-					noder->addNode(root_, value_);
-				}
-			}
-			else {
-				return 0;
-			}
-			/**
-				Compute the possibly changed depth and the balancefactor. Rotate the tree if the balancefactor is greater or equal than 2
-			*/
-			setDepthNode();
-			
-			int balanceFactor = getBalanceFactor();
-
-			if (balanceFactor == 2) {
-				bool rootparent = 0;
-				if (!parent) {
-					rootparent = 1;
-					*root_ = nodel;
-				}
-				turnRight(root_, rootparent);
-				parent->setDepth();
-			}
-			else if (balanceFactor == -2) {
-				bool rootparent = 0;
-				if (!parent) {
-					rootparent = 1;
-					*root_ = noder;
-				}
-				turnLeft(root_, rootparent);
-				parent->setDepth();
-			}
+			return stamps[index_] == epoch;
 		}
 
 		/**
-			Rotates the node to the right
+			Returns the set of the calling thread, which is shared by all queries
+			of this thread
 
-			@param root_, pointer to root
-			@param rootparent_, determines whether the node is involved which points to root
+			@return reference to the set of the calling thread
 		*/
-		void turnRight(void** root_, bool rootparent_) {
-			/**
-			When the right subtree of the left node has a too large depth the left subtree has to turn left
-			*/
-			int depthl = 0, depthr = 0;
-			if (nodel->noder) { depthr = nodel->noder->depth + 1; }
-			if (nodel->nodel) { depthl = nodel->nodel->depth + 1; }
-			if (depthr > depthl) {
-				if (rootparent_) {
-					*root_ = nodel->noder;
-				}
-				nodel->turnLeft(root_, rootparent_);
-			}
-			/**
-				Assigning the respective left or right node in the parent the new child
-			*/
-			if (parent) {
-				if (!parent->nodel && parent->noder) {
-					parent->noder = nodel;
-				}
-				else if (parent->nodel && !parent->noder) {
-					parent->nodel = nodel;
-				}
-				else if (parent->nodel && parent->noder) {
-					if (parent->nodel->value == value) { parent->nodel = nodel; }
-					else if (parent->noder->value == value) { parent->noder = nodel; }
-				}
-			}
-			/**
-				Exchange the respective pointers of the involved nodes using the node swap
-			*/
-			BalancedTree<T>* swap = nodel;
-			swap->parent = parent;
-			nodel = nodel->noder;
-			if (nodel) {
-				nodel->parent = this;
-			}
-			parent = swap;
-			swap->noder = this;
+		static VisitedSet& local()
+		{
+			static thread_local VisitedSet set;
+			return set;
 		}
 
+	private:
+
 		/**
-			Rotates the node to the left
+			Epoch in which the respective index has been inserted
+		*/
+		std::vector<uint32_t> stamps;
 
-			@param root_, pointer to root
-			@param rootparent_, determines whether the node is involved which points to root
+		/**
+			Epoch of the current query
 		*/
-		void turnLeft(void** root_, bool rootparent_) {
-			/**
-				When the left subtree of the right node has a too large depth the right subtree has to turn right
-			*/
-			int depthl = 0, depthr = 0;
-			if (noder->nodel) { depthl = noder->nodel->depth + 1; }
-			if (noder->noder) { depthr = noder->noder->depth + 1; }
-			if (depthl > depthr) {
-				if (rootparent_) {
-					*root_ = noder->nodel;
-				}
-				noder->turnRight(root_, rootparent_);
-			}
-			/**
-				Assigning the respective left or right node in the parent the new child
-			*/
-			if (parent) {
-				if (!parent->nodel && parent->noder) {
-					parent->noder = noder;
-				}
-				else if (parent->nodel && !parent->noder) {
-					parent->nodel = noder;
-				}
-				else if (parent->nodel && parent->noder) {
-					if (parent->nodel->value == value) { parent->nodel = noder; }
-					else if (parent->noder->value == value) { parent->noder = noder; }
-				}
-			}
+		uint32_t epoch;
+
+		/**
+			Number of queries in a row which have needed less than a quarter of
+			the array
+		*/
+		size_t small;
+	};
+
+	/**
+		Ordered set which stores its values in sorted pages of at most PAGE_SIZE
+		values. The first value of every page is kept in a separate sorted array,
+		so a lookup is a binary search over the pages followed by a binary search
+		inside of one page. A full page is split into two halves, like a leaf of a
+		B-tree.
+
+		The surface follows utils::BalancedTree, so the set can replace the tree.
+	*/
+	template <typename ElementType>
+	class FlatSet
+	{
+	public:
+
+		enum
+		{
 			/**
-				Exchange the respective pointers of the involved nodes using the node swap
+				Maximal number of values in a page
 			*/
-			BalancedTree<T>* swap = noder;
-			swap->parent = parent;
-			noder = noder->nodel;
-			if (noder) {
-				noder->parent = this;
-			}
-			parent = swap;
-			swap->nodel = this;
+			PAGE_SIZE = 256
+		};
 
+		/**
+			Constructor
+		*/
+		FlatSet() : number(0)
+		{
 		}
 
 		/**
-			Computes the balance factor
+			Adds a value to the set
 
-			@return balancefactor which lies between [-2,2]
+			@param value_ the value which should be added
+			@return true when the value has not been in the set before
 		*/
-		int getBalanceFactor() {
-			if (!nodel && !noder) {
-				return 0;
-			}
-			else if (!nodel) {
-				return -noder->depth - 1;
+		bool addNode(ElementType value_)
+		{
+			if (pages.empty()) {
+				pages.push_back(std::vector<ElementType>(1, value_));
+				firsts.push_back(value_);
+				number = 1;
+				return 1;
 			}
-			else if (!noder) {
-				return nodel->depth + 1;
+
+			size_t page = findPage(value_);
+			std::vector<ElementType>& values = pages[page];
+
+			typename std::vector<ElementType>::iterator position = std::lower_bound(values.begin(), values.end(), value_);
+			if (position != values.end() && !(value_ < *position)) {
+				return 0;
 			}
-			else {
-				return nodel->depth - noder->depth;
+			values.insert(position, value_);
+			firsts[page] = values.front();
+			number = number + 1;
+
+			if (values.size() > PAGE_SIZE) {
+				splitPage(page);
 			}
+			return 1;
 		}
 
-	public:
-
 		/**
-			Computes the number of elements in the tree
-	
-			@return count number of elements in the tree
+			Adds a value to the set, the root is not used and only exists to keep
+			the surface of BalancedTree
+
+			@param root_ pointer to root
+			@param value_ the value which should be added
+			@return true when the value has not been in the set before
 		*/
-		void getNumber(int& count)
+		bool addNode(void** /*root_*/, ElementType value_)
 		{
-			if (nodel) { nodel->getNumber(count); }
-			if (noder) { noder->getNumber(count); }
-
-			count = count + 1;
+			return addNode(value_);
 		}
 
 		/**
-			Displays information about ervery node of the tree
+			Adds a range of values to the set. Large ranges are sorted and merged
+			with the set at once, small ranges are added value by value.
 
-			Balancefactor - Depth - Value - Nodel->Value - Noder->Value
+			@param first_ iterator to the first value
+			@param last_ iterator behind the last value
 		*/
-		void getInfos()
+		template <typename Iterator>
+		void addNodes(Iterator first_, Iterator last_)
 		{
-			if (nodel) { nodel->getInfos(); }
-			if (noder) { noder->getInfos(); }
+			std::vector<ElementType> values(first_, last_);
+			if (values.size() * 16 < number) {
+				for (size_t i = 0; i < values.size(); ++i) {
+					addNode(values[i]);
+				}
+				return;
+			}
 
-			if (!nodel && !noder) {
-				std::cout << 0 << " " << depth << " " << value << " " << "0" << " " << "0" << " ";
+			std::sort(values.begin(), values.end());
 
+			std::vector<ElementType> merged;
+			merged.reserve(number + values.size());
+			for (size_t p = 0; p < pages.size(); ++p) {
+				merged.insert(merged.end(), pages[p].begin(), pages[p].end());
 			}
-			else if (!nodel && noder) {
-				std::cout << -noder->depth - 1 << " " << depth << " " << value << " " << "0" << " " << noder->value << " ";
-			}
-			else if (nodel && !noder) {
-				std::cout << nodel->depth + 1 << " " << depth << " " << value << " " << nodel->value << " " << "0" << " ";
-			}
-			else {
-				std::cout << nodel->depth - noder->depth << " " << depth << " " << value << " " << nodel->value << " " << noder->value << " ";
-			}
+			size_t middle = merged.size();
+			merged.insert(merged.end(), values.begin(), values.end());
+			std::inplace_merge(merged.begin(), merged.begin() + middle, merged.end());
+			merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
 
-			if (parent) {
-				std::cout << parent->value << " " << std::endl;
-			}
-			else
-				std::cout << "0" << std::endl;
+			build(merged);
 		}
 
 		/**
-			Checks whether the specification of the depth in every node of the tree is correct
+			Searches for a value
 
-			@return true when the specifications are correct
+			@param value_ value which should be searched for in the set
+			@return true when the set contains the value
 		*/
-		bool checkDepth()
+		bool search(ElementType value_) const
 		{
-			if (nodel) {
-				if (!nodel->checkDepth()) {
-					return 0;
-				}
-			}
-			if (noder) {
-				if (!noder->checkDepth()) {
-					return 0;
-				}
+			if (pages.empty()) {
+				return 0;
 			}
 
-			if (!nodel && !noder) {
-				if (depth != 0) {
-					return 0;
-				}
-			}
-			else if (!nodel) {
-				if (depth != noder->depth + 1) {
-					return 0;
-				}
-			}
-			else if (!noder) {
-				if (depth != nodel->depth + 1) {
-					return 0;
-				}
-			}
-			else {
-				if (depth != (nodel->depth > noder->depth ? nodel->depth : noder->depth) + 1) {
-					return 0;
-				}
-			}
+			const std::vector<ElementType>& values = pages[findPage(value_)];
+			return std::binary_search(values.begin(), values.end(), value_);
+		}
 
-			return 1;
+		/**
+			Computes the number of elements in the set
+
+			@return count is increased by the number of elements in the set
+		*/
+		void getNumber(int& count) const
+		{
+			count = count + (int)number;
 		}
 
 		/**
-			Checks whether the left and right node have this as parent
+			Returns the number of elements in the set
 
-			@return true when the the left and right node have this as parent
+			@return number of elements
 		*/
-		bool checkParent()
+		size_t size() const
 		{
-			if (nodel) {
-				if (nodel->parent->value == value) {
-					return nodel->checkParent();
-				}
-				else {
-					return 0;
-				}
-			}
-			if (noder) {
-				if (noder->parent->value == value) {
-					return noder->checkParent();
-				}
-				else {
-					return 0;
-				}
-			}
+			return number;
+		}
 
-			return 1;
+		/**
+			Removes all values
+		*/
+		void clear()
+		{
+			pages.clear();
+			firsts.clear();
+			number = 0;
 		}
 
 		/**
-			Checks whether the value of the left node is smaller and the value of the right value is bigger than the value of the parent
+			Checks whether the values are sorted across all pages
 
-			@return true when the values are co
+			@return true when the values are sorted
 		*/
-		bool checkRelations()
+		bool checkRelations() const
 		{
-			if (nodel) {
-				if (nodel->value > value) {
+			for (size_t p = 0; p < pages.size(); ++p) {
+				if (pages[p].empty() || firsts[p] != pages[p].front()) {
 					return 0;
 				}
-				else {
-					return nodel->checkRelations();
+				for (size_t i = 1; i < pages[p].size(); ++i) {
+					if (!(pages[p][i - 1] < pages[p][i])) {
+						return 0;
+					}
 				}
-			}
-			if (noder) {
-				if (noder->value < value) {
+				if (p > 0 && !(pages[p - 1].back() < pages[p].front())) {
 					return 0;
 				}
-				else {
-					return noder->checkRelations();
-				}
 			}
-
 			return 1;
 		}
 
 	private:
 
 		/**
-			Sets the depth of all children of a node
+			Returns the page which contains the value, if it is in the set
+
+			@param value_ value which should be searched for
+			@return index of the page
 		*/
-		void setDepth()
+		size_t findPage(ElementType value_) const
 		{
-			if (nodel) { nodel->setDepth(); }
-			if (noder) { noder->setDepth(); }
-
-			if (!nodel && !noder) {
-				depth = 0;
-			}
-			else if (!nodel) {
-				depth = noder->depth + 1;
-			}
-			else if (!noder) {
-				depth = nodel->depth + 1;
-			}
-			else {
-				depth = (nodel->depth > noder->depth ? nodel->depth : noder->depth) + 1;
-			}
+			typename std::vector<ElementType>::const_iterator position = std::upper_bound(firsts.begin(), firsts.end(), value_);
+			return position == firsts.begin() ? 0 : (position - firsts.begin()) - 1;
 		}
 
 		/**
-			Sets the depth of a node
+			Splits a page into two halves
+
+			@param page_ index of the page
 		*/
-		void setDepthNode()
+		void splitPage(size_t page_)
 		{
-			if (!nodel && !noder) {
-				depth = 0;
-			}
-			else if (!nodel) {
-				depth = noder->depth + 1;
-			}
-			else if (!noder) {
-				depth = nodel->depth + 1;
-			}
-			else {
-				depth = (nodel->depth>noder->depth ? nodel->depth : noder->depth) + 1;
-			}
-		}
+			std::vector<ElementType>& values = pages[page_];
+			size_t half = values.size() / 2;
 
-	public:
+			std::vector<ElementType> upper(values.begin() + half, values.end());
+			values.resize(half);
+
+			firsts.insert(firsts.begin() + page_ + 1, upper.front());
+			pages.insert(pages.begin() + page_ + 1, std::vector<ElementType>());
+			pages[page_ + 1].swap(upper);
+		}
 
 		/**
-			Searches for a node with the same value as value_
+			Replaces the pages by sorted, unique values. The pages are filled to
+			three quarters, so following insertions do not split them at once.
 
-			@param value_ value which should be searched for in the tree
-			@return true when the tree contains a node with the given value
+			@param values_ sorted values without duplicates
 		*/
-		bool search(T value_)
+		void build(const std::vector<ElementType>& values_)
 		{
+			size_t fill = PAGE_SIZE * 3 / 4;
+			size_t count = (values_.size() + fill - 1) / fill;
+
+			pages.assign(count, std::vector<ElementType>());
+			firsts.resize(count);
+			for (size_t p = 0; p < count; ++p) {
+				size_t begin = p * fill;
+				size_t end = std::min(begin + fill, values_.size());
+				pages[p].assign(values_.begin() + begin, values_.begin() + end);
+				firsts[p] = values_[begin];
+			}
+			number = values_.size();
+		}
 
-			if (value_ == value) { return 1; }
+		/**
+			Sorted pages of values
+		*/
+		std::vector<std::vector<ElementType> > pages;
 
-			if (value_ < value && nodel) { return nodel->search(value_); }
-			if (value_ > value && noder) { return noder->search(value_); }
+		/**
+			First value of every page
+		*/
+		std::vector<ElementType> firsts;
 
-			return 0;
-		}
+		/**
+			Number of values in the set
+		*/
+		size_t number;
 	};
 }
 
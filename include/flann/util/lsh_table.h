@@ -50,6 +50,7 @@
 
 #include "flann/util/dynamic_bitset.h"
 #include "flann/util/matrix.h"
+#include "flann/util/random.h"
 
 namespace flann
 {
@@ -364,7 +365,7 @@ inline LshTable<unsigned char>::LshTable(unsigned int feature_size, unsigned int
     // A bit brutal but fast to code
     std::vector<size_t> indices(feature_size * CHAR_BIT);
     for (size_t i = 0; i < feature_size * CHAR_BIT; ++i) indices[i] = i;
-    std::random_shuffle(indices.begin(), indices.end());
+    permute(indices.begin(), indices.end(), random_engine());
 
     // Generate a random set of order of subsignature_size_ bits
     for (unsigned int i = 0; i < key_size_; ++i) {
@@ -0,0 +1,261 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef FLANN_MAPPED_FILE_H_
+#define FLANN_MAPPED_FILE_H_
+
+#include <algorithm>
+#include <cstddef>
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace flann
+{
+	/**
+		Read-only memory mapping of a whole file. The pages of the file are loaded
+		by the operating system when they are accessed, nothing is copied.
+	*/
+	class MappedFile
+	{
+	public:
+
+		/**
+			Constructor
+		*/
+		MappedFile() : data(NULL), size(0)
+		{
+#if defined(_WIN32)
+			file = INVALID_HANDLE_VALUE;
+			mapping = NULL;
+#endif
+		}
+
+		/**
+			Deconstructor
+		*/
+		~MappedFile()
+		{
+			close();
+		}
+
+		/**
+			Maps a file into memory
+
+			@param stringfile_ path of the file
+			@param sequential_ the file is read from the beginning to the end
+			@return true when the file has been mapped
+		*/
+		bool open(const char* stringfile_, bool sequential_ = true)
+		{
+			close();
+
+#if defined(_WIN32)
+			file = CreateFileA(stringfile_, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+				sequential_ ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+			if (file == INVALID_HANDLE_VALUE) {
+				return 0;
+			}
+
+			LARGE_INTEGER length;
+			if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) {
+				close();
+				return 0;
+			}
+			size = (size_t)length.QuadPart;
+
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (!mapping) {
+				close();
+				return 0;
+			}
+			data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+			int descriptor = ::open(stringfile_, O_RDONLY);
+			if (descriptor < 0) {
+				return 0;
+			}
+
+			struct stat status;
+			if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+				::close(descriptor);
+				return 0;
+			}
+			size = (size_t)status.st_size;
+
+			void* pointer = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			::close(descriptor);
+			if (pointer != MAP_FAILED) {
+				data = (const char*)pointer;
+				madvise(pointer, size, sequential_ ? MADV_SEQUENTIAL : MADV_RANDOM);
+			}
+#endif
+			if (!data) {
+				close();
+				return 0;
+			}
+			return 1;
+		}
+
+		/**
+			Removes the mapping
+		*/
+		void close()
+		{
+#if defined(_WIN32)
+			if (data) {
+				UnmapViewOfFile(data);
+			}
+			if (mapping) {
+				CloseHandle(mapping);
+				mapping = NULL;
+			}
+			if (file != INVALID_HANDLE_VALUE) {
+				CloseHandle(file);
+				file = INVALID_HANDLE_VALUE;
+			}
+#else
+			if (data) {
+				munmap((void*)data, size);
+			}
+#endif
+			data = NULL;
+			size = 0;
+		}
+
+		/**
+			Loads a range of the file into memory before it is accessed
+
+			@param offset_ first Byte of the range
+			@param size_ number of Bytes of the range
+		*/
+		void prefetch(size_t offset_, size_t size_) const
+		{
+			if (!data || offset_ >= size) {
+				return;
+			}
+			size_ = std::min(size_, size - offset_);
+
+#if defined(_WIN32)
+	#if _WIN32_WINNT >= 0x0602
+			WIN32_MEMORY_RANGE_ENTRY range;
+			range.VirtualAddress = (PVOID)(data + offset_);
+			range.NumberOfBytes = size_;
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	#endif
+#else
+			size_t page = (size_t)sysconf(_SC_PAGESIZE);
+			size_t begin = offset_ / page * page;
+			madvise((void*)(data + begin), offset_ + size_ - begin, MADV_WILLNEED);
+#endif
+
+			/**
+				Touch every page, so that the range is resident when the call returns
+			*/
+			volatile char sum = 0;
+			for (size_t i = offset_; i < offset_ + size_; i += 4096) {
+				sum += data[i];
+			}
+			(void)sum;
+		}
+
+		/**
+			Tells the operating system that a range of the file is not needed
+			anymore, so that its pages can be dropped from memory. The range
+			stays readable and is loaded again when it is accessed.
+
+			@param offset_ first Byte of the range
+			@param size_ number of Bytes of the range
+		*/
+		void release(size_t offset_, size_t size_) const
+		{
+#if defined(_WIN32)
+			/**
+				Clean pages of a read-only view are trimmed from the working set by Windows
+			*/
+			(void)offset_;
+			(void)size_;
+#else
+			if (!data || offset_ >= size) {
+				return;
+			}
+			size_t page = (size_t)sysconf(_SC_PAGESIZE);
+			size_t begin = (offset_ + page - 1) / page * page;
+			size_t end = std::min(offset_ + size_, size) / page * page;
+			if (begin < end) {
+				madvise((void*)(data + begin), end - begin, MADV_DONTNEED);
+			}
+#endif
+		}
+
+		/**
+			Returns the pointer to the content of the file
+
+			@return pointer to the first Byte
+		*/
+		const char* getPtr() const
+		{
+			return data;
+		}
+
+		/**
+			Returns the size of the file
+
+			@return number of Bytes
+		*/
+		size_t getSize() const
+		{
+			return size;
+		}
+
+	private:
+
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+		const char* data;
+		size_t size;
+
+#if defined(_WIN32)
+		HANDLE file;
+		HANDLE mapping;
+#endif
+	};
+}
+
+#endif /* FLANN_MAPPED_FILE_H_ */
@@ -0,0 +1,367 @@
+/***********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ * Copyright 2008-2009  Marius Muja (mariusm@cs.ubc.ca). All rights reserved.
+ * Copyright 2008-2009  David G. Lowe (lowe@cs.ubc.ca). All rights reserved.
+ *
+ * THE BSD LICENSE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *************************************************************************/
+
+#ifndef FLANN_MAPPING_H_
+#define FLANN_MAPPING_H_
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "flann/general.h"
+#include "flann/util/serialization.h"
+#include "flann/util/mapped_file.h"
+
+#ifdef FLANN_MAPPED_SIGNATURE_
+#undef FLANN_MAPPED_SIGNATURE_
+#endif
+#define FLANN_MAPPED_SIGNATURE_ "FLANN_MAPPED_INDEX_v1.0"
+
+namespace flann
+{
+
+/**
+ * Pointer which stores the distance to its target relative to its own
+ * address. Structures which are linked with relative pointers stay valid
+ * when they are copied as a whole or mapped from a file at any address.
+ */
+template <typename T>
+class RelativePtr
+{
+public:
+    RelativePtr() : offset_(0)
+    {
+    }
+
+    RelativePtr(T* ptr)
+    {
+        set(ptr);
+    }
+
+    RelativePtr(const RelativePtr& other)
+    {
+        set(other.get());
+    }
+
+    RelativePtr& operator=(const RelativePtr& other)
+    {
+        set(other.get());
+        return *this;
+    }
+
+    RelativePtr& operator=(T* ptr)
+    {
+        set(ptr);
+        return *this;
+    }
+
+    T* get() const
+    {
+        return offset_ ? (T*)((char*)this + offset_) : NULL;
+    }
+
+    operator T*() const
+    {
+        return get();
+    }
+
+    T* operator->() const
+    {
+        return get();
+    }
+
+    T& operator*() const
+    {
+        return *get();
+    }
+
+private:
+    void set(T* ptr)
+    {
+        offset_ = ptr ? (char*)ptr - (char*)this : 0;
+    }
+
+    /** Distance in bytes, 0 for NULL */
+    ptrdiff_t offset_;
+};
+
+/**
+ * Position in a file which may be larger than 2 GB
+ */
+inline uint64_t file_tell(FILE* stream)
+{
+#if defined(_WIN32)
+    return (uint64_t)_ftelli64(stream);
+#else
+    return (uint64_t)ftello(stream);
+#endif
+}
+
+inline int file_seek(FILE* stream, uint64_t position)
+{
+#if defined(_WIN32)
+    return _fseeki64(stream, (__int64)position, SEEK_SET);
+#else
+    return fseeko(stream, (off_t)position, SEEK_SET);
+#endif
+}
+
+/**
+ * Sections of a mapped index file
+ */
+enum MappedSection
+{
+    /** Nodes of the trees, linked with relative pointers */
+    MAPPED_NODES = 0,
+    /** Node indices of the roots of the trees */
+    MAPPED_ROOTS,
+    /** Points in the order of the leaves */
+    MAPPED_POINTS,
+    MAPPED_SECTIONS
+};
+
+/**
+ * Header of a mapped index file. The header is followed by the compressed
+ * state of the NNIndex base class and the uncompressed sections, which are
+ * used in place after the file has been mapped into memory.
+ */
+struct MappedIndexHeader
+{
+    char signature[24];
+    flann_datatype_t data_type;
+    flann_algorithm_t index_type;
+    /** Size of a node, guards against files of a different build */
+    uint64_t node_size;
+    /** Position of the archive with the state of the base class */
+    uint64_t base_offset;
+    /** Position and size of the sections in bytes */
+    uint64_t sections[MAPPED_SECTIONS][2];
+};
+
+/**
+ * Writes a mapped index file. The sections are aligned to cache lines, the
+ * header is completed when the writer is closed.
+ */
+class MappedIndexWriter
+{
+public:
+    MappedIndexWriter(const std::string& filename, flann_datatype_t data_type, flann_algorithm_t index_type, size_t node_size)
+    {
+        stream_ = fopen(filename.c_str(), "wb");
+        if (stream_ == NULL) {
+            throw FLANNException("Cannot open file");
+        }
+        memset(&header_, 0, sizeof(header_));
+        strcpy(header_.signature, FLANN_MAPPED_SIGNATURE_);
+        header_.data_type = data_type;
+        header_.index_type = index_type;
+        header_.node_size = node_size;
+        fwrite(&header_, sizeof(header_), 1, stream_);
+    }
+
+    ~MappedIndexWriter()
+    {
+        if (stream_) {
+            fclose(stream_);
+        }
+    }
+
+    /**
+     * Writes the state of an index which is not mapped with a SaveArchive,
+     * e.g. its base class
+     * @param base State of the index
+     */
+    template <typename Base>
+    void writeBase(Base& base)
+    {
+        header_.base_offset = file_tell(stream_);
+        serialization::SaveArchive sa(stream_);
+        sa & base;
+    }
+
+    /**
+     * Writes a section
+     * @param section Index of the section
+     * @param data Content of the section
+     * @param size Size in bytes
+     */
+    void writeSection(MappedSection section, const void* data, size_t size)
+    {
+        static const char zeros[ALIGNMENT] = {};
+        uint64_t position = file_tell(stream_);
+        size_t padding = size_t((ALIGNMENT - position % ALIGNMENT) % ALIGNMENT);
+        if (padding > 0) {
+            fwrite(zeros, padding, 1, stream_);
+        }
+
+        header_.sections[section][0] = position + padding;
+        header_.sections[section][1] = size;
+        if (size > 0 && fwrite(data, size, 1, stream_) != 1) {
+            throw FLANNException("Cannot write index file");
+        }
+    }
+
+    /**
+     * Completes the header and closes the file
+     */
+    void close()
+    {
+        file_seek(stream_, 0);
+        fwrite(&header_, sizeof(header_), 1, stream_);
+        if (fclose(stream_) != 0) {
+            stream_ = NULL;
+            throw FLANNException("Cannot write index file");
+        }
+        stream_ = NULL;
+    }
+
+private:
+    enum { ALIGNMENT = 64 };
+
+    FILE* stream_;
+    MappedIndexHeader header_;
+};
+
+/**
+ * Mapped index file. The sections point into the mapping, which is shared
+ * with all processes that map the same file.
+ */
+class MappedIndexReader
+{
+public:
+    /**
+     * Maps an index file and checks its header
+     * @param filename Path of the file
+     * @param data_type Expected type of the elements
+     * @param index_type Expected type of the index
+     * @param node_size Expected size of a node
+     */
+    MappedIndexReader(const std::string& filename, flann_datatype_t data_type, flann_algorithm_t index_type, size_t node_size) :
+        file_(new MappedFile())
+    {
+        if (!file_->open(filename.c_str(), false)) {
+            throw FLANNException("Cannot map index file");
+        }
+        if (file_->getSize() < sizeof(header_)) {
+            throw FLANNException("Invalid index file, cannot read");
+        }
+        memcpy(&header_, file_->getPtr(), sizeof(header_));
+        if (strncmp(header_.signature, FLANN_MAPPED_SIGNATURE_, sizeof(header_.signature)) != 0) {
+            throw FLANNException("Invalid index file, wrong signature");
+        }
+        if (header_.data_type != data_type || header_.index_type != index_type || header_.node_size != node_size) {
+            throw FLANNException("Mapped index does not match the type of the index");
+        }
+        for (int i = 0; i < MAPPED_SECTIONS; ++i) {
+            if (header_.sections[i][0] > file_->getSize() || header_.sections[i][1] > file_->getSize() - header_.sections[i][0]) {
+                throw FLANNException("Invalid index file, section out of range");
+            }
+        }
+
+        filename_ = filename;
+    }
+
+    /**
+     * Reads the state of an index which is not mapped with a LoadArchive
+     * @param base State of the index
+     */
+    template <typename Base>
+    void readBase(Base& base)
+    {
+        FILE* stream = fopen(filename_.c_str(), "rb");
+        if (stream == NULL) {
+            throw FLANNException("Cannot open file");
+        }
+        file_seek(stream, header_.base_offset);
+        try {
+            serialization::LoadArchive la(stream);
+            la & base;
+        }
+        catch (...) {
+            fclose(stream);
+            throw;
+        }
+        fclose(stream);
+    }
+
+    /**
+     * Returns a section
+     * @param section Index of the section
+     * @param count Expected number of elements
+     * @return Pointer to the first element
+     */
+    template <typename T>
+    T* section(MappedSection section, size_t count) const
+    {
+        if (header_.sections[section][1] != count * sizeof(T)) {
+            throw FLANNException("Invalid index file, wrong section size");
+        }
+        return (T*)(file_->getPtr() + header_.sections[section][0]);
+    }
+
+    /**
+     * Returns the number of elements of a section
+     * @param section Index of the section
+     */
+    template <typename T>
+    size_t count(MappedSection section) const
+    {
+        return size_t(header_.sections[section][1] / sizeof(T));
+    }
+
+    /**
+     * Loads all pages of the file into memory, so that the first queries do
+     * not wait for the disk
+     */
+    void prefetch() const
+    {
+        file_->prefetch(0, file_->getSize());
+    }
+
+    /**
+     * Returns the mapping, which has to be kept as long as the sections are used
+     */
+    std::shared_ptr<MappedFile> getFile() const
+    {
+        return file_;
+    }
+
+private:
+    std::shared_ptr<MappedFile> file_;
+    MappedIndexHeader header_;
+    std::string filename_;
+};
+
+}
+
+#endif /* FLANN_MAPPING_H_ */
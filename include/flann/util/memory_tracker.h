@@ -0,0 +1,424 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef FLANN_MEMORY_TRACKER_H_
+#define FLANN_MEMORY_TRACKER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "flann/util/thread_registry.h"
+
+namespace flann
+{
+	/**
+		Counts the allocations of the program, in total and for every thread, so
+		leaks and allocations in paths which should not allocate, like the search
+		of a built index, can be found on every platform.
+
+		The allocations are reported by hooks: the arenas of utils::Allocator and
+		the aligned matrices report their blocks, everything else which is allocated
+		with new, e.g. the heaps and the result sets, is reported by the global
+		operators new and delete if they are replaced by defining
+		FLANN_MEMORY_TRACKER_OPERATORS in exactly one translation unit before this
+		header is included.
+
+		The tracker is disabled by default, then a hook costs a single atomic load
+		and no thread is registered. The counters of a thread which has finished
+		are continued by the next new thread, so short-lived pools of workers do
+		not add up counters.
+	*/
+	class MemoryTracker
+	{
+	public:
+
+		/**
+			Counters of the allocations of a thread or of the whole program
+		*/
+		struct Counters {
+			size_t allocations;
+			size_t frees;
+			/** Bytes of all allocations */
+			size_t bytes;
+			/** Bytes which are allocated and not freed yet */
+			long long current;
+			/** maximum of current */
+			long long peak;
+
+			Counters() : allocations(0), frees(0), bytes(0), current(0), peak(0) {}
+		};
+
+		/**
+			Counts the allocations of the calling thread from its construction on,
+			e.g. to check that a path does not allocate
+		*/
+		class Scope
+		{
+		public:
+
+			/**
+				Constructor, starts to count if the tracker is enabled
+			*/
+			Scope() :
+				counting(MemoryTracker::enabled()), begin(MemoryTracker::thread())
+			{
+			}
+
+			/**
+				Returns the allocations of the calling thread since the construction,
+				0 if the tracker has been disabled in the meantime
+
+				@return number of allocations
+			*/
+			size_t allocations() const
+			{
+				return counting ? since(begin.allocations, MemoryTracker::thread().allocations) : 0;
+			}
+
+			/**
+				Returns the Bytes allocated by the calling thread since the
+				construction, 0 if the tracker has been disabled in the meantime
+
+				@return number of Bytes
+			*/
+			size_t bytes() const
+			{
+				return counting ? since(begin.bytes, MemoryTracker::thread().bytes) : 0;
+			}
+
+		private:
+
+			static size_t since(size_t begin_, size_t end_)
+			{
+				return end_ > begin_ ? end_ - begin_ : 0;
+			}
+
+			bool counting;
+			Counters begin;
+		};
+
+		/**
+			Starts to count allocations
+		*/
+		static void enable()
+		{
+			active().store(true);
+		}
+
+		/**
+			Stops to count allocations, the counters are kept
+		*/
+		static void disable()
+		{
+			active().store(false);
+		}
+
+		/**
+			Returns whether allocations are counted
+
+			@return true if the tracker is enabled
+		*/
+		static bool enabled()
+		{
+			return active().load(std::memory_order_relaxed);
+		}
+
+		/**
+			Hook for an allocation of the calling thread
+
+			@param bytes_ size of the allocation in Bytes
+			@return true if the allocation has been counted, only then its free
+				has to be reported
+		*/
+		static bool allocated(size_t bytes_)
+		{
+			if (!enabled()) {
+				return false;
+			}
+			Counters* counters = threadCounters();
+			if (counters) {
+				counters->allocations++;
+				counters->bytes += bytes_;
+				counters->current += (long long)bytes_;
+				counters->peak = std::max(counters->peak, counters->current);
+			}
+
+			Global& all = global();
+			all.allocations.fetch_add(1, std::memory_order_relaxed);
+			all.bytes.fetch_add(bytes_, std::memory_order_relaxed);
+			long long current = all.current.fetch_add((long long)bytes_, std::memory_order_relaxed) + (long long)bytes_;
+			long long peak = all.peak.load(std::memory_order_relaxed);
+			while (current > peak && !all.peak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {
+			}
+			return true;
+		}
+
+		/**
+			Hook for a free of the calling thread, only for allocations which have
+			been counted. Memory may be freed by another thread than the one which
+			has allocated it, so the current Bytes of a thread can be negative.
+
+			@param bytes_ size of the allocation in Bytes
+		*/
+		static void freed(size_t bytes_)
+		{
+			if (!enabled()) {
+				return;
+			}
+			Counters* counters = threadCounters();
+			if (counters) {
+				counters->frees++;
+				counters->current -= (long long)bytes_;
+			}
+
+			Global& all = global();
+			all.frees.fetch_add(1, std::memory_order_relaxed);
+			all.current.fetch_sub((long long)bytes_, std::memory_order_relaxed);
+		}
+
+		/**
+			Returns the counters of the calling thread
+
+			@return counters, zero if the tracker is disabled
+		*/
+		static Counters thread()
+		{
+			if (!enabled()) {
+				return Counters();
+			}
+			Counters* counters = threadCounters();
+			return counters ? *counters : Counters();
+		}
+
+		/**
+			Returns the counters of the whole program
+
+			@return counters
+		*/
+		static Counters total()
+		{
+			Global& all = global();
+			Counters counters;
+			counters.allocations = all.allocations.load();
+			counters.frees = all.frees.load();
+			counters.bytes = all.bytes.load();
+			counters.current = all.current.load();
+			counters.peak = all.peak.load();
+			return counters;
+		}
+
+		/**
+			Writes a table with the counters of the program and of every thread
+			which has allocated memory. The counters of a thread are read without
+			a lock, so the threads should be idle.
+
+			@param stream_ stream which receives the table
+		*/
+		static void print(std::ostream& stream_ = std::cout)
+		{
+			std::vector<std::shared_ptr<ThreadRegistry<Counters>::Slot> > entries = global().threads.entries();
+			std::vector<Counters> threads;
+			for (size_t i = 0; i < entries.size(); i++) {
+				threads.push_back(*entries[i]);
+			}
+
+			stream_ << "memory allocations frees bytes current peak" << std::endl;
+			print(stream_, "total", total());
+			for (size_t i = 0; i < threads.size(); i++) {
+				if (threads[i].allocations > 0 || threads[i].frees > 0) {
+					print(stream_, "thread " + std::to_string(i), threads[i]);
+				}
+			}
+		}
+
+	private:
+
+		/**
+			Returns the counters of the calling thread and registers them on the
+			first call. The registration allocates itself, these allocations are
+			only counted in the total.
+
+			@return counters, nullptr during the registration and after the
+				thread has released its counters
+		*/
+		static Counters* threadCounters()
+		{
+			return global().threads.local();
+		}
+
+		struct Global {
+			std::atomic<size_t> allocations;
+			std::atomic<size_t> frees;
+			std::atomic<size_t> bytes;
+			std::atomic<long long> current;
+			std::atomic<long long> peak;
+			ThreadRegistry<Counters> threads;
+
+			Global() : allocations(0), frees(0), bytes(0), current(0), peak(0) {}
+		};
+
+		static void print(std::ostream& stream_, const std::string& name_, const Counters& counters_)
+		{
+			stream_ << name_ << " " << counters_.allocations << " " << counters_.frees << " " << counters_.bytes
+				<< " " << counters_.current << " " << counters_.peak << std::endl;
+		}
+
+		static std::atomic<bool>& active()
+		{
+			static std::atomic<bool> flag(false);
+			return flag;
+		}
+
+		/**
+			The counters are never destroyed, so allocations of static objects
+			which are destructed at the exit of the program can still be counted
+		*/
+		static Global& global()
+		{
+			static Global* all = new (std::malloc(sizeof(Global))) Global();
+			return *all;
+		}
+	};
+}
+
+#ifdef FLANN_MEMORY_TRACKER_OPERATORS
+
+/**
+	Replacements of the global operators which report to the MemoryTracker. The
+	size of an allocation is stored in front of it, so delete knows how many
+	Bytes are freed, and whether the allocation has been counted, so memory
+	allocated before the tracker has been enabled is not subtracted.
+*/
+namespace flann
+{
+	namespace memory_tracker
+	{
+		enum
+		{
+			/**
+				Size of the header in front of an allocation, keeps the alignment of malloc
+			*/
+			HEADER = 2 * sizeof(size_t) > alignof(std::max_align_t) ? 2 * sizeof(size_t) : alignof(std::max_align_t)
+		};
+
+		inline void* allocate(size_t bytes_)
+		{
+			char* pointer = (char*)std::malloc(bytes_ + HEADER);
+			if (!pointer) {
+				return nullptr;
+			}
+			size_t* header = (size_t*)pointer;
+			header[0] = bytes_;
+			header[1] = MemoryTracker::allocated(bytes_);
+			return pointer + HEADER;
+		}
+
+		inline void free(void* pointer_)
+		{
+			if (!pointer_) {
+				return;
+			}
+			char* pointer = (char*)pointer_ - HEADER;
+			size_t* header = (size_t*)pointer;
+			if (header[1]) {
+				MemoryTracker::freed(header[0]);
+			}
+			std::free(pointer);
+		}
+	}
+}
+
+void* operator new(size_t bytes_)
+{
+	void* pointer = flann::memory_tracker::allocate(bytes_);
+	if (!pointer) {
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void* operator new[](size_t bytes_)
+{
+	void* pointer = flann::memory_tracker::allocate(bytes_);
+	if (!pointer) {
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void* operator new(size_t bytes_, const std::nothrow_t&) noexcept
+{
+	return flann::memory_tracker::allocate(bytes_);
+}
+
+void* operator new[](size_t bytes_, const std::nothrow_t&) noexcept
+{
+	return flann::memory_tracker::allocate(bytes_);
+}
+
+void operator delete(void* pointer_) noexcept
+{
+	flann::memory_tracker::free(pointer_);
+}
+
+void operator delete[](void* pointer_) noexcept
+{
+	flann::memory_tracker::free(pointer_);
+}
+
+void operator delete(void* pointer_, size_t) noexcept
+{
+	flann::memory_tracker::free(pointer_);
+}
+
+void operator delete[](void* pointer_, size_t) noexcept
+{
+	flann::memory_tracker::free(pointer_);
+}
+
+void operator delete(void* pointer_, const std::nothrow_t&) noexcept
+{
+	flann::memory_tracker::free(pointer_);
+}
+
+void operator delete[](void* pointer_, const std::nothrow_t&) noexcept
+{
+	flann::memory_tracker::free(pointer_);
+}
+
+#endif /* FLANN_MEMORY_TRACKER_OPERATORS */
+
+#endif /* FLANN_MEMORY_TRACKER_H_ */
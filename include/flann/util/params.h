@@ -32,8 +32,10 @@
 
 #include "any.h"
 #include "flann/general.h"
+#include "flann/util/search_statistics.h"
 #include <iostream>
 #include <map>
+#include <vector>
 
 
 namespace flann
@@ -66,6 +68,11 @@ struct SearchParams
     	max_neighbors = -1;
     	use_heap = FLANN_Undefined;
     	cores = 1;
+    	schedule = FLANN_SCHEDULE_STATIC;
+    	chunk_size = 16;
+    	thread_times = NULL;
+    	thread_allocations = NULL;
+    	statistics = NULL;
     	matrices_in_gpu_ram = false;
     }
 
@@ -81,6 +88,18 @@ struct SearchParams
     tri_type use_heap;
     // how many cores to assign to the search (used only if compiled with OpenMP capable compiler) (0 for auto)
     int cores;
+    // how the queries of a batch are distributed among the cores (default: FLANN_SCHEDULE_STATIC)
+    flann_schedule_t schedule;
+    // number of queries a core takes at once with the dynamic and stealing schedules (default: 16)
+    int chunk_size;
+    // if not NULL, receives the time in seconds every core spent on the last batch (default: NULL)
+    std::vector<double>* thread_times;
+    // if not NULL, receives the number of allocations every core made while searching its
+    // queries of the last batch, only counted if flann::MemoryTracker is enabled (default: NULL)
+    std::vector<size_t>* thread_allocations;
+    // if not NULL, receives the search statistics of every query of the last batch,
+    // only counted if compiled with FLANN_SEARCH_STATISTICS (default: NULL)
+    std::vector<SearchStatistics>* statistics;
     // for GPU search indicates if matrices are already in GPU ram
     bool matrices_in_gpu_ram;
 };
@@ -130,6 +149,9 @@ inline void print_params(const SearchParams& params)
 	std::cout << "eps : " << params.eps << std::endl;
 	std::cout << "sorted : " << params.sorted << std::endl;
 	std::cout << "max_neighbors : " << params.max_neighbors << std::endl;
+	std::cout << "cores : " << params.cores << std::endl;
+	std::cout << "schedule : " << params.schedule << std::endl;
+	std::cout << "chunk_size : " << params.chunk_size << std::endl;
 }
 
 
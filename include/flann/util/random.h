@@ -32,15 +32,172 @@
 #define FLANN_RANDOM_H
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstddef>
 #include <vector>
+#include <stdint.h>
 
 #include "flann/general.h"
 
 namespace flann
 {
 
+/**
+ * Pseudo random number generator xoshiro256** (Blackman and Vigna). It is
+ * small, fast and passes the common statistical tests. Generators with the
+ * same seed and different streams are 2^128 numbers apart, so they never
+ * produce overlapping sequences.
+ *
+ * The class satisfies the requirements of a uniform random bit generator and
+ * can be passed to std::shuffle.
+ */
+class RandomEngine
+{
+public:
+    typedef uint64_t result_type;
+
+    /**
+     * Constructor.
+     * @param seed Random seed
+     * @param stream Index of the stream
+     */
+    RandomEngine(uint64_t seed = 5489u, uint64_t stream = 0)
+    {
+        // expand the seed with splitmix64, which never yields an all-zero state
+        for (int i = 0; i < 4; ++i) {
+            seed += 0x9E3779B97F4A7C15ull;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            s_[i] = z ^ (z >> 31);
+        }
+        for (uint64_t i = 0; i < stream; ++i) {
+            jump();
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~result_type(0); }
+
+    /**
+     * Returns the next random number of the sequence.
+     */
+    result_type operator()()
+    {
+        const uint64_t result = rotl(s_[1] * 5, 7) * 9;
+        const uint64_t t = s_[1] << 17;
+
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 45);
+
+        return result;
+    }
+
+    /**
+     * Returns a random integer in [0,n).
+     */
+    uint32_t uniform(uint32_t n)
+    {
+        return uint32_t(((*this)() >> 32) * n >> 32);
+    }
+
+    /**
+     * Returns a random double in [0,1).
+     */
+    double real()
+    {
+        return ((*this)() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    /**
+     * Advances the generator by 2^128 numbers.
+     */
+    void jump()
+    {
+        static const uint64_t JUMP[] = { 0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull, 0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull };
+
+        uint64_t s[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < 4; ++i) {
+            for (int b = 0; b < 64; ++b) {
+                if (JUMP[i] & (uint64_t(1) << b)) {
+                    for (int j = 0; j < 4; ++j) s[j] ^= s_[j];
+                }
+                (*this)();
+            }
+        }
+        for (int j = 0; j < 4; ++j) s_[j] = s[j];
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t s_[4];
+};
+
+/**
+ * Seed which is used for the generators of threads which have not been seeded.
+ */
+inline std::atomic<uint64_t>& random_seed()
+{
+    static std::atomic<uint64_t> seed(5489u);
+    return seed;
+}
+
+/**
+ * Returns the random number generator of the calling thread. Every thread
+ * starts with its own stream of random_seed().
+ */
+inline RandomEngine& random_engine()
+{
+    static std::atomic<uint64_t> streams(0);
+    static thread_local RandomEngine engine(random_seed().load(), streams++);
+    return engine;
+}
+
+/**
+ * Replaces the random number generator of the calling thread until the end
+ * of the scope, e.g. to give every tree of a parallel build its own stream.
+ */
+class ScopedRandomEngine
+{
+public:
+    ScopedRandomEngine(const RandomEngine& engine) : saved_(random_engine())
+    {
+        random_engine() = engine;
+    }
+
+    ~ScopedRandomEngine()
+    {
+        random_engine() = saved_;
+    }
+
+private:
+    RandomEngine saved_;
+};
+
+/**
+ * Shuffles a range with the Fisher-Yates algorithm. Unlike std::shuffle the
+ * result only depends on the generator and not on the standard library.
+ * @param first Iterator to the first element
+ * @param last Iterator behind the last element
+ * @param engine Random number generator
+ */
+template <typename Iterator>
+void permute(Iterator first, Iterator last, RandomEngine& engine)
+{
+    for (ptrdiff_t i = (last - first) - 1; i > 0; --i) {
+        std::iter_swap(first + i, first + engine.uniform(uint32_t(i + 1)));
+    }
+}
+
 /**
  * Seeds the random number generator
  *  @param seed Random seed
@@ -48,6 +205,8 @@ namespace flann
 inline void seed_random(unsigned int seed)
 {
     srand(seed);
+    random_seed().store(seed);
+    random_engine() = RandomEngine(seed);
 }
 
 /*
@@ -61,7 +220,7 @@ inline void seed_random(unsigned int seed)
  */
 inline double rand_double(double high = 1.0, double low = 0)
 {
-    return low + ((high-low) * (std::rand() / (RAND_MAX + 1.0)));
+    return low + ((high-low) * random_engine().real());
 }
 
 /**
@@ -72,7 +231,7 @@ inline double rand_double(double high = 1.0, double low = 0)
  */
 inline int rand_int(int high = RAND_MAX, int low = 0)
 {
-    return low + (int) ( double(high-low) * (std::rand() / (RAND_MAX + 1.0)));
+    return low + (int) random_engine().uniform(uint32_t(high-low));
 }
 
 
@@ -110,14 +269,13 @@ public:
      */
     void init(int n)
     {
-        static RandomGenerator generator;
         // create and initialize an array of size n
         vals_.resize(n);
         size_ = n;
         for (int i = 0; i < size_; ++i) vals_[i] = i;
 
         // shuffle the elements in the array
-        std::random_shuffle(vals_.begin(), vals_.end(), generator);
+        permute(vals_.begin(), vals_.end(), random_engine());
 
         counter_ = 0;
     }
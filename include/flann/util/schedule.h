@@ -0,0 +1,179 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef FLANN_SCHEDULE_H_
+#define FLANN_SCHEDULE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+#include "flann/defines.h"
+
+namespace flann
+{
+	/**
+		Distributes the queries [0,size) of a batch search among a fixed number of
+		threads. Every thread asks for its next range of queries until next() fails.
+
+		FLANN_SCHEDULE_STATIC: every thread gets one contiguous range of equal size
+		FLANN_SCHEDULE_DYNAMIC: the threads take chunks from one shared counter
+		FLANN_SCHEDULE_STEALING: every thread takes chunks from the front of its own
+			range and, when this is exhausted, steals chunks from the back of the
+			ranges of the other threads
+	*/
+	class BatchScheduler
+	{
+	public:
+
+		/**
+			Constructor
+
+			@param size_ number of queries
+			@param threads_ number of threads which take part in the search
+			@param schedule_ policy used to distribute the queries
+			@param chunk_ number of queries a thread takes at once
+		*/
+		BatchScheduler(int size_, int threads_, flann_schedule_t schedule_, int chunk_) :
+			size(size_), threads(std::max(threads_, 1)), schedule(schedule_), chunk(std::max(chunk_, 1)),
+			ranges(new Range[std::max(threads_, 1)])
+		{
+			if (schedule == FLANN_SCHEDULE_DYNAMIC) {
+				ranges[0].store(0, size);
+				return;
+			}
+
+			for (int i = 0; i < threads; i++) {
+				ranges[i].store((int)((int64_t)size * i / threads), (int)((int64_t)size * (i + 1) / threads));
+			}
+		}
+
+		/**
+			Returns the next range of queries of a thread
+
+			@param thread_ number of the thread in [0,threads)
+			@param begin_ first query of the range
+			@param end_ query behind the last query of the range
+			@return false when no queries are left for this thread
+		*/
+		bool next(int thread_, int& begin_, int& end_)
+		{
+			switch (schedule) {
+			case FLANN_SCHEDULE_DYNAMIC:
+				return ranges[0].takeFront(chunk, begin_, end_);
+			case FLANN_SCHEDULE_STEALING:
+				if (ranges[thread_].takeFront(chunk, begin_, end_)) {
+					return true;
+				}
+				for (int i = 1; i < threads; i++) {
+					if (ranges[(thread_ + i) % threads].takeBack(chunk, begin_, end_)) {
+						return true;
+					}
+				}
+				return false;
+			default:
+				return ranges[thread_].takeFront(size, begin_, end_);
+			}
+		}
+
+	private:
+
+		/**
+			Range of queries which can be shrunk concurrently from both sides.
+			Begin and end are packed into one word, so that a single compare and
+			swap updates both. Every range lies on its own cache line.
+		*/
+		struct Range
+		{
+			std::atomic<uint64_t> bounds;
+			char padding[64 - sizeof(std::atomic<uint64_t>)];
+
+			Range() : bounds(0) {}
+
+			void store(int begin_, int end_)
+			{
+				bounds.store(pack(begin_, end_));
+			}
+
+			bool takeFront(int count_, int& begin_, int& end_)
+			{
+				uint64_t current = bounds.load();
+				for (;;) {
+					int begin = (int)(uint32_t)current;
+					int end = (int)(uint32_t)(current >> 32);
+					if (begin >= end) {
+						return false;
+					}
+					int split = end - begin > count_ ? begin + count_ : end;
+					if (bounds.compare_exchange_weak(current, pack(split, end))) {
+						begin_ = begin;
+						end_ = split;
+						return true;
+					}
+				}
+			}
+
+			bool takeBack(int count_, int& begin_, int& end_)
+			{
+				uint64_t current = bounds.load();
+				for (;;) {
+					int begin = (int)(uint32_t)current;
+					int end = (int)(uint32_t)(current >> 32);
+					if (begin >= end) {
+						return false;
+					}
+					int split = end - begin > count_ ? end - count_ : begin;
+					if (bounds.compare_exchange_weak(current, pack(begin, split))) {
+						begin_ = split;
+						end_ = end;
+						return true;
+					}
+				}
+			}
+
+			static uint64_t pack(int begin_, int end_)
+			{
+				return (uint64_t)(uint32_t)begin_ | ((uint64_t)(uint32_t)end_ << 32);
+			}
+		};
+
+		int size;
+		int threads;
+		flann_schedule_t schedule;
+		int chunk;
+
+		/**
+			One range per thread, the dynamic schedule only uses the first one
+		*/
+		std::unique_ptr<Range[]> ranges;
+	};
+}
+
+#endif /* FLANN_SCHEDULE_H_ */
@@ -0,0 +1,132 @@
+/***********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ * Copyright 2008-2009  Marius Muja (mariusm@cs.ubc.ca). All rights reserved.
+ * Copyright 2008-2009  David G. Lowe (lowe@cs.ubc.ca). All rights reserved.
+ *
+ * THE BSD LICENSE
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *************************************************************************/
+
+#ifndef FLANN_SEARCH_STATISTICS_H_
+#define FLANN_SEARCH_STATISTICS_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+/**
+ * The search paths of the kd-trees count their work only if the library is
+ * compiled with FLANN_SEARCH_STATISTICS defined, otherwise the counters are
+ * removed by the preprocessor and cost nothing.
+ */
+#ifdef FLANN_SEARCH_STATISTICS
+#define FLANN_STATISTICS(x) x
+#else
+#define FLANN_STATISTICS(x)
+#endif
+
+#ifdef __CUDACC__
+#define FLANN_HOST_DEVICE __host__ __device__
+#else
+#define FLANN_HOST_DEVICE
+#endif
+
+namespace flann
+{
+
+/**
+ * Counters of the work done by the search of a single query, or by a number
+ * of queries if they are aggregated.
+ */
+struct SearchStatistics
+{
+    // number of queries
+    size_t queries;
+    // inner nodes and leaves which have been visited
+    size_t nodes;
+    // leaves which have been reached
+    size_t leaves;
+    // evaluations of the distance functor
+    size_t distances;
+    // branches pushed onto the heap
+    size_t pushes;
+    // branches popped from the heap
+    size_t pops;
+    // largest size of the heap, the maximum over all queries when aggregated
+    size_t peak_heap;
+    // branches which have not been searched because they were too far
+    size_t pruned;
+
+    FLANN_HOST_DEVICE
+    SearchStatistics()
+    {
+        clear();
+    }
+
+    FLANN_HOST_DEVICE
+    void clear()
+    {
+        queries = nodes = leaves = distances = pushes = pops = peak_heap = pruned = 0;
+    }
+
+    SearchStatistics& operator+=(const SearchStatistics& other)
+    {
+        queries += other.queries;
+        nodes += other.nodes;
+        leaves += other.leaves;
+        distances += other.distances;
+        pushes += other.pushes;
+        pops += other.pops;
+        peak_heap = std::max(peak_heap, other.peak_heap);
+        pruned += other.pruned;
+        return *this;
+    }
+
+    /**
+     * Counters of the query the calling thread is searching for
+     */
+    static SearchStatistics& local()
+    {
+        static thread_local SearchStatistics statistics;
+        return statistics;
+    }
+};
+
+/**
+ * Sums up the counters of a number of queries
+ * @param statistics Counters of the queries
+ * @return Aggregated counters
+ */
+inline SearchStatistics aggregate(const std::vector<SearchStatistics>& statistics)
+{
+    SearchStatistics result;
+    for (size_t i=0; i<statistics.size(); ++i) {
+        result += statistics[i];
+    }
+    return result;
+}
+
+}
+
+#endif //FLANN_SEARCH_STATISTICS_H_
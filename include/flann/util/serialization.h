@@ -6,8 +6,10 @@
 #include <cstdlib>
 #include <cstring>
 #include <stdio.h>
+#include <memory>
 #include "flann/ext/lz4.h"
 #include "flann/ext/lz4hc.h"
+#include "flann/util/thread_pool.h"
 
 
 namespace flann
@@ -373,11 +375,76 @@ public:
     
 #define BLOCK_BYTES (1024 * 64)
 
+/**
+ * Layout of the compressed data of an archive, stored in the compression
+ * field of the index header
+ */
+enum CompressionFormat
+{
+    /** One LZ4HC stream of 64 KB blocks, every block references the previous */
+    COMPRESSION_STREAM = 1,
+    /** Independent blocks which are compressed and decompressed in parallel */
+    COMPRESSION_BLOCKS = 2
+};
+
+struct CompressionParams
+{
+    CompressionParams(CompressionFormat format_ = COMPRESSION_STREAM, int level_ = 0, int cores_ = 0, size_t block_size_ = 1024 * 1024) :
+        format(format_), level(level_), cores(cores_), block_size(block_size_)
+    {
+    }
+
+    /** Layout of the compressed data */
+    CompressionFormat format;
+    /** Level of LZ4HC for independent blocks, 0 selects the fast LZ4 compressor.
+     *  The stream is always compressed with LZ4HC level 9. */
+    int level;
+    /** Number of threads for independent blocks, 0 for the number of hardware threads */
+    int cores;
+    /** Uncompressed size of an independent block in bytes */
+    size_t block_size;
+};
+
+/**
+ * Compression parameters of the calling thread, used by archives which are
+ * created without explicit parameters, e.g. by NNIndex::saveIndex().
+ */
+inline CompressionParams& compression_params()
+{
+    static thread_local CompressionParams params;
+    return params;
+}
+
+/**
+ * Replaces the compression parameters of the calling thread until the end
+ * of the scope.
+ */
+class ScopedCompressionParams
+{
+public:
+    ScopedCompressionParams(const CompressionParams& params) : saved_(compression_params())
+    {
+        compression_params() = params;
+    }
+
+    ~ScopedCompressionParams()
+    {
+        compression_params() = saved_;
+    }
+
+private:
+    CompressionParams saved_;
+};
+
 class SaveArchive : public OutputArchive<SaveArchive>
 {
     /**
      * Based on blockStreaming_doubleBuffer code at:
      * https://github.com/Cyan4973/lz4/blob/master/examples/blockStreaming_doubleBuffer.c
+     *
+     * With COMPRESSION_BLOCKS the header is followed by independent blocks,
+     * each prefixed by its compressed and uncompressed size. A batch of
+     * blocks is compressed in parallel before it is written.
      */
     
     FILE* stream_;
@@ -391,11 +458,26 @@ class SaveArchive : public OutputArchive<SaveArchive>
     LZ4_streamHC_t lz4Stream_body;
     LZ4_streamHC_t* lz4Stream;
 
+    CompressionParams params_;
+    size_t block_bytes_;
+    std::vector<std::vector<char> > pending_;
+    std::vector<std::vector<char> > compressed_;
+    std::unique_ptr<ThreadPool> workers_;
+
     void initBlock()
     {
+        block_bytes_ = BLOCK_BYTES;
+        if (params_.format == COMPRESSION_BLOCKS) {
+            if (params_.block_size < sizeof(IndexHeaderStruct) || params_.block_size > (1u << 30)) {
+                throw FLANNException("Invalid compression block size");
+            }
+            block_bytes_ = params_.block_size;
+            workers_.reset(new ThreadPool(params_.cores));
+        }
+
         // Alloc the space for both buffer blocks (each compressed block
         // references the previous)
-        buffer_ = buffer_blocks_ = (char *)malloc(BLOCK_BYTES*2);
+        buffer_ = buffer_blocks_ = (char *)malloc(block_bytes_*2);
         compressed_buffer_ = (char *)malloc(LZ4_COMPRESSBOUND(BLOCK_BYTES) + sizeof(size_t));
         if (buffer_ == NULL || compressed_buffer_ == NULL) {
             throw FLANNException("Error allocating compression buffer");
@@ -411,6 +493,10 @@ class SaveArchive : public OutputArchive<SaveArchive>
     
     void flushBlock()
     {
+        if (params_.format == COMPRESSION_BLOCKS) {
+            return flushIndependentBlock();
+        }
+
         size_t compSz = 0;
         // Handle header
         if (first_block_) {
@@ -464,8 +550,78 @@ class SaveArchive : public OutputArchive<SaveArchive>
         offset_ = 0;
     }
     
+    void flushIndependentBlock()
+    {
+        size_t begin = 0;
+        if (first_block_) {
+            // The header is stored uncompressed
+            IndexHeaderStruct *head = (IndexHeaderStruct *)buffer_;
+            size_t headSz = sizeof(IndexHeaderStruct);
+
+            assert(head->compression == 0);
+            head->compression = COMPRESSION_BLOCKS;
+            head->first_block_size = block_bytes_;
+            fwrite(buffer_, headSz, 1, stream_);
+
+            begin = headSz;
+            first_block_ = false;
+        }
+
+        if (offset_ > begin) {
+            pending_.push_back(std::vector<char>(buffer_ + begin, buffer_ + offset_));
+        }
+        offset_ = 0;
+
+        if (pending_.size() >= size_t(4 * workers_->size())) {
+            writeBlocks();
+        }
+    }
+
+    void writeBlocks()
+    {
+        compressed_.resize(pending_.size());
+
+        std::atomic<size_t> next(0);
+        std::atomic<bool> valid(true);
+        workers_->run(workers_->size(), [&](int, int) {
+            for (size_t i = next++; i < pending_.size(); i = next++) {
+                const std::vector<char>& block = pending_[i];
+                std::vector<char>& target = compressed_[i];
+                target.resize(LZ4_COMPRESSBOUND(block.size()));
+
+                int compSz = params_.level > 0 ?
+                    LZ4_compress_HC(&block[0], &target[0], (int)block.size(), (int)target.size(), params_.level) :
+                    LZ4_compress_default(&block[0], &target[0], (int)block.size(), (int)target.size());
+                if (compSz <= 0) {
+                    valid = false;
+                }
+                // Blocks which do not shrink are stored uncompressed
+                else if ((size_t)compSz >= block.size()) {
+                    target.assign(block.begin(), block.end());
+                }
+                else {
+                    target.resize(compSz);
+                }
+            }
+        });
+        if (!valid) {
+            throw FLANNException("Error compressing");
+        }
+
+        for (size_t i = 0; i < pending_.size(); ++i) {
+            size_t sizes[2] = { compressed_[i].size(), pending_[i].size() };
+            fwrite(sizes, sizeof(sizes), 1, stream_);
+            fwrite(&compressed_[i][0], compressed_[i].size(), 1, stream_);
+        }
+        pending_.clear();
+    }
+
     void endBlock()
     {
+        if (params_.format == COMPRESSION_BLOCKS) {
+            writeBlocks();
+        }
+
         // Cleanup memory
         free(buffer_blocks_);
         buffer_blocks_ = NULL;
@@ -479,14 +635,14 @@ class SaveArchive : public OutputArchive<SaveArchive>
     }
 
 public:
-    SaveArchive(const char* filename)
+    SaveArchive(const char* filename, const CompressionParams& params = compression_params()) : params_(params)
     {
         stream_ = fopen(filename, "wb");
         own_stream_ = true;
         initBlock();
     }
 
-    SaveArchive(FILE* stream) : stream_(stream), own_stream_(false)
+    SaveArchive(FILE* stream, const CompressionParams& params = compression_params()) : stream_(stream), own_stream_(false), params_(params)
     {
         initBlock();
     }
@@ -507,8 +663,8 @@ public:
     template<typename T>
     void save(const T& val)
     {
-        assert(sizeof(val) < BLOCK_BYTES);
-        if (offset_+sizeof(val) > BLOCK_BYTES)
+        assert(sizeof(val) < block_bytes_);
+        if (offset_+sizeof(val) > block_bytes_)
             flushBlock();
         memcpy(buffer_+offset_, &val, sizeof(val));
         offset_ += sizeof(val);
@@ -524,19 +680,19 @@ public:
     template<typename T>
     void save_binary(T* ptr, size_t size)
     {
-        while (size > BLOCK_BYTES) {
+        while (size > block_bytes_) {
             // Flush existing block
             flushBlock();
             
             // Save large chunk
-            memcpy(buffer_, ptr, BLOCK_BYTES);
-            offset_ += BLOCK_BYTES;
-            ptr = ((char *)ptr) + BLOCK_BYTES;
-            size -= BLOCK_BYTES;
+            memcpy(buffer_, ptr, block_bytes_);
+            offset_ += block_bytes_;
+            ptr = ((char *)ptr) + block_bytes_;
+            size -= block_bytes_;
         }
         
         // Save existing block if new data will make it too big
-        if (offset_+size > BLOCK_BYTES)
+        if (offset_+size > block_bytes_)
             flushBlock();
         
         // Copy out requested data
@@ -565,6 +721,15 @@ class LoadArchive : public InputArchive<LoadArchive>
     LZ4_streamDecode_t* lz4StreamDecode;
     size_t block_sz_;
 
+    int cores_;
+    bool blocks_;
+    bool end_reached_;
+    size_t block_bytes_;
+    size_t decoded_index_;
+    std::vector<std::vector<char> > decoded_;
+    std::vector<std::vector<char> > compressed_;
+    std::unique_ptr<ThreadPool> workers_;
+
     void decompressAndLoadV10(FILE* stream)
     {
         buffer_ = NULL;
@@ -634,6 +799,8 @@ class LoadArchive : public InputArchive<LoadArchive>
         buffer_ = NULL;
         buffer_blocks_ = NULL;
         compressed_buffer_ = NULL;
+        blocks_ = false;
+        end_reached_ = false;
         size_t headSz = sizeof(IndexHeaderStruct);
         
         // Read the file header to a buffer
@@ -652,6 +819,24 @@ class LoadArchive : public InputArchive<LoadArchive>
             fseek(stream, pos, SEEK_SET);
             return decompressAndLoadV10(stream);
         }
+
+        if (head->compression == COMPRESSION_BLOCKS) {
+            blocks_ = true;
+            block_bytes_ = head->first_block_size;
+            if (block_bytes_ < headSz || block_bytes_ > (1u << 30)) {
+                free(head);
+                throw FLANNException("Invalid index file, wrong block size");
+            }
+            workers_.reset(new ThreadPool(cores_));
+
+            // The header is stored uncompressed and served as the first block
+            decoded_.assign(1, std::vector<char>((char*)head, (char*)head + headSz));
+            decoded_index_ = 0;
+            ptr_ = buffer_ = &decoded_[0][0];
+            block_sz_ = headSz;
+            free(head);
+            return;
+        }
         
         // Alloc the space for both buffer blocks (each block
         // references the previous)
@@ -694,11 +879,77 @@ class LoadArchive : public InputArchive<LoadArchive>
         block_sz_ = decBytes;
     }
     
+    /**
+     * Reads a batch of independent blocks and decompresses them in parallel
+     */
+    void loadBlocks()
+    {
+        size_t count = 0;
+        while (count < size_t(4 * workers_->size()) && !end_reached_) {
+            size_t sizes[2] = { 0, 0 };
+            if (fread(&sizes[0], sizeof(size_t), 1, stream_) != 1) {
+                throw FLANNException("Invalid index file, cannot read from disk (block)");
+            }
+            if (sizes[0] == 0) {
+                end_reached_ = true;
+                break;
+            }
+            if (fread(&sizes[1], sizeof(size_t), 1, stream_) != 1) {
+                throw FLANNException("Invalid index file, cannot read from disk (block)");
+            }
+            if (sizes[1] == 0 || sizes[1] > block_bytes_ || sizes[0] > sizes[1]) {
+                throw FLANNException("Requested block size too large");
+            }
+
+            if (compressed_.size() <= count) {
+                compressed_.resize(count + 1);
+                decoded_.resize(count + 1);
+            }
+            compressed_[count].resize(sizes[0]);
+            decoded_[count].resize(sizes[1]);
+            if (fread(&compressed_[count][0], sizes[0], 1, stream_) != 1) {
+                throw FLANNException("Invalid index file, cannot read from disk (block)");
+            }
+            ++count;
+        }
+        if (count == 0) {
+            throw FLANNException("Requested to read next block past end of file");
+        }
+        decoded_.resize(count);
+
+        std::atomic<size_t> next(0);
+        std::atomic<bool> valid(true);
+        workers_->run(workers_->size(), [&](int, int) {
+            for (size_t i = next++; i < count; i = next++) {
+                std::vector<char>& block = decoded_[i];
+                if (compressed_[i].size() == block.size()) {
+                    memcpy(&block[0], &compressed_[i][0], block.size());
+                }
+                else if (LZ4_decompress_safe(&compressed_[i][0], &block[0], (int)compressed_[i].size(), (int)block.size()) != (int)block.size()) {
+                    valid = false;
+                }
+            }
+        });
+        if (!valid) {
+            throw FLANNException("Invalid index file, cannot decompress block");
+        }
+        decoded_index_ = 0;
+    }
+
     void preparePtr(size_t size)
     {
         // Return if the new size is less than (or eq) the size of a block
         if (ptr_+size <= buffer_+block_sz_)
             return;
+
+        if (blocks_) {
+            if (++decoded_index_ >= decoded_.size()) {
+                loadBlocks();
+            }
+            ptr_ = buffer_ = &decoded_[decoded_index_][0];
+            block_sz_ = decoded_[decoded_index_].size();
+            return;
+        }
         
         // Switch the buffer to the *other* block
         if (buffer_ == buffer_blocks_)
@@ -721,7 +972,7 @@ class LoadArchive : public InputArchive<LoadArchive>
     void endBlock()
     {
         // If not v1.0 format hack...
-        if (buffer_blocks_ != NULL) {
+        if (buffer_blocks_ != NULL || (blocks_ && !end_reached_)) {
             // Read the last '0' in the file
             size_t zero = -1;
             if (fread(&zero, sizeof(zero), 1, stream_) != 1) {
@@ -745,7 +996,7 @@ class LoadArchive : public InputArchive<LoadArchive>
     }
     
 public:
-    LoadArchive(const char* filename)
+    LoadArchive(const char* filename, int cores = compression_params().cores) : cores_(cores)
     {
         // Open the file
         stream_ = fopen(filename, "rb");
@@ -754,7 +1005,7 @@ public:
         initBlock(stream_);
     }
 
-    LoadArchive(FILE* stream)
+    LoadArchive(FILE* stream, int cores = compression_params().cores) : cores_(cores)
     {
         stream_ = stream;
         own_stream_ = false;
@@ -788,15 +1039,16 @@ public:
     template<typename T>
     void load_binary(T* ptr, size_t size)
     {
-        while (size > BLOCK_BYTES) {
+        size_t block_bytes = blocks_ ? block_bytes_ : BLOCK_BYTES;
+        while (size > block_bytes) {
             // Load next block
-            preparePtr(BLOCK_BYTES);
+            preparePtr(block_bytes);
             
             // Load large chunk
-            memcpy(ptr, ptr_, BLOCK_BYTES);
-            ptr_ += BLOCK_BYTES;
-            ptr = ((char *)ptr) + BLOCK_BYTES;
-            size -= BLOCK_BYTES;
+            memcpy(ptr, ptr_, block_bytes);
+            ptr_ += block_bytes;
+            ptr = ((char *)ptr) + block_bytes;
+            size -= block_bytes;
         }
         
         // Load next block if needed
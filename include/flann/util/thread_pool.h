@@ -0,0 +1,388 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef FLANN_THREAD_POOL_H_
+#define FLANN_THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace flann
+{
+	/**
+		Persistent pool of worker threads. A batch is a job which is executed by
+		a number of threads at once, job(thread, threads) is called once for every
+		thread in [0,threads). The calling thread takes part as thread 0, so a pool
+		of size n owns n-1 worker threads.
+
+		The workers stay alive between batches. After a batch they spin for a short
+		time before they block, so consecutive small batches do not pay for waking
+		up the threads.
+
+		An observer which is installed with setObserver() is told when a thread
+		begins and ends its share of a batch, e.g. to record it in a timeline.
+	*/
+	class ThreadPool
+	{
+	public:
+
+		typedef std::function<void(int, int)> Job;
+
+		/**
+			Receives the begin and the end of the share of a thread of a batch of
+			every pool. Both are called on the executing thread, end() also if the
+			job throws.
+		*/
+		class Observer
+		{
+		public:
+
+			virtual ~Observer() {}
+
+			/**
+				Called before a thread executes its share of a batch
+
+				@param id_ number of the thread in the batch
+				@param threads_ number of threads of the batch
+			*/
+			virtual void begin(int id_, int threads_) = 0;
+
+			/**
+				Called after a thread has executed its share of a batch
+
+				@param id_ number of the thread in the batch
+				@param threads_ number of threads of the batch
+			*/
+			virtual void end(int id_, int threads_) = 0;
+		};
+
+		/**
+			Constructor
+
+			@param threads_ number of threads including the calling thread, 0 for
+				the number of hardware threads
+			@param pin_ pins every worker thread to its own core out of the cores
+				the process may run on
+		*/
+		ThreadPool(int threads_ = 0, bool pin_ = false) :
+			stop(false), generation(0), job(nullptr), active(0), pending(0)
+		{
+			int threads = resolveThreads(threads_);
+			for (int i = 1; i < threads; i++) {
+				workers.push_back(std::thread(&ThreadPool::work, this, i, pin_));
+			}
+		}
+
+		/**
+			Deconstructor, waits for the workers to finish
+		*/
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+			}
+			wakeup.notify_all();
+			for (size_t i = 0; i < workers.size(); i++) {
+				workers[i].join();
+			}
+		}
+
+		/**
+			Returns the number of threads including the calling thread
+
+			@return number of threads
+		*/
+		int size() const
+		{
+			return (int)workers.size() + 1;
+		}
+
+		/**
+			Executes a job on a number of threads and waits until every thread has
+			finished. Batches of different callers are executed one after another.
+			An exception thrown by the job is rethrown in the calling thread.
+
+			@param threads_ number of threads, at most size()
+			@param job_ job which is called once for every thread
+		*/
+		void run(int threads_, const Job& job_)
+		{
+			threads_ = std::max(1, std::min(threads_, size()));
+			if (threads_ == 1) {
+				execute(job_, 0, 1);
+				return;
+			}
+
+			std::lock_guard<std::mutex> batch(batchMutex);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				job = &job_;
+				active = threads_;
+				pending = threads_ - 1;
+				error = std::exception_ptr();
+				generation.fetch_add(1);
+			}
+			wakeup.notify_all();
+
+			try {
+				execute(job_, 0, threads_);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				error = std::current_exception();
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			finished.wait(lock, [this] { return pending == 0; });
+			job = nullptr;
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+
+		/**
+			Resolves a requested number of threads, 0 or less stands for the number
+			of hardware threads
+
+			@param threads_ requested number of threads
+			@return number of threads which is at least 1
+		*/
+		static int resolveThreads(int threads_)
+		{
+			if (threads_ > 0) {
+				return threads_;
+			}
+			int hardware = (int)std::thread::hardware_concurrency();
+			return hardware > 0 ? hardware : 1;
+		}
+
+		/**
+			Installs the observer of all pools, without an observer a batch costs
+			a single atomic load more. The observer has to outlive every batch
+			which has begun while it was installed.
+
+			@param observer_ observer or nullptr to remove it
+		*/
+		static void setObserver(Observer* observer_)
+		{
+			observer().store(observer_);
+		}
+
+	private:
+
+		/**
+			Main loop of a worker thread
+
+			@param id_ number of the worker in [1,size())
+			@param pin_ pins the worker to its own core
+		*/
+		void work(int id_, bool pin_)
+		{
+			if (pin_) {
+				pin(id_);
+			}
+
+			unsigned long long seen = 0;
+			for (;;) {
+				/**
+					Spin for a short time before blocking on the condition variable
+				*/
+				for (int i = 0; i < SPIN_COUNT && generation.load() == seen && !stop; i++) {
+					std::this_thread::yield();
+				}
+
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeup.wait(lock, [this, seen] { return stop || generation.load() != seen; });
+				if (stop) {
+					return;
+				}
+				seen = generation.load();
+				if (id_ >= active) {
+					continue;
+				}
+
+				const Job* current = job;
+				int threads = active;
+				lock.unlock();
+
+				try {
+					execute(*current, id_, threads);
+				}
+				catch (...) {
+					lock.lock();
+					error = std::current_exception();
+					lock.unlock();
+				}
+
+				lock.lock();
+				pending = pending - 1;
+				if (pending == 0) {
+					finished.notify_one();
+				}
+			}
+		}
+
+		/**
+			Executes the share of a thread of a batch and reports it to the observer
+
+			@param job_ job of the batch
+			@param id_ number of the thread in the batch
+			@param threads_ number of threads of the batch
+		*/
+		void execute(const Job& job_, int id_, int threads_)
+		{
+			Observer* current = observer().load(std::memory_order_acquire);
+			if (!current) {
+				job_(id_, threads_);
+				return;
+			}
+
+			struct Scope {
+				Observer& observer;
+				int id;
+				int threads;
+
+				Scope(Observer& observer_, int id_, int threads_) :
+					observer(observer_), id(id_), threads(threads_)
+				{
+					observer.begin(id, threads);
+				}
+
+				~Scope()
+				{
+					observer.end(id, threads);
+				}
+			} scope(*current, id_, threads_);
+			job_(id_, threads_);
+		}
+
+		/**
+			Observer of all pools
+		*/
+		static std::atomic<Observer*>& observer()
+		{
+			static std::atomic<Observer*> current(nullptr);
+			return current;
+		}
+
+		/**
+			Pins the calling thread to a core. The cores are taken from the
+			affinity mask of the process, so a restricted cpuset or a mask set by
+			the caller is respected.
+
+			@param id_ number of the worker
+		*/
+		static void pin(int id_)
+		{
+#if defined(_WIN32)
+			DWORD_PTR process = 0;
+			DWORD_PTR system = 0;
+			if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system) || !process) {
+				return;
+			}
+			std::vector<int> cores;
+			for (int i = 0; i < int(8 * sizeof(DWORD_PTR)); i++) {
+				if (process & (DWORD_PTR(1) << i)) {
+					cores.push_back(i);
+				}
+			}
+			SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cores[id_ % cores.size()]);
+#elif defined(__linux__)
+			cpu_set_t allowed;
+			CPU_ZERO(&allowed);
+			if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+				return;
+			}
+			std::vector<int> cores;
+			for (int i = 0; i < CPU_SETSIZE; i++) {
+				if (CPU_ISSET(i, &allowed)) {
+					cores.push_back(i);
+				}
+			}
+			if (cores.empty()) {
+				return;
+			}
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cores[id_ % cores.size()], &set);
+			pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+#else
+			(void)id_;
+#endif
+		}
+
+		enum
+		{
+			/**
+				Number of times an idle worker yields before it blocks
+			*/
+			SPIN_COUNT = 2000
+		};
+
+		std::vector<std::thread> workers;
+
+		/**
+			Serializes the batches of different callers
+		*/
+		std::mutex batchMutex;
+
+		/**
+			Protects the state of the current batch
+		*/
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		std::condition_variable finished;
+
+		std::atomic<bool> stop;
+		std::atomic<unsigned long long> generation;
+		const Job* job;
+		int active;
+		int pending;
+		std::exception_ptr error;
+	};
+}
+
+#endif /* FLANN_THREAD_POOL_H_ */
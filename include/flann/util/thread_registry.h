@@ -0,0 +1,202 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef FLANN_THREAD_REGISTRY_H_
+#define FLANN_THREAD_REGISTRY_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace flann
+{
+	/**
+		Registry of one entry per thread, e.g. the event buffers of a tracer or
+		the allocation counters of a thread. The first call of a thread registers
+		its entry, later calls cost a thread_local lookup. The entries outlive
+		their threads, the entry of a finished thread is continued by the next
+		new thread, so short-lived pools of workers do not add up entries.
+
+		A thread has an entry in one registry of an entry type at a time, it
+		releases its entry when it calls another registry of the same type.
+	*/
+	template <typename Entry>
+	class ThreadRegistry
+	{
+	public:
+
+		/**
+			Entry and whether its thread has released it
+		*/
+		struct Slot : Entry {
+			std::atomic<bool> released;
+
+			template <typename... Args>
+			Slot(Args&&... args_) :
+				Entry(std::forward<Args>(args_)...), released(false)
+			{
+			}
+		};
+
+		/**
+			Constructor
+		*/
+		ThreadRegistry() :
+			id(nextId())
+		{
+		}
+
+		/**
+			Returns the entry of the calling thread, registers it on the first call.
+			The registration allocates itself and returns nullptr to calls which
+			are made meanwhile, e.g. by a hook of the allocator. After the thread
+			has released its entry at its end, e.g. in destructors of other
+			thread_local objects, nullptr is returned as well.
+
+			@param args_ arguments of the constructor of a new entry
+			@return entry or nullptr
+		*/
+		template <typename... Args>
+		Entry* local(Args&&... args_)
+		{
+			State& state = threadState();
+			if (state.owner == id && state.slot) {
+				return state.slot;
+			}
+			if (state.busy) {
+				return nullptr;
+			}
+			state.busy = true;
+
+			static thread_local Release release;
+			if (release.slot) {
+				release.slot->released.store(true);
+			}
+
+			std::shared_ptr<Slot> slot;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (size_t i = 0; i < slots.size() && !slot; i++) {
+					bool released = true;
+					if (slots[i]->released.compare_exchange_strong(released, false)) {
+						slot = slots[i];
+					}
+				}
+				if (!slot) {
+					slots.push_back(std::make_shared<Slot>(std::forward<Args>(args_)...));
+					slot = slots.back();
+				}
+			}
+
+			release.slot = slot;
+			state.slot = slot.get();
+			state.owner = id;
+			state.busy = false;
+			return state.slot;
+		}
+
+		/**
+			Returns all entries which have been registered, in the order of their
+			registration. The calling thread does not register while the entries
+			are copied, so a hook of the allocator cannot lock the registry again.
+
+			@return entries
+		*/
+		std::vector<std::shared_ptr<Slot>> entries() const
+		{
+			State& state = threadState();
+			bool busy = state.busy;
+			state.busy = true;
+			std::vector<std::shared_ptr<Slot>> copy;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				copy = slots;
+			}
+			state.busy = busy;
+			return copy;
+		}
+
+	private:
+
+		/**
+			Entry of the calling thread, trivially destructible so it can be read
+			until the thread has finished
+		*/
+		struct State {
+			Slot* slot;
+			unsigned long long owner;
+			bool busy;
+		};
+
+		/**
+			Releases the entry of the calling thread when the thread finishes
+		*/
+		struct Release {
+			std::shared_ptr<Slot> slot;
+
+			~Release()
+			{
+				State& state = threadState();
+				state.slot = nullptr;
+				state.busy = true;
+				if (slot) {
+					slot->released.store(true);
+				}
+			}
+		};
+
+		static State& threadState()
+		{
+			static thread_local State state = { nullptr, 0, false };
+			return state;
+		}
+
+		/**
+			The id tells registries apart even if one is constructed at the
+			address of another
+		*/
+		static unsigned long long nextId()
+		{
+			static std::atomic<unsigned long long> ids(0);
+			return ++ids;
+		}
+
+		unsigned long long id;
+		std::vector<std::shared_ptr<Slot>> slots;
+
+		/**
+			Guards the registration of the entries
+		*/
+		mutable std::mutex mutex;
+	};
+}
+
+#endif /* FLANN_THREAD_REGISTRY_H_ */
@@ -0,0 +1,167 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef BENCHMARK_ORDEREDSET_H_
+#define BENCHMARK_ORDEREDSET_H_
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "utils/balancedtree.h"
+#include "utils/flatset.h"
+
+namespace benchmark
+{
+	/**
+		Throughput of an ordered set in operations per second
+	*/
+	struct Throughput {
+		double insert;
+		double search;
+		int found;
+	};
+
+	/**
+		Returns the seconds which have passed since a point in time
+
+		@param start_ point in time
+		@return seconds
+	*/
+	inline double seconds(std::chrono::steady_clock::time_point start_)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+	}
+
+	/**
+		Measures BalancedTree
+
+		@param values_ values which are inserted
+		@param queries_ values which are searched for
+		@return throughput
+	*/
+	template <typename ElementType>
+	Throughput balancedtree(const std::vector<ElementType>& values_, const std::vector<ElementType>& queries_)
+	{
+		Throughput throughput;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		utils::BalancedTree<ElementType>* root = new utils::BalancedTree<ElementType>(NULL);
+		for (size_t i = 0; i < values_.size(); ++i) {
+			root->addNode((void**)&root, values_[i]);
+		}
+		throughput.insert = values_.size() / seconds(start);
+
+		start = std::chrono::steady_clock::now();
+		throughput.found = 0;
+		for (size_t i = 0; i < queries_.size(); ++i) {
+			throughput.found += root->search(queries_[i]);
+		}
+		throughput.search = queries_.size() / seconds(start);
+
+		delete root;
+		return throughput;
+	}
+
+	/**
+		Measures FlatSet
+
+		@param values_ values which are inserted
+		@param queries_ values which are searched for
+		@param bulk_ inserts all values at once
+		@return throughput
+	*/
+	template <typename ElementType>
+	Throughput flatset(const std::vector<ElementType>& values_, const std::vector<ElementType>& queries_, bool bulk_)
+	{
+		Throughput throughput;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		utils::FlatSet<ElementType> set;
+		if (bulk_) {
+			set.addNodes(values_.begin(), values_.end());
+		}
+		else {
+			for (size_t i = 0; i < values_.size(); ++i) {
+				set.addNode(values_[i]);
+			}
+		}
+		throughput.insert = values_.size() / seconds(start);
+
+		start = std::chrono::steady_clock::now();
+		throughput.found = 0;
+		for (size_t i = 0; i < queries_.size(); ++i) {
+			throughput.found += set.search(queries_[i]);
+		}
+		throughput.search = queries_.size() / seconds(start);
+
+		return throughput;
+	}
+
+	/**
+		Compares insert and lookup throughput of BalancedTree and FlatSet. The
+		values are drawn at random from [0,4*number_), so about half of the
+		lookups find their value.
+
+		@param number_ number of values which are inserted and searched for
+		@param stream_ stream which receives the results
+	*/
+	inline void orderedset(size_t number_, std::ostream& stream_ = std::cout)
+	{
+		std::mt19937 generator(5489u);
+		std::uniform_int_distribution<int> distribution(0, int(4 * number_));
+
+		std::vector<int> values(number_);
+		std::vector<int> queries(number_);
+		for (size_t i = 0; i < number_; ++i) {
+			values[i] = distribution(generator);
+		}
+		for (size_t i = 0; i < number_; ++i) {
+			queries[i] = i % 2 ? values[distribution(generator) % number_] : distribution(generator);
+		}
+
+		Throughput results[3] = {
+			balancedtree(values, queries),
+			flatset(values, queries, false),
+			flatset(values, queries, true)
+		};
+		const char* names[3] = { "BalancedTree", "FlatSet", "FlatSet (bulk)" };
+
+		stream_ << "Ordered set with " << number_ << " values [Mop/s]" << std::endl;
+		for (int i = 0; i < 3; ++i) {
+			stream_ << names[i] << ": insert " << results[i].insert * 1e-6
+				<< " search " << results[i].search * 1e-6
+				<< " found " << results[i].found << std::endl;
+		}
+	}
+}
+
+#endif /* BENCHMARK_ORDEREDSET_H_ */
@@ -0,0 +1,160 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef BENCHMARK_RECALL_H_
+#define BENCHMARK_RECALL_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "flann/algorithms/dist.h"
+#include "flann/nn/ground_truth.h"
+#include "flann/nn/index_testing.h"
+#include "flann/util/matrix.h"
+
+namespace benchmark
+{
+	/**
+		Header of a file with cached ground truth
+	*/
+	struct GroundTruthHeader {
+		char signature[16];
+		uint64_t rows;
+		uint64_t cols;
+		/** checksum of the points and the queries */
+		uint64_t checksum;
+	};
+
+	/**
+		Returns the FNV-1a hash of a buffer
+
+		@param data_ buffer
+		@param size_ size of the buffer in bytes
+		@param hash_ hash of the preceding buffers
+		@return hash
+	*/
+	inline uint64_t checksum(const void* data_, size_t size_, uint64_t hash_ = 14695981039346656037ull)
+	{
+		const unsigned char* bytes = (const unsigned char*)data_;
+		for (size_t i = 0; i < size_; ++i) {
+			hash_ = (hash_ ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash_;
+	}
+
+	/**
+		Computes the exact nearest neighbors of queries or reads them from a
+		cache file. The file is used if it belongs to the same points and
+		queries and has at least as many neighbors, otherwise it is computed
+		and written.
+
+		@param points_ points
+		@param queries_ queries
+		@param groundtruth_ vector which receives queries_.rows*knn_ indices of points
+		@param knn_ number of nearest neighbors
+		@param file_ cache file, empty for no cache
+	*/
+	inline void groundTruth(const flann::Matrix<float>& points_, const flann::Matrix<float>& queries_,
+		std::vector<size_t>& groundtruth_, size_t knn_, const std::string& file_ = "")
+	{
+		groundtruth_.resize(queries_.rows * knn_);
+
+		uint64_t hash = checksum(points_.ptr(), points_.rows * points_.stride);
+		hash = checksum(queries_.ptr(), queries_.rows * queries_.stride, hash);
+
+		if (!file_.empty()) {
+			FILE* file = fopen(file_.c_str(), "rb");
+			if (file) {
+				GroundTruthHeader header;
+				bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+					!strncmp(header.signature, "GROUNDTRUTH", sizeof(header.signature)) &&
+					header.rows == queries_.rows && header.cols >= knn_ && header.checksum == hash;
+
+				std::vector<uint64_t> row(valid ? size_t(header.cols) : 0);
+				for (size_t i = 0; valid && i < queries_.rows; ++i) {
+					valid = fread(row.data(), sizeof(uint64_t), row.size(), file) == row.size();
+					for (size_t j = 0; valid && j < knn_; ++j) {
+						valid = row[j] < points_.rows;
+						groundtruth_[i * knn_ + j] = size_t(row[j]);
+					}
+				}
+				fclose(file);
+				if (valid) {
+					return;
+				}
+			}
+		}
+
+		flann::Matrix<size_t> matches(groundtruth_.data(), queries_.rows, knn_);
+		flann::compute_ground_truth<flann::L2<float> >(points_, queries_, matches);
+
+		if (!file_.empty()) {
+			FILE* file = fopen(file_.c_str(), "wb");
+			if (file) {
+				GroundTruthHeader header;
+				memset(&header, 0, sizeof(header));
+				strncpy(header.signature, "GROUNDTRUTH", sizeof(header.signature));
+				header.rows = queries_.rows;
+				header.cols = knn_;
+				header.checksum = hash;
+
+				std::vector<uint64_t> values(groundtruth_.begin(), groundtruth_.end());
+				bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+					fwrite(values.data(), sizeof(uint64_t), values.size(), file) == values.size();
+				fclose(file);
+				if (!written) {
+					remove(file_.c_str());
+				}
+			}
+		}
+	}
+
+	/**
+		Returns the fraction of the exact k nearest neighbors which have been
+		found, recall@k
+
+		@param indices_ neighbors which have been found, knn_ per query
+		@param groundtruth_ exact neighbors, at least knn_ per query
+		@param knn_ number of neighbors per query
+		@return recall in [0,1]
+	*/
+	inline double recall(const flann::Matrix<size_t>& indices_, const flann::Matrix<size_t>& groundtruth_, size_t knn_)
+	{
+		size_t correct = 0;
+		for (size_t i = 0; i < indices_.rows; ++i) {
+			correct += flann::countCorrectMatches(indices_[i], groundtruth_[i], int(knn_));
+		}
+		return indices_.rows ? double(correct) / (indices_.rows * knn_) : 1.0;
+	}
+}
+
+#endif /* BENCHMARK_RECALL_H_ */
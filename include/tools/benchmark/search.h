@@ -0,0 +1,660 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef BENCHMARK_SEARCH_H_
+#define BENCHMARK_SEARCH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "flann/flann.hpp"
+
+#include "benchmark/recall.h"
+#include "utils/memorytracker.h"
+#include "utils/perfcounters.h"
+#include "utils/timer.h"
+
+namespace benchmark
+{
+	/**
+		Synthetic distributions of the points
+	*/
+	enum Distribution {
+		/** uniform in the unit cube */
+		DISTRIBUTION_UNIFORM,
+		/** normal around a few centers in the unit cube */
+		DISTRIBUTION_CLUSTERED,
+		/** rings of a laser scanner on a plane, in the order of the scan */
+		DISTRIBUTION_PLANAR
+	};
+
+	/**
+		Returns the name of a distribution
+
+		@param distribution_ distribution
+		@return name
+	*/
+	inline const char* distributionName(Distribution distribution_)
+	{
+		switch (distribution_) {
+		case DISTRIBUTION_UNIFORM: return "uniform";
+		case DISTRIBUTION_CLUSTERED: return "clustered";
+		case DISTRIBUTION_PLANAR: return "planar";
+		}
+		return "unknown";
+	}
+
+	/**
+		Returns the name of an algorithm
+
+		@param algorithm_ algorithm
+		@return name
+	*/
+	inline const char* algorithmName(flann::flann_algorithm_t algorithm_)
+	{
+		switch (algorithm_) {
+		case flann::FLANN_INDEX_LINEAR: return "linear";
+		case flann::FLANN_INDEX_KDTREE: return "kdtree";
+		case flann::FLANN_INDEX_KDTREE_SINGLE: return "kdtree_single";
+		case flann::FLANN_INDEX_KDTREE_CUDA: return "kdtree_cuda";
+		default: return "unknown";
+		}
+	}
+
+	/**
+		Generates synthetic points
+
+		@param data_ vector which receives rows_*dim_ coordinates
+		@param rows_ number of points
+		@param dim_ dimension of the points
+		@param distribution_ distribution of the points
+		@param seed_ seed of the random numbers, the structure of a distribution
+			like its clusters is the same for every seed
+	*/
+	inline void generate(std::vector<float>& data_, size_t rows_, size_t dim_, Distribution distribution_, unsigned int seed_)
+	{
+		std::mt19937 generator(seed_);
+		std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+		std::normal_distribution<float> normal(0.0f, 1.0f);
+
+		data_.resize(rows_ * dim_);
+		if (distribution_ == DISTRIBUTION_UNIFORM) {
+			for (size_t i = 0; i < data_.size(); ++i) {
+				data_[i] = uniform(generator);
+			}
+		}
+		else if (distribution_ == DISTRIBUTION_CLUSTERED) {
+			/* The centers do not depend on the seed, so points and queries which
+			are generated with different seeds share their clusters. */
+			const size_t clusters = 16;
+			std::mt19937 centergenerator(5489u);
+			std::vector<float> centers(clusters * dim_);
+			for (size_t i = 0; i < centers.size(); ++i) {
+				centers[i] = uniform(centergenerator);
+			}
+			for (size_t i = 0; i < rows_; ++i) {
+				const float* center = &centers[(generator() % clusters) * dim_];
+				for (size_t j = 0; j < dim_; ++j) {
+					data_[i * dim_ + j] = center[j] + 0.02f * normal(generator);
+				}
+			}
+		}
+		else {
+			/* Every ring has the same number of points, so the density drops with
+			the distance to the scanner like in a real scan. */
+			const size_t rings = 32;
+			size_t perring = std::max<size_t>((rows_ + rings - 1) / rings, 1);
+			for (size_t i = 0; i < rows_; ++i) {
+				double radius = 0.05 + 0.45 * double(i / perring + 1) / rings;
+				double angle = 6.283185307179586 * double(i % perring) / perring;
+				float point[3] = {
+					float(0.5 + radius * std::cos(angle)),
+					float(0.5 + radius * std::sin(angle)),
+					0.001f * normal(generator)
+				};
+				for (size_t j = 0; j < dim_; ++j) {
+					data_[i * dim_ + j] = j < 3 ? point[j] : 0.001f * normal(generator);
+				}
+			}
+		}
+	}
+
+	/**
+		Parameters of a sweep over the search indices. Every combination of the
+		values which apply to an algorithm is measured, e.g. the leaf size only
+		applies to KDTreeSingleIndex and the trees only to the randomized trees.
+	*/
+	struct SearchSweep {
+		std::vector<flann::flann_algorithm_t> algorithms;
+		std::vector<Distribution> distributions;
+		std::vector<size_t> sizes;
+		std::vector<size_t> dims;
+		std::vector<size_t> knn;
+		std::vector<int> trees;
+		std::vector<int> checks;
+		std::vector<int> leafs;
+		std::vector<int> cores;
+		/** number of queries of the batch which measures the throughput */
+		size_t queries;
+		/** number of queries which are measured one by one for the latency */
+		size_t latencies;
+		/** measures the recall against the exact nearest neighbors */
+		bool recall;
+		/** directory which caches the exact nearest neighbors, empty for none */
+		std::string cache;
+		/** collects hardware performance counters of the build and the batch */
+		bool counters;
+
+		SearchSweep() :
+			algorithms({ flann::FLANN_INDEX_KDTREE, flann::FLANN_INDEX_KDTREE_SINGLE, flann::FLANN_INDEX_LINEAR }),
+			distributions({ DISTRIBUTION_UNIFORM }), sizes({ 100000 }), dims({ 3 }), knn({ 10 }),
+			trees({ 4 }), checks({ 32 }), leafs({ 10 }), cores({ 1 }), queries(10000), latencies(1000),
+			recall(false), counters(false)
+		{
+		}
+
+		/**
+			Sets a parameter from a comma separated list of values, e.g.
+			set("sizes", "10000,100000")
+
+			@param name_ name of the member
+			@param values_ comma separated values
+		*/
+		void set(const std::string& name_, const std::string& values_)
+		{
+			std::vector<std::string> list;
+			std::stringstream stream(values_);
+			for (std::string value; std::getline(stream, value, ',');) {
+				list.push_back(value);
+			}
+
+			if (name_ == "algorithms") {
+				algorithms.clear();
+				for (size_t i = 0; i < list.size(); ++i) {
+					if (list[i] == "linear") algorithms.push_back(flann::FLANN_INDEX_LINEAR);
+					else if (list[i] == "kdtree") algorithms.push_back(flann::FLANN_INDEX_KDTREE);
+					else if (list[i] == "kdtree_single") algorithms.push_back(flann::FLANN_INDEX_KDTREE_SINGLE);
+					else if (list[i] == "kdtree_cuda") algorithms.push_back(flann::FLANN_INDEX_KDTREE_CUDA);
+					else throw std::invalid_argument("Unknown algorithm " + list[i]);
+				}
+			}
+			else if (name_ == "distributions") {
+				distributions.clear();
+				for (size_t i = 0; i < list.size(); ++i) {
+					if (list[i] == "uniform") distributions.push_back(DISTRIBUTION_UNIFORM);
+					else if (list[i] == "clustered") distributions.push_back(DISTRIBUTION_CLUSTERED);
+					else if (list[i] == "planar") distributions.push_back(DISTRIBUTION_PLANAR);
+					else throw std::invalid_argument("Unknown distribution " + list[i]);
+				}
+			}
+			else if (name_ == "sizes") parse(list, sizes);
+			else if (name_ == "dims") parse(list, dims);
+			else if (name_ == "knn") parse(list, knn);
+			else if (name_ == "trees") parse(list, trees);
+			else if (name_ == "checks") parse(list, checks);
+			else if (name_ == "leafs") parse(list, leafs);
+			else if (name_ == "cores") parse(list, cores);
+			else if (name_ == "queries") queries = std::stoul(values_);
+			else if (name_ == "latencies") latencies = std::stoul(values_);
+			else if (name_ == "recall") recall = std::stoi(values_) != 0;
+			else if (name_ == "cache") cache = values_;
+			else if (name_ == "counters") counters = std::stoi(values_) != 0;
+			else throw std::invalid_argument("Unknown parameter " + name_);
+		}
+
+	private:
+
+		template <typename ValueType>
+		static void parse(const std::vector<std::string>& list_, std::vector<ValueType>& values_)
+		{
+			values_.clear();
+			for (size_t i = 0; i < list_.size(); ++i) {
+				values_.push_back(ValueType(std::stoll(list_[i])));
+			}
+		}
+	};
+
+	/**
+		Measurement of one combination of a sweep. Parameters which do not apply
+		to the algorithm are 0.
+	*/
+	struct SearchResult {
+		flann::flann_algorithm_t algorithm;
+		Distribution distribution;
+		size_t size;
+		size_t dim;
+		size_t knn;
+		int trees;
+		int checks;
+		int leaf;
+		int cores;
+		/** seconds to build the index */
+		double build;
+		/** queries per second of a batch */
+		double throughput;
+		/** percentiles of the seconds of a single query */
+		double p50;
+		double p90;
+		double p99;
+		/** bytes used by the index as reported by usedMemory(), at least the
+			bytes the build has retained according to the MemoryTracker if it is
+			enabled, -1 if usedMemory() has overflowed and the tracker is disabled */
+		long long memory;
+		/** recall@knn of the batch, -1 if it has not been measured */
+		double recall;
+		/** no other configuration of the algorithm is both faster and more accurate */
+		bool pareto;
+		/** performance counters of the build per indexed point, invalid if not collected */
+		utils::PerfCounters::Sample buildcounters;
+		/** performance counters of the batch per query, invalid if not collected */
+		utils::PerfCounters::Sample searchcounters;
+		/** allocations per single query, -1 if the MemoryTracker is disabled */
+		double allocations;
+	};
+
+	/**
+		Measures the search of a built index
+
+		@param index_ index
+		@param queries_ queries
+		@param latencies_ number of queries which are measured one by one
+		@param params_ search parameters
+		@param result_ result which receives the throughput, the latencies and the recall
+		@param groundtruth_ exact nearest neighbors of the queries, NULL to skip the recall
+		@param counters_ performance counters which measure the batch, NULL for none
+	*/
+	inline void measure(flann::Index<flann::L2<float> >& index_, const flann::Matrix<float>& queries_, size_t latencies_,
+		const flann::SearchParams& params_, SearchResult& result_, const flann::Matrix<size_t>* groundtruth_ = NULL,
+		const utils::PerfCounters* counters_ = NULL)
+	{
+		size_t knn = result_.knn;
+		std::vector<size_t> indices(queries_.rows * knn);
+		std::vector<float> dists(queries_.rows * knn);
+		flann::Matrix<size_t> indicesflann(&indices[0], queries_.rows, knn);
+		flann::Matrix<float> distsflann(&dists[0], queries_.rows, knn);
+
+		utils::PerfCounters::Sample before = counters_ ? counters_->read() : utils::PerfCounters::Sample();
+		utils::Timer timer;
+		index_.knnSearch(queries_, indicesflann, distsflann, knn, params_);
+		result_.throughput = queries_.rows / timer.stop();
+		if (counters_) {
+			result_.searchcounters = (counters_->read() - before) / double(queries_.rows);
+		}
+		result_.recall = groundtruth_ ? recall(indicesflann, *groundtruth_, knn) : -1;
+
+		/* A single query runs on the calling thread. */
+		flann::SearchParams single = params_;
+		single.cores = 1;
+		std::vector<double> seconds(std::min(latencies_, queries_.rows));
+		utils::MemoryTracker::Scope scope;
+		for (size_t i = 0; i < seconds.size(); ++i) {
+			flann::Matrix<float> query(queries_[i], 1, queries_.cols);
+			flann::Matrix<size_t> indicesquery(&indices[0], 1, knn);
+			flann::Matrix<float> distsquery(&dists[0], 1, knn);
+			timer.start();
+			index_.knnSearch(query, indicesquery, distsquery, knn, single);
+			seconds[i] = timer.stop();
+		}
+		result_.allocations = utils::MemoryTracker::enabled() && !seconds.empty() ? double(scope.allocations()) / seconds.size() : -1;
+
+		std::sort(seconds.begin(), seconds.end());
+		double* percentiles[3] = { &result_.p50, &result_.p90, &result_.p99 };
+		double fractions[3] = { 0.5, 0.9, 0.99 };
+		for (int i = 0; i < 3; ++i) {
+			*percentiles[i] = seconds.empty() ? 0 : seconds[std::min(seconds.size() - 1, size_t(fractions[i] * seconds.size()))];
+		}
+	}
+
+	/**
+		Writes a measurement as one line of text
+
+		@param result_ measurement
+		@param stream_ stream which receives the line
+	*/
+	inline void print(const SearchResult& result_, std::ostream& stream_)
+	{
+		stream_ << algorithmName(result_.algorithm) << " " << distributionName(result_.distribution)
+			<< " size " << result_.size << " dim " << result_.dim << " knn " << result_.knn
+			<< " trees " << result_.trees << " checks " << result_.checks << " leaf " << result_.leaf
+			<< " cores " << result_.cores << ": build " << result_.build << " s, "
+			<< result_.throughput << " queries/s, p50 " << result_.p50 * 1e6 << " us, p99 "
+			<< result_.p99 * 1e6 << " us, memory ";
+		if (result_.memory >= 0) {
+			stream_ << result_.memory << " B";
+		}
+		else {
+			stream_ << "unknown";
+		}
+		if (result_.recall >= 0) {
+			stream_ << ", recall " << result_.recall;
+		}
+		if (result_.allocations >= 0) {
+			stream_ << ", " << result_.allocations << " allocations/query";
+		}
+		const utils::PerfCounters::Sample& counters = result_.searchcounters;
+		if (counters.valid[utils::PerfCounters::CYCLES] && counters.valid[utils::PerfCounters::INSTRUCTIONS] &&
+			counters.values[utils::PerfCounters::CYCLES] > 0) {
+			stream_ << ", IPC " << counters.values[utils::PerfCounters::INSTRUCTIONS] / counters.values[utils::PerfCounters::CYCLES];
+		}
+		for (int i = utils::PerfCounters::LLC_MISSES; i < utils::PerfCounters::COUNTERS; ++i) {
+			if (counters.valid[i]) {
+				stream_ << ", " << utils::PerfCounters::name(utils::PerfCounters::Counter(i)) << "/query " << counters.values[i];
+			}
+		}
+		stream_ << std::endl;
+	}
+
+	/**
+		Marks the configurations on the Pareto front of recall and throughput.
+		The configurations of an algorithm are compared if they search the same
+		points for the same number of neighbors with the same number of cores.
+
+		@param results_ measurements with recall
+	*/
+	inline void pareto(std::vector<SearchResult>& results_)
+	{
+		for (size_t i = 0; i < results_.size(); ++i) {
+			SearchResult& result = results_[i];
+			result.pareto = result.recall >= 0;
+			for (size_t j = 0; j < results_.size() && result.pareto; ++j) {
+				const SearchResult& other = results_[j];
+				bool comparable = other.algorithm == result.algorithm && other.distribution == result.distribution &&
+					other.size == result.size && other.dim == result.dim && other.knn == result.knn &&
+					other.cores == result.cores && other.recall >= 0;
+				bool dominates = other.recall >= result.recall && other.throughput >= result.throughput &&
+					(other.recall > result.recall || other.throughput > result.throughput);
+				result.pareto = !(comparable && dominates);
+			}
+		}
+	}
+
+	/**
+		Writes the Pareto front of every algorithm, ordered by recall, so an
+		operating point can be picked from it
+
+		@param results_ measurements marked by pareto()
+		@param stream_ stream which receives the fronts
+	*/
+	inline void printPareto(const std::vector<SearchResult>& results_, std::ostream& stream_ = std::cout)
+	{
+		std::vector<SearchResult> front;
+		for (size_t i = 0; i < results_.size(); ++i) {
+			if (results_[i].pareto) {
+				front.push_back(results_[i]);
+			}
+		}
+		std::stable_sort(front.begin(), front.end(), [](const SearchResult& a, const SearchResult& b) {
+			if (a.algorithm != b.algorithm) return a.algorithm < b.algorithm;
+			return a.recall < b.recall;
+		});
+
+		stream_ << "Pareto front of recall and throughput" << std::endl;
+		for (size_t i = 0; i < front.size(); ++i) {
+			print(front[i], stream_);
+		}
+	}
+
+	/**
+		Runs a sweep over the search indices. The points and the queries of a
+		combination of distribution, size and dimension are generated once, an
+		index is built once for every combination of its build parameters.
+
+		@param sweep_ parameters of the sweep
+		@param progress_ stream which receives a line for every measurement, NULL for none
+		@return measurements
+	*/
+	inline std::vector<SearchResult> search(const SearchSweep& sweep_, std::ostream* progress_ = &std::cout)
+	{
+		std::vector<SearchResult> results;
+
+		/* The counters are opened before any index, so they count the worker
+		threads of the indices as well. */
+		std::unique_ptr<utils::PerfCounters> counters;
+		if (sweep_.counters) {
+			counters.reset(new utils::PerfCounters());
+			if (!counters->available()) {
+				counters.reset();
+				if (progress_) {
+					*progress_ << "performance counters are not available" << std::endl;
+				}
+			}
+		}
+
+		for (size_t d = 0; d < sweep_.distributions.size(); ++d) {
+			for (size_t s = 0; s < sweep_.sizes.size(); ++s) {
+				for (size_t m = 0; m < sweep_.dims.size(); ++m) {
+					size_t size = sweep_.sizes[s];
+					size_t dim = sweep_.dims[m];
+
+					std::vector<float> points, queries;
+					generate(points, size, dim, sweep_.distributions[d], 5489u);
+					generate(queries, sweep_.queries, dim, sweep_.distributions[d], 1234u);
+					flann::Matrix<float> pointsflann(&points[0], size, dim);
+					flann::Matrix<float> queriesflann(&queries[0], sweep_.queries, dim);
+
+					/* The exact neighbors for the largest k serve every k. */
+					std::vector<size_t> groundtruth;
+					size_t maxknn = sweep_.knn.empty() ? 0 : std::min(*std::max_element(sweep_.knn.begin(), sweep_.knn.end()), size);
+					if (sweep_.recall) {
+						std::string file;
+						if (!sweep_.cache.empty()) {
+							std::stringstream name;
+							name << sweep_.cache << "/groundtruth_" << distributionName(sweep_.distributions[d]) << "_"
+								<< size << "_" << dim << "_" << sweep_.queries << "_" << maxknn << ".bin";
+							file = name.str();
+						}
+						utils::Timer timer;
+						groundTruth(pointsflann, queriesflann, groundtruth, maxknn, file);
+						if (progress_) {
+							*progress_ << "ground truth of " << distributionName(sweep_.distributions[d]) << " size " << size
+								<< " dim " << dim << " in " << timer.stop() << " s" << std::endl;
+						}
+					}
+					flann::Matrix<size_t> groundtruthflann(groundtruth.data(), sweep_.queries, maxknn);
+
+					for (size_t a = 0; a < sweep_.algorithms.size(); ++a) {
+						flann::flann_algorithm_t algorithm = sweep_.algorithms[a];
+						bool randomized = algorithm == flann::FLANN_INDEX_KDTREE || algorithm == flann::FLANN_INDEX_KDTREE_CUDA;
+						bool single = algorithm == flann::FLANN_INDEX_KDTREE_SINGLE;
+
+						const std::vector<int> none(1, 0);
+						const std::vector<int>& trees = randomized ? sweep_.trees : none;
+						const std::vector<int>& checks = randomized ? sweep_.checks : none;
+						const std::vector<int>& leafs = single ? sweep_.leafs : none;
+
+						for (size_t t = 0; t < trees.size(); ++t) {
+							for (size_t l = 0; l < leafs.size(); ++l) {
+								for (size_t c = 0; c < sweep_.cores.size(); ++c) {
+									flann::IndexParams params;
+									if (algorithm == flann::FLANN_INDEX_KDTREE) params = flann::KDTreeIndexParams(trees[t], sweep_.cores[c]);
+									else if (algorithm == flann::FLANN_INDEX_KDTREE_CUDA) params = flann::KDTreeCudaIndexParams(trees[t], sweep_.cores[c]);
+									else if (single) params = flann::KDTreeSingleIndexParams(leafs[l]);
+									else params = flann::LinearIndexParams();
+
+									utils::PerfCounters::Sample before = counters ? counters->read() : utils::PerfCounters::Sample();
+									long long allocated = utils::MemoryTracker::total().current;
+									utils::Timer timer;
+									flann::Index<flann::L2<float> > index(pointsflann, params);
+									index.buildIndex();
+									double build = timer.stop();
+
+									/* usedMemory() is an int, which overflows above 2 GB. The
+									tracker misses the pools of flann, which use malloc, but it
+									does not overflow. */
+									long long memory = std::max(index.usedMemory(), -1);
+									if (utils::MemoryTracker::enabled()) {
+										memory = std::max(memory, utils::MemoryTracker::total().current - allocated);
+									}
+									utils::PerfCounters::Sample buildcounters;
+									if (counters) {
+										buildcounters = (counters->read() - before) / double(size);
+									}
+
+									for (size_t h = 0; h < checks.size(); ++h) {
+										for (size_t k = 0; k < sweep_.knn.size(); ++k) {
+											SearchResult result;
+											result.algorithm = algorithm;
+											result.distribution = sweep_.distributions[d];
+											result.size = size;
+											result.dim = dim;
+											result.knn = std::min(sweep_.knn[k], size);
+											result.trees = trees[t];
+											result.checks = checks[h];
+											result.leaf = leafs[l];
+											result.cores = sweep_.cores[c];
+											result.build = build;
+											result.memory = memory;
+											result.buildcounters = buildcounters;
+
+											flann::SearchParams searchparams(randomized ? checks[h] : flann::FLANN_CHECKS_UNLIMITED);
+											searchparams.cores = sweep_.cores[c];
+											measure(index, queriesflann, sweep_.latencies, searchparams, result,
+												sweep_.recall ? &groundtruthflann : NULL, counters.get());
+
+											results.push_back(result);
+											if (progress_) {
+												print(result, *progress_);
+											}
+										}
+									}
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+		pareto(results);
+		return results;
+	}
+
+	/**
+		Writes performance counters as a JSON object, invalid counters are null
+
+		@param counters_ counters
+		@param stream_ stream which receives the object
+	*/
+	inline void writeJson(const utils::PerfCounters::Sample& counters_, std::ostream& stream_)
+	{
+		stream_ << "{";
+		for (int i = 0; i < utils::PerfCounters::COUNTERS; ++i) {
+			stream_ << (i ? "," : "") << "\"" << utils::PerfCounters::name(utils::PerfCounters::Counter(i)) << "\":";
+			if (counters_.valid[i]) {
+				stream_ << counters_.values[i];
+			}
+			else {
+				stream_ << "null";
+			}
+		}
+		stream_ << "}";
+	}
+
+	/**
+		Writes measurements as JSON
+
+		@param results_ measurements
+		@param stream_ stream which receives the report
+	*/
+	inline void writeJson(const std::vector<SearchResult>& results_, std::ostream& stream_)
+	{
+		stream_ << "{\"results\":[";
+		for (size_t i = 0; i < results_.size(); ++i) {
+			const SearchResult& result = results_[i];
+			stream_ << (i ? "," : "") << std::endl
+				<< "{\"algorithm\":\"" << algorithmName(result.algorithm) << "\""
+				<< ",\"distribution\":\"" << distributionName(result.distribution) << "\""
+				<< ",\"size\":" << result.size
+				<< ",\"dim\":" << result.dim
+				<< ",\"knn\":" << result.knn
+				<< ",\"trees\":" << result.trees
+				<< ",\"checks\":" << result.checks
+				<< ",\"leaf\":" << result.leaf
+				<< ",\"cores\":" << result.cores
+				<< ",\"build\":" << result.build
+				<< ",\"throughput\":" << result.throughput
+				<< ",\"p50\":" << result.p50
+				<< ",\"p90\":" << result.p90
+				<< ",\"p99\":" << result.p99
+				<< ",\"memory\":" << result.memory
+				<< ",\"recall\":" << result.recall
+				<< ",\"pareto\":" << (result.pareto ? "true" : "false")
+				<< ",\"allocations\":" << result.allocations
+				<< ",\"build_counters\":";
+			writeJson(result.buildcounters, stream_);
+			stream_ << ",\"search_counters\":";
+			writeJson(result.searchcounters, stream_);
+			stream_ << "}";
+		}
+		stream_ << std::endl << "]}" << std::endl;
+	}
+
+	/**
+		Writes measurements as CSV with a header line
+
+		@param results_ measurements
+		@param stream_ stream which receives the table
+	*/
+	inline void writeCsv(const std::vector<SearchResult>& results_, std::ostream& stream_)
+	{
+		stream_ << "algorithm,distribution,size,dim,knn,trees,checks,leaf,cores,build,throughput,p50,p90,p99,memory,recall,pareto,allocations";
+		for (int i = 0; i < utils::PerfCounters::COUNTERS; ++i) {
+			stream_ << ",build_" << utils::PerfCounters::name(utils::PerfCounters::Counter(i));
+		}
+		for (int i = 0; i < utils::PerfCounters::COUNTERS; ++i) {
+			stream_ << ",search_" << utils::PerfCounters::name(utils::PerfCounters::Counter(i));
+		}
+		stream_ << std::endl;
+		for (size_t i = 0; i < results_.size(); ++i) {
+			const SearchResult& result = results_[i];
+			stream_ << algorithmName(result.algorithm) << "," << distributionName(result.distribution) << ","
+				<< result.size << "," << result.dim << "," << result.knn << ","
+				<< result.trees << "," << result.checks << "," << result.leaf << "," << result.cores << ","
+				<< result.build << "," << result.throughput << ","
+				<< result.p50 << "," << result.p90 << "," << result.p99 << "," << result.memory << ","
+				<< result.recall << "," << int(result.pareto) << "," << result.allocations;
+			/* Invalid counters are -1 like a recall which has not been measured. */
+			for (int i = 0; i < utils::PerfCounters::COUNTERS; ++i) {
+				stream_ << "," << (result.buildcounters.valid[i] ? result.buildcounters.values[i] : -1);
+			}
+			for (int i = 0; i < utils::PerfCounters::COUNTERS; ++i) {
+				stream_ << "," << (result.searchcounters.valid[i] ? result.searchcounters.values[i] : -1);
+			}
+			stream_ << std::endl;
+		}
+	}
+}
+
+#endif /* BENCHMARK_SEARCH_H_ */
@@ -32,5 +32,11 @@
 
 #include "io/ioply.h"
 #include "io/ioply.hpp"
+#include "io/cachefile.h"
+#include "io/mappedfile.h"
+#include "io/outputfile.h"
+#include "io/plyheader.h"
+#include "io/plyreader.h"
+#include "io/plywriter.h"
 
 #endif /* INCLUDE_IO_H_ */
@@ -0,0 +1,619 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+
+#ifndef IO_CACHEFILE_H_
+#define IO_CACHEFILE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+#include "flann/ext/lz4.h"
+#include "flann/ext/lz4hc.h"
+#include "flann/util/thread_pool.h"
+
+#include "io/mappedfile.h"
+#include "io/outputfile.h"
+#include "utils/pointcloud.h"
+
+namespace io
+{
+	/**
+		Filters which are applied to the columns of a cache before compression
+	*/
+	enum CacheFilter {
+		CACHE_FILTER_NONE = 0,
+		/**
+			Groups the Bytes of the values by their significance
+		*/
+		CACHE_FILTER_SHUFFLE = 1,
+		/**
+			Stores the differences of consecutive values, lossless also for
+			floating point values because the bit patterns are subtracted
+		*/
+		CACHE_FILTER_DELTA = 2,
+		/**
+			Rounds the coordinates to multiples of a precision and stores them
+			as 32 bit integers, this is lossy
+		*/
+		CACHE_FILTER_QUANTIZE = 4
+	};
+
+	/**
+		Header of a cache file
+	*/
+	struct CacheHeader {
+		char signature[8];
+		uint32_t version;
+		uint32_t elementSize;
+		uint64_t rows;
+		uint32_t blockRows;
+		uint32_t columns;
+	};
+
+	/**
+		Column of a cache file, the columns 0-2 are the coordinates, 3-5 the colors
+	*/
+	struct CacheColumn {
+		uint32_t filters;
+		uint32_t valueSize;
+		double origin;
+		double precision;
+	};
+
+	/**
+		Compressed block of a column
+	*/
+	struct CacheBlock {
+		uint64_t offset;
+		uint32_t size;
+		uint32_t rawSize;
+	};
+
+	/**
+		Applies the filters to a block of a column
+
+		@param data_ values of the block, replaced by the filtered block
+		@param valueSize_ size of a value in Bytes
+		@param filters_ filters
+		@param buffer_ temporary memory
+	*/
+	inline void cacheFilter(std::vector<char>& data_, size_t valueSize_, uint32_t filters_, std::vector<char>& buffer_)
+	{
+		size_t count = data_.size() / valueSize_;
+		if (filters_ & CACHE_FILTER_DELTA) {
+			char* p = data_.data();
+			if (valueSize_ == 1) {
+				for (size_t i = count; i-- > 1;) p[i] = (char)(p[i] - p[i - 1]);
+			}
+			else if (valueSize_ == 4) {
+				uint32_t previous = 0;
+				for (size_t i = 0; i < count; ++i) {
+					uint32_t value;
+					std::memcpy(&value, p + 4 * i, 4);
+					uint32_t delta = value - previous;
+					std::memcpy(p + 4 * i, &delta, 4);
+					previous = value;
+				}
+			}
+			else {
+				uint64_t previous = 0;
+				for (size_t i = 0; i < count; ++i) {
+					uint64_t value;
+					std::memcpy(&value, p + 8 * i, 8);
+					uint64_t delta = value - previous;
+					std::memcpy(p + 8 * i, &delta, 8);
+					previous = value;
+				}
+			}
+		}
+		if ((filters_ & CACHE_FILTER_SHUFFLE) && valueSize_ > 1) {
+			buffer_.resize(data_.size());
+			for (size_t i = 0; i < count; ++i) {
+				for (size_t k = 0; k < valueSize_; ++k) {
+					buffer_[k * count + i] = data_[i * valueSize_ + k];
+				}
+			}
+			data_.swap(buffer_);
+		}
+	}
+
+	/**
+		Reverts the filters of a block of a column
+
+		@param data_ filtered block, replaced by the values
+		@param valueSize_ size of a value in Bytes
+		@param filters_ filters
+		@param buffer_ temporary memory
+	*/
+	inline void cacheUnfilter(std::vector<char>& data_, size_t valueSize_, uint32_t filters_, std::vector<char>& buffer_)
+	{
+		size_t count = data_.size() / valueSize_;
+		if ((filters_ & CACHE_FILTER_SHUFFLE) && valueSize_ > 1) {
+			buffer_.resize(data_.size());
+			for (size_t k = 0; k < valueSize_; ++k) {
+				for (size_t i = 0; i < count; ++i) {
+					buffer_[i * valueSize_ + k] = data_[k * count + i];
+				}
+			}
+			data_.swap(buffer_);
+		}
+		if (filters_ & CACHE_FILTER_DELTA) {
+			char* p = data_.data();
+			if (valueSize_ == 1) {
+				for (size_t i = 1; i < count; ++i) p[i] = (char)(p[i] + p[i - 1]);
+			}
+			else if (valueSize_ == 4) {
+				uint32_t value = 0;
+				for (size_t i = 0; i < count; ++i) {
+					uint32_t delta;
+					std::memcpy(&delta, p + 4 * i, 4);
+					value += delta;
+					std::memcpy(p + 4 * i, &value, 4);
+				}
+			}
+			else {
+				uint64_t value = 0;
+				for (size_t i = 0; i < count; ++i) {
+					uint64_t delta;
+					std::memcpy(&delta, p + 8 * i, 8);
+					value += delta;
+					std::memcpy(p + 8 * i, &value, 8);
+				}
+			}
+		}
+	}
+
+	/**
+		Writer for cache files of pointclouds. Every coordinate axis and every
+		color channel is a column, which is split into blocks of a fixed number
+		of rows. The blocks are filtered and compressed with LZ4 in parallel.
+	*/
+	class CacheWriter
+	{
+	public:
+
+		enum
+		{
+			/**
+				Number of rows of a block
+			*/
+			BLOCK_ROWS = 65536
+		};
+
+		/**
+			Constructor
+
+			@param filters_ filters of the columns, see CacheFilter
+			@param precision_ precision of the quantization of the coordinates
+			@param level_ 0 for fast LZ4, otherwise the level of LZ4HC
+			@param threads_ number of threads, 0 for the number of hardware threads
+		*/
+		CacheWriter(int filters_ = CACHE_FILTER_SHUFFLE | CACHE_FILTER_DELTA, double precision_ = 0, int level_ = 0, int threads_ = 0) :
+			filters(filters_), precision(precision_), level(level_), threads(threads_)
+		{
+		}
+
+		/**
+			Writes a pointcloud into a cache file
+
+			@param stringfile_ path of the file
+			@param pointcloud_ pointcloud
+			@return true when the file has been written
+		*/
+		template <typename ElementType>
+		bool write(const char* stringfile_, const utils::Pointcloud<ElementType>& pointcloud_) const
+		{
+			size_t rows = pointcloud_.rows;
+			size_t columns = pointcloud_.colors.rows > 0 ? 6 : 3;
+			size_t blocks = (rows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+
+			/**
+				Quantization needs the origin of every axis and falls back to the
+				values when the range does not fit into 32 bit
+			*/
+			std::vector<CacheColumn> descriptors(columns);
+			for (size_t j = 0; j < columns; ++j) {
+				CacheColumn& column = descriptors[j];
+				column.filters = (uint32_t)(filters & ~CACHE_FILTER_QUANTIZE);
+				column.valueSize = j < 3 ? sizeof(ElementType) : 1;
+				column.origin = 0;
+				column.precision = 0;
+
+				if (j < 3 && (filters & CACHE_FILTER_QUANTIZE) && precision > 0 && rows > 0) {
+					double low = pointcloud_.coordinate(0, j);
+					double high = low;
+					for (size_t i = 1; i < rows; ++i) {
+						low = std::min(low, (double)pointcloud_.coordinate(i, j));
+						high = std::max(high, (double)pointcloud_.coordinate(i, j));
+					}
+					if ((high - low) / precision < 2147483647.0) {
+						column.filters |= CACHE_FILTER_QUANTIZE;
+						column.valueSize = 4;
+						column.origin = low;
+						column.precision = precision;
+					}
+				}
+			}
+
+			std::vector<std::vector<char> > compressed(columns * blocks);
+			std::vector<CacheBlock> table(columns * blocks);
+
+			std::atomic<size_t> next(0);
+			flann::ThreadPool workers(threads);
+			workers.run(workers.size(), [&](int, int) {
+				std::vector<char> data, buffer;
+				for (size_t task = next++; task < columns * blocks; task = next++) {
+					size_t j = task / blocks;
+					size_t begin = (task % blocks) * BLOCK_ROWS;
+					size_t count = std::min((size_t)BLOCK_ROWS, rows - begin);
+					const CacheColumn& column = descriptors[j];
+
+					data.resize(count * column.valueSize);
+					if (j >= 3) {
+						for (size_t i = 0; i < count; ++i) {
+							data[i] = (char)pointcloud_.colors[begin + i][j - 3];
+						}
+					}
+					else if (column.filters & CACHE_FILTER_QUANTIZE) {
+						for (size_t i = 0; i < count; ++i) {
+							int32_t value = (int32_t)std::floor((pointcloud_.coordinate(begin + i, j) - column.origin) / column.precision + 0.5);
+							std::memcpy(&data[4 * i], &value, 4);
+						}
+					}
+					else {
+						for (size_t i = 0; i < count; ++i) {
+							std::memcpy(&data[i * sizeof(ElementType)], &pointcloud_.coordinate(begin + i, j), sizeof(ElementType));
+						}
+					}
+					cacheFilter(data, column.valueSize, column.filters, buffer);
+
+					/**
+						Blocks which do not shrink are stored uncompressed
+					*/
+					std::vector<char>& target = compressed[task];
+					target.resize(LZ4_compressBound((int)data.size()));
+					int size = level > 0 ?
+						LZ4_compress_HC(data.data(), target.data(), (int)data.size(), (int)target.size(), level) :
+						LZ4_compress_default(data.data(), target.data(), (int)data.size(), (int)target.size());
+					if (size <= 0 || (size_t)size >= data.size()) {
+						target.assign(data.begin(), data.end());
+					}
+					else {
+						target.resize(size);
+					}
+					table[task].size = (uint32_t)target.size();
+					table[task].rawSize = (uint32_t)data.size();
+				}
+			});
+
+			CacheHeader header;
+			std::memcpy(header.signature, "PCCACHE", 8);
+			header.version = 1;
+			header.elementSize = sizeof(ElementType);
+			header.rows = rows;
+			header.blockRows = BLOCK_ROWS;
+			header.columns = (uint32_t)columns;
+
+			size_t offset = sizeof(CacheHeader) + columns * sizeof(CacheColumn) + table.size() * sizeof(CacheBlock);
+			for (size_t task = 0; task < table.size(); ++task) {
+				table[task].offset = offset;
+				offset += table[task].size;
+			}
+
+			OutputFile file;
+			if (!file.open(stringfile_) || !file.resize(offset)) {
+				return 0;
+			}
+			bool valid = file.write(0, (const char*)&header, sizeof(CacheHeader)) &&
+				file.write(sizeof(CacheHeader), (const char*)descriptors.data(), columns * sizeof(CacheColumn)) &&
+				(table.empty() || file.write(sizeof(CacheHeader) + columns * sizeof(CacheColumn), (const char*)table.data(), table.size() * sizeof(CacheBlock)));
+			for (size_t task = 0; task < table.size() && valid; ++task) {
+				valid = file.write(table[task].offset, compressed[task].data(), compressed[task].size());
+			}
+			return valid;
+		}
+
+	private:
+
+		int filters;
+		double precision;
+		int level;
+		int threads;
+	};
+
+	/**
+		Cache file of a pointcloud which is mapped into memory. The blocks are
+		decompressed in parallel directly into the pointcloud, single blocks can
+		be read without touching the rest of the file.
+	*/
+	class CacheFile
+	{
+	public:
+
+		/**
+			Constructor
+		*/
+		CacheFile()
+		{
+			std::memset(&header, 0, sizeof(CacheHeader));
+		}
+
+		/**
+			Maps a cache file into memory and checks its tables
+
+			@param stringfile_ path of the file
+			@return true when the file is a valid cache file
+		*/
+		bool open(const char* stringfile_)
+		{
+			if (!file.open(stringfile_)) {
+				return 0;
+			}
+
+			const char* data = file.getPtr();
+			size_t size = file.getSize();
+			if (size < sizeof(CacheHeader)) {
+				return close();
+			}
+			std::memcpy(&header, data, sizeof(CacheHeader));
+			if (std::memcmp(header.signature, "PCCACHE", 8) != 0 || header.version != 1 ||
+				(header.elementSize != 4 && header.elementSize != 8) || header.blockRows == 0 ||
+				(header.columns != 3 && header.columns != 6)) {
+				return close();
+			}
+
+			size_t blocks = getBlocks();
+			if (blocks > size) {
+				return close();
+			}
+			size_t tables = sizeof(CacheHeader) + header.columns * sizeof(CacheColumn) + header.columns * blocks * sizeof(CacheBlock);
+			if (tables > size) {
+				return close();
+			}
+			columns.resize(header.columns);
+			std::memcpy(columns.data(), data + sizeof(CacheHeader), header.columns * sizeof(CacheColumn));
+			table.resize(header.columns * blocks);
+			if (!table.empty()) {
+				std::memcpy(table.data(), data + sizeof(CacheHeader) + header.columns * sizeof(CacheColumn), table.size() * sizeof(CacheBlock));
+			}
+
+			for (size_t j = 0; j < columns.size(); ++j) {
+				size_t valueSize = columns[j].filters & CACHE_FILTER_QUANTIZE ? 4 : j < 3 ? header.elementSize : 1;
+				if (columns[j].valueSize != valueSize) {
+					return close();
+				}
+				for (size_t b = 0; b < blocks; ++b) {
+					const CacheBlock& block = table[j * blocks + b];
+					if (block.offset + block.size > size || block.rawSize != blockCount(b) * valueSize) {
+						return close();
+					}
+				}
+			}
+			return 1;
+		}
+
+		/**
+			Removes the mapping
+
+			@return false
+		*/
+		bool close()
+		{
+			file.close();
+			columns.clear();
+			table.clear();
+			return 0;
+		}
+
+		/**
+			Returns the number of points
+
+			@return number of points
+		*/
+		size_t getRows() const
+		{
+			return (size_t)header.rows;
+		}
+
+		/**
+			Returns the number of blocks of every column
+
+			@return number of blocks
+		*/
+		size_t getBlocks() const
+		{
+			return (size_t)((header.rows + header.blockRows - 1) / header.blockRows);
+		}
+
+		/**
+			Returns the number of rows of a block
+
+			@param block_ index of the block
+			@return number of rows
+		*/
+		size_t blockCount(size_t block_) const
+		{
+			return (size_t)std::min((uint64_t)header.blockRows, header.rows - (uint64_t)block_ * header.blockRows);
+		}
+
+		/**
+			Returns whether the points have colors
+
+			@return true when the file has colors
+		*/
+		bool hasColors() const
+		{
+			return columns.size() == 6;
+		}
+
+		/**
+			Reads all points and colors into a pointcloud, in the layout of the
+			pointcloud
+
+			@param pointcloud_ receives the points and colors
+			@param threads_ number of threads, 0 for the number of hardware threads
+			@return false when a block is corrupt
+		*/
+		template <typename ElementType>
+		bool read(utils::Pointcloud<ElementType>& pointcloud_, int threads_ = 0) const
+		{
+			return readBlocks(0, getBlocks(), pointcloud_, threads_);
+		}
+
+		/**
+			Reads a range of blocks into a pointcloud, in the layout of the
+			pointcloud. The first row of the pointcloud is the first row of the
+			block first_.
+
+			@param first_ index of the first block
+			@param last_ index behind the last block
+			@param pointcloud_ receives the points and colors
+			@param threads_ number of threads, 0 for the number of hardware threads
+			@return false when the range is invalid or a block is corrupt
+		*/
+		template <typename ElementType>
+		bool readBlocks(size_t first_, size_t last_, utils::Pointcloud<ElementType>& pointcloud_, int threads_ = 0) const
+		{
+			if (!file.getPtr() || first_ > last_ || last_ > getBlocks()) {
+				return 0;
+			}
+
+			size_t rows = 0;
+			for (size_t b = first_; b < last_; ++b) {
+				rows += blockCount(b);
+			}
+			pointcloud_.setPoints(rows, 3);
+			if (hasColors()) {
+				pointcloud_.setColors(rows, 3);
+			}
+
+			size_t blocks = last_ - first_;
+			std::atomic<size_t> next(0);
+			std::atomic<bool> valid(1);
+			flann::ThreadPool workers(threads_);
+			workers.run(workers.size(), [&](int, int) {
+				std::vector<char> data, buffer;
+				for (size_t task = next++; task < columns.size() * blocks; task = next++) {
+					size_t j = task / blocks;
+					size_t b = first_ + task % blocks;
+					if (!decode(j, b, (b - first_) * header.blockRows, pointcloud_, data, buffer)) {
+						valid = 0;
+					}
+				}
+			});
+			return valid;
+		}
+
+		/**
+			Reads a single block into a pointcloud
+
+			@param block_ index of the block
+			@param pointcloud_ receives the points and colors
+			@return false when the block does not exist or is corrupt
+		*/
+		template <typename ElementType>
+		bool readBlock(size_t block_, utils::Pointcloud<ElementType>& pointcloud_) const
+		{
+			return readBlocks(block_, block_ + 1, pointcloud_, 1);
+		}
+
+	private:
+
+		/**
+			Decompresses a block of a column and writes it into a pointcloud
+
+			@param column_ index of the column
+			@param block_ index of the block
+			@param row_ row of the pointcloud which receives the first value
+			@param pointcloud_ receives the values
+			@param data_ temporary memory
+			@param buffer_ temporary memory
+			@return false when the block is corrupt
+		*/
+		template <typename ElementType>
+		bool decode(size_t column_, size_t block_, size_t row_, utils::Pointcloud<ElementType>& pointcloud_,
+			std::vector<char>& data_, std::vector<char>& buffer_) const
+		{
+			const CacheColumn& column = columns[column_];
+			const CacheBlock& block = table[column_ * getBlocks() + block_];
+			const char* source = file.getPtr() + block.offset;
+
+			data_.resize(block.rawSize);
+			if (block.size == block.rawSize) {
+				std::memcpy(data_.data(), source, block.size);
+			}
+			else if (LZ4_decompress_safe(source, data_.data(), (int)block.size, (int)block.rawSize) != (int)block.rawSize) {
+				return 0;
+			}
+			cacheUnfilter(data_, column.valueSize, column.filters, buffer_);
+
+			size_t count = blockCount(block_);
+			const char* p = data_.data();
+			if (column_ >= 3) {
+				for (size_t i = 0; i < count; ++i) {
+					pointcloud_.colors[row_ + i][column_ - 3] = (utils::uchar)p[i];
+				}
+			}
+			else if (column.filters & CACHE_FILTER_QUANTIZE) {
+				for (size_t i = 0; i < count; ++i) {
+					int32_t value;
+					std::memcpy(&value, p + 4 * i, 4);
+					pointcloud_.coordinate(row_ + i, column_) = (ElementType)(column.origin + value * column.precision);
+				}
+			}
+			else if (header.elementSize == 4) {
+				for (size_t i = 0; i < count; ++i) {
+					float value;
+					std::memcpy(&value, p + 4 * i, 4);
+					pointcloud_.coordinate(row_ + i, column_) = (ElementType)value;
+				}
+			}
+			else {
+				for (size_t i = 0; i < count; ++i) {
+					double value;
+					std::memcpy(&value, p + 8 * i, 8);
+					pointcloud_.coordinate(row_ + i, column_) = (ElementType)value;
+				}
+			}
+			return 1;
+		}
+
+		MappedFile file;
+		CacheHeader header;
+		std::vector<CacheColumn> columns;
+		std::vector<CacheBlock> table;
+	};
+}
+
+#endif /* IO_CACHEFILE_H_ */
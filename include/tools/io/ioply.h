@@ -33,6 +33,8 @@
 
 #include <rply.h>
 
+#include "io/plyreader.h"
+#include "io/plywriter.h"
 #include "utils/pointcloud.h"
 #include "utils/matrix.h"
 
@@ -40,11 +42,13 @@ namespace io
 {
 	template <typename ElementType> int readply(char *stringfile_, utils::Matrix<ElementType>& dataset_);
 
-	template <typename ElementType> int writeply(char *stringfile_, utils::Matrix<ElementType>& dataset_);
+	template <typename ElementType> int writeply(char *stringfile_, utils::Matrix<ElementType>& dataset_, PlyFormat format_ = PLY_FORMAT_BINARY_LE);
 
 	template<typename ElementType> int readply(char* stringfile_, utils::Pointcloud<ElementType>& pointcloud_);
 
-	template <typename ElementType> int writeply(char *stringfile_, utils::Pointcloud<ElementType>& pointcloud_);
+	template <typename ElementType, typename Callback> int streamply(char *stringfile_, size_t chunk_, Callback callback_);
+
+	template <typename ElementType> int writeply(char *stringfile_, utils::Pointcloud<ElementType>& pointcloud_, PlyFormat format_ = PLY_FORMAT_BINARY_LE);
 }
 
 #endif /* IOPLY_H_ */
\ No newline at end of file
@@ -50,7 +50,7 @@ template <typename ElementType> int io::readply(char *stringfile_, utils::Matrix
 	ply_set_read_cb(ply, "vertex", "y", callbackMatrix<ElementType>, &dataset_, 1);
 	ply_set_read_cb(ply, "vertex", "z", callbackMatrix<ElementType>, &dataset_, 2);
 
-	dataset_ = utils::Matrix<ElementType>(new ElementType[numberofpoints * 3], numberofpoints, 3);
+	dataset_ = utils::Matrix<ElementType>(numberofpoints, 3);
 
 	if (!ply_read(ply)) {
 		return 0;
@@ -61,34 +61,10 @@ template <typename ElementType> int io::readply(char *stringfile_, utils::Matrix
 	return 1;
 }
 
-template <typename ElementType> int io::writeply(char *stringfile_, utils::Matrix<ElementType>& dataset_)
+template <typename ElementType> int io::writeply(char *stringfile_, utils::Matrix<ElementType>& dataset_, io::PlyFormat format_)
 {
-	p_ply ply = ply_create(stringfile_, PLY_DEFAULT, NULL, 0, NULL);
-
-	ply_add_element(ply, "vertex", (long)dataset_.rows);
-
-	if (std::is_same<ElementType, float>::value) {
-		ply_add_property(ply, "x", PLY_FLOAT32, PLY_FLOAT32, PLY_FLOAT32);
-		ply_add_property(ply, "y", PLY_FLOAT32, PLY_FLOAT32, PLY_FLOAT32);
-		ply_add_property(ply, "z", PLY_FLOAT32, PLY_FLOAT32, PLY_FLOAT32);
-	}
-	else {
-		ply_add_property(ply, "x", PLY_DOUBLE, PLY_DOUBLE, PLY_DOUBLE);
-		ply_add_property(ply, "y", PLY_DOUBLE, PLY_DOUBLE, PLY_DOUBLE);
-		ply_add_property(ply, "z", PLY_DOUBLE, PLY_DOUBLE, PLY_DOUBLE);
-	}
-
-	ply_write_header(ply);
-
-	for (int i = 0; i < dataset_.rows; i++) {
-		ply_write(ply, dataset_[i][0]);
-		ply_write(ply, dataset_[i][1]);
-		ply_write(ply, dataset_[i][2]);
-	}
-
-	ply_close(ply);
-
-	return 1;
+	io::PlyWriter plywriter(format_);
+	return plywriter.write(stringfile_, dataset_);
 }
 
 template <typename ElementType> static int callbackPointcloud(p_ply_argument argument)
@@ -99,13 +75,13 @@ template <typename ElementType> static int callbackPointcloud(p_ply_argument arg
 
 	switch (index) {
 	case 0:
-		(*pointcloud).points[counter][0] = (ElementType)ply_get_argument_value(argument);
+		(*pointcloud).coordinate(counter, 0) = (ElementType)ply_get_argument_value(argument);
 		break;
 	case 1:
-		(*pointcloud).points[counter][1] = (ElementType)ply_get_argument_value(argument);
+		(*pointcloud).coordinate(counter, 1) = (ElementType)ply_get_argument_value(argument);
 		break;
 	case 2:
-		(*pointcloud).points[counter][2] = (ElementType)ply_get_argument_value(argument);
+		(*pointcloud).coordinate(counter, 2) = (ElementType)ply_get_argument_value(argument);
 		if (elements == 2) {
 			counter++;
 		}
@@ -131,6 +107,16 @@ template <typename ElementType> static int callbackPointcloud(p_ply_argument arg
 
 template <typename ElementType> int io::readply(char *stringfile_, utils::Pointcloud<ElementType>& pointcloud_)
 {
+	/**
+		Files are decoded from a memory mapping in parallel, rply is used when this fails
+	*/
+	{
+		io::PlyFile plyfile;
+		if (plyfile.open(stringfile_) && plyfile.read(pointcloud_)) {
+			return 1;
+		}
+	}
+
 	counter = 0;
 
 	p_ply ply = ply_open(stringfile_, NULL, 0, NULL);
@@ -178,46 +164,24 @@ template <typename ElementType> int io::readply(char *stringfile_, utils::Pointc
 	return 1;
 }
 
-template <typename ElementType> int io::writeply(char *stringfile_, utils::Pointcloud<ElementType>& pointcloud_)
+template <typename ElementType, typename Callback> int io::streamply(char *stringfile_, size_t chunk_, Callback callback_)
 {
-	p_ply ply = ply_create(stringfile_, PLY_DEFAULT, NULL, 0, NULL);
-
-	ply_add_element(ply, "vertex", (long)pointcloud_.points.rows);
-
-	if (std::is_same<ElementType, float>::value) {
-		ply_add_property(ply, "x", PLY_FLOAT32, PLY_FLOAT32, PLY_FLOAT32);
-		ply_add_property(ply, "y", PLY_FLOAT32, PLY_FLOAT32, PLY_FLOAT32);
-		ply_add_property(ply, "z", PLY_FLOAT32, PLY_FLOAT32, PLY_FLOAT32);
-	}
-	else {
-		ply_add_property(ply, "x", PLY_DOUBLE, PLY_DOUBLE, PLY_DOUBLE);
-		ply_add_property(ply, "y", PLY_DOUBLE, PLY_DOUBLE, PLY_DOUBLE);
-		ply_add_property(ply, "z", PLY_DOUBLE, PLY_DOUBLE, PLY_DOUBLE);
-	}
-
-	if (pointcloud_.colors.rows > 0) {
-		ply_add_property(ply, "red", PLY_UCHAR, PLY_UCHAR, PLY_UCHAR);
-		ply_add_property(ply, "green", PLY_UCHAR, PLY_UCHAR, PLY_UCHAR);
-		ply_add_property(ply, "blue", PLY_UCHAR, PLY_UCHAR, PLY_UCHAR);
-	}
-
-	ply_write_header(ply);
-
-	for (int i = 0; i < pointcloud_.points.rows; i++) {
-		ply_write(ply, pointcloud_.points[i][0]);
-		ply_write(ply, pointcloud_.points[i][1]);
-		ply_write(ply, pointcloud_.points[i][2]);
-		
-		if (pointcloud_.colors.rows > 0) {
-			ply_write(ply, pointcloud_.colors[i][0]);
-			ply_write(ply, pointcloud_.colors[i][1]);
-			ply_write(ply, pointcloud_.colors[i][2]);
-		}
+	io::PlyFile plyfile;
+	if (!plyfile.open(stringfile_)) {
+		std::cout << stringfile_ << " not found" << std::endl;
+		return 0;
 	}
 
-	ply_close(ply);
+	return plyfile.stream<ElementType>(chunk_, callback_);
+}
 
-	return 1;
+template <typename ElementType> int io::writeply(char *stringfile_, utils::Pointcloud<ElementType>& pointcloud_, io::PlyFormat format_)
+{
+	/**
+		Whole blocks of points and colors are encoded in parallel and written at once
+	*/
+	io::PlyWriter plywriter(format_);
+	return plywriter.write(stringfile_, pointcloud_);
 }
 
 #endif /* IOPLY_HPP_*/
\ No newline at end of file
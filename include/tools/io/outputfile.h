@@ -0,0 +1,178 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+
+#ifndef IO_OUTPUTFILE_H_
+#define IO_OUTPUTFILE_H_
+
+#include <cstddef>
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace io
+{
+	/**
+		File which is written at explicit positions. Writes to different ranges
+		may be issued from several threads at the same time.
+	*/
+	class OutputFile
+	{
+	public:
+
+		/**
+			Constructor
+		*/
+		OutputFile()
+		{
+#if defined(_WIN32)
+			file = INVALID_HANDLE_VALUE;
+#else
+			descriptor = -1;
+#endif
+		}
+
+		/**
+			Deconstructor
+		*/
+		~OutputFile()
+		{
+			close();
+		}
+
+		/**
+			Creates a file or truncates an existing file
+
+			@param stringfile_ path of the file
+			@return true when the file has been opened
+		*/
+		bool open(const char* stringfile_)
+		{
+			close();
+
+#if defined(_WIN32)
+			file = CreateFileA(stringfile_, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			return file != INVALID_HANDLE_VALUE;
+#else
+			descriptor = ::open(stringfile_, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			return descriptor >= 0;
+#endif
+		}
+
+		/**
+			Closes the file
+		*/
+		void close()
+		{
+#if defined(_WIN32)
+			if (file != INVALID_HANDLE_VALUE) {
+				CloseHandle(file);
+				file = INVALID_HANDLE_VALUE;
+			}
+#else
+			if (descriptor >= 0) {
+				::close(descriptor);
+				descriptor = -1;
+			}
+#endif
+		}
+
+		/**
+			Sets the size of the file, so that the blocks are allocated before
+			they are written in parallel
+
+			@param size_ number of Bytes
+			@return true when the size has been set
+		*/
+		bool resize(size_t size_)
+		{
+#if defined(_WIN32)
+			LARGE_INTEGER position;
+			position.QuadPart = (LONGLONG)size_;
+			return SetFilePointerEx(file, position, NULL, FILE_BEGIN) && SetEndOfFile(file);
+#else
+			return ftruncate(descriptor, (off_t)size_) == 0;
+#endif
+		}
+
+		/**
+			Writes a block of data at a position of the file
+
+			@param offset_ position in Bytes
+			@param data_ pointer to the data
+			@param size_ number of Bytes
+			@return true when all Bytes have been written
+		*/
+		bool write(size_t offset_, const char* data_, size_t size_) const
+		{
+			while (size_ > 0) {
+				size_t part = size_ < ((size_t)1 << 30) ? size_ : ((size_t)1 << 30);
+#if defined(_WIN32)
+				OVERLAPPED overlapped = {};
+				overlapped.Offset = (DWORD)(offset_ & 0xffffffff);
+				overlapped.OffsetHigh = (DWORD)((unsigned long long)offset_ >> 32);
+				DWORD written = 0;
+				if (!WriteFile(file, data_, (DWORD)part, &written, &overlapped) || written == 0) {
+					return 0;
+				}
+#else
+				ssize_t written = pwrite(descriptor, data_, part, (off_t)offset_);
+				if (written <= 0) {
+					return 0;
+				}
+#endif
+				offset_ += (size_t)written;
+				data_ += written;
+				size_ -= (size_t)written;
+			}
+			return 1;
+		}
+
+	private:
+
+		OutputFile(const OutputFile&);
+		OutputFile& operator=(const OutputFile&);
+
+#if defined(_WIN32)
+		HANDLE file;
+#else
+		int descriptor;
+#endif
+	};
+}
+
+#endif /* IO_OUTPUTFILE_H_ */
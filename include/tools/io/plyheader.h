@@ -0,0 +1,322 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+
+#ifndef IO_PLYHEADER_H_
+#define IO_PLYHEADER_H_
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace io
+{
+	/**
+		Encoding of the data of a PLY file
+	*/
+	enum PlyFormat {
+		PLY_FORMAT_ASCII = 0,
+		PLY_FORMAT_BINARY_LE = 1,
+		PLY_FORMAT_BINARY_BE = 2
+	};
+
+	/**
+		Scalar types of PLY properties
+	*/
+	enum PlyType {
+		PLY_TYPE_NONE = 0,
+		PLY_TYPE_INT8,
+		PLY_TYPE_UINT8,
+		PLY_TYPE_INT16,
+		PLY_TYPE_UINT16,
+		PLY_TYPE_INT32,
+		PLY_TYPE_UINT32,
+		PLY_TYPE_FLOAT32,
+		PLY_TYPE_FLOAT64
+	};
+
+	/**
+		Returns the type of a name of the header
+
+		@param name_ name of the type, e.g. "float" or "float32"
+		@return type, PLY_TYPE_NONE for unknown names
+	*/
+	inline PlyType plyType(const std::string& name_)
+	{
+		if (name_ == "char" || name_ == "int8") return PLY_TYPE_INT8;
+		if (name_ == "uchar" || name_ == "uint8") return PLY_TYPE_UINT8;
+		if (name_ == "short" || name_ == "int16") return PLY_TYPE_INT16;
+		if (name_ == "ushort" || name_ == "uint16") return PLY_TYPE_UINT16;
+		if (name_ == "int" || name_ == "int32") return PLY_TYPE_INT32;
+		if (name_ == "uint" || name_ == "uint32") return PLY_TYPE_UINT32;
+		if (name_ == "float" || name_ == "float32") return PLY_TYPE_FLOAT32;
+		if (name_ == "double" || name_ == "float64") return PLY_TYPE_FLOAT64;
+		return PLY_TYPE_NONE;
+	}
+
+	/**
+		Returns the size of a type
+
+		@param type_ type
+		@return number of Bytes
+	*/
+	inline size_t plyTypeSize(PlyType type_)
+	{
+		switch (type_) {
+		case PLY_TYPE_INT8: case PLY_TYPE_UINT8: return 1;
+		case PLY_TYPE_INT16: case PLY_TYPE_UINT16: return 2;
+		case PLY_TYPE_INT32: case PLY_TYPE_UINT32: case PLY_TYPE_FLOAT32: return 4;
+		case PLY_TYPE_FLOAT64: return 8;
+		default: return 0;
+		}
+	}
+
+	/**
+		Returns whether the machine stores numbers little-endian
+
+		@return true on little-endian machines
+	*/
+	inline bool plyLittleEndian()
+	{
+		uint16_t number = 1;
+		return *(const char*)&number == 1;
+	}
+
+	/**
+		Property of an element
+	*/
+	struct PlyProperty {
+		std::string name;
+		PlyType type;
+
+		/**
+			Type of the number of entries of a list, PLY_TYPE_NONE for scalars
+		*/
+		PlyType countType;
+
+		/**
+			Position of a scalar inside of a row in Bytes, only valid when the
+			element has no lists
+		*/
+		size_t offset;
+	};
+
+	/**
+		Element of a PLY file, e.g. "vertex" or "face"
+	*/
+	struct PlyElement {
+		std::string name;
+		size_t count;
+		std::vector<PlyProperty> properties;
+
+		/**
+			Size of a row in Bytes, 0 when the element contains lists
+		*/
+		size_t stride;
+
+		/**
+			Returns a property
+
+			@param name_ name of the property
+			@return pointer to the property, NULL when the element has no such property
+		*/
+		const PlyProperty* find(const char* name_) const
+		{
+			for (size_t i = 0; i < properties.size(); ++i) {
+				if (properties[i].name == name_) {
+					return &properties[i];
+				}
+			}
+			return NULL;
+		}
+	};
+
+	/**
+		Header of a PLY file
+	*/
+	struct PlyHeader {
+		PlyFormat format;
+		std::vector<PlyElement> elements;
+
+		/**
+			Size of the header in Bytes, the data starts behind it
+		*/
+		size_t size;
+
+		/**
+			Returns an element
+
+			@param name_ name of the element
+			@return pointer to the element, NULL when the file has no such element
+		*/
+		const PlyElement* find(const char* name_) const
+		{
+			for (size_t i = 0; i < elements.size(); ++i) {
+				if (elements[i].name == name_) {
+					return &elements[i];
+				}
+			}
+			return NULL;
+		}
+
+		/**
+			Computes where the data of an element starts in a binary file. All
+			elements in front of it must have a fixed row size.
+
+			@param name_ name of the element
+			@param offset_ receives the position in Bytes from the start of the file
+			@return true when the position could be computed
+		*/
+		bool dataOffset(const char* name_, size_t& offset_) const
+		{
+			offset_ = size;
+			for (size_t i = 0; i < elements.size(); ++i) {
+				if (elements[i].name == name_) {
+					return 1;
+				}
+				if (elements[i].stride == 0) {
+					return 0;
+				}
+				offset_ += elements[i].count * elements[i].stride;
+			}
+			return 0;
+		}
+	};
+
+	/**
+		Parses the header of a PLY file
+
+		@param data_ content of the file
+		@param size_ size of the content in Bytes
+		@param header_ receives the header
+		@return true when the header is valid
+	*/
+	inline bool parsePlyHeader(const char* data_, size_t size_, PlyHeader& header_)
+	{
+		const char* end = NULL;
+		const char* marker = "end_header";
+		size_t length = std::strlen(marker);
+		for (size_t i = 0; i + length <= size_; ++i) {
+			if (data_[i] == 'e' && std::strncmp(data_ + i, marker, length) == 0) {
+				end = data_ + i + length;
+				break;
+			}
+		}
+		if (!end || size_ < 3 || std::strncmp(data_, "ply", 3) != 0) {
+			return 0;
+		}
+
+		/**
+			The data starts behind the line break of end_header, which can be \r\n
+		*/
+		while (end < data_ + size_ && (*end == ' ' || *end == '\r')) ++end;
+		if (end < data_ + size_ && *end == '\n') ++end;
+		header_.size = end - data_;
+		header_.elements.clear();
+
+		std::istringstream stream(std::string(data_, header_.size));
+		std::string line;
+		bool format = 0;
+		while (std::getline(stream, line)) {
+			std::istringstream words(line);
+			std::string keyword;
+			words >> keyword;
+
+			if (keyword == "format") {
+				std::string name;
+				words >> name;
+				if (name == "ascii") header_.format = PLY_FORMAT_ASCII;
+				else if (name == "binary_little_endian") header_.format = PLY_FORMAT_BINARY_LE;
+				else if (name == "binary_big_endian") header_.format = PLY_FORMAT_BINARY_BE;
+				else return 0;
+				format = 1;
+			}
+			else if (keyword == "element") {
+				PlyElement element;
+				words >> element.name >> element.count;
+				if (!words) {
+					return 0;
+				}
+				element.stride = 0;
+				header_.elements.push_back(element);
+			}
+			else if (keyword == "property") {
+				if (header_.elements.empty()) {
+					return 0;
+				}
+				PlyElement& element = header_.elements.back();
+
+				PlyProperty property;
+				std::string type;
+				words >> type;
+				if (type == "list") {
+					std::string count;
+					words >> count >> type;
+					property.countType = plyType(count);
+					if (property.countType == PLY_TYPE_NONE) {
+						return 0;
+					}
+				}
+				else {
+					property.countType = PLY_TYPE_NONE;
+				}
+				property.type = plyType(type);
+				words >> property.name;
+				if (property.type == PLY_TYPE_NONE || !words) {
+					return 0;
+				}
+				property.offset = 0;
+				element.properties.push_back(property);
+			}
+		}
+
+		/**
+			Rows of elements without lists have a fixed size
+		*/
+		for (size_t i = 0; i < header_.elements.size(); ++i) {
+			PlyElement& element = header_.elements[i];
+			size_t offset = 0;
+			for (size_t j = 0; j < element.properties.size(); ++j) {
+				if (element.properties[j].countType != PLY_TYPE_NONE) {
+					offset = (size_t)-1;
+					break;
+				}
+				element.properties[j].offset = offset;
+				offset += plyTypeSize(element.properties[j].type);
+			}
+			element.stride = offset == (size_t)-1 ? 0 : offset;
+		}
+
+		return format;
+	}
+}
+
+#endif /* IO_PLYHEADER_H_ */
@@ -0,0 +1,727 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+
+#ifndef IO_PLYREADER_H_
+#define IO_PLYREADER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include <stdint.h>
+
+#include "flann/util/matrix.h"
+#include "flann/util/thread_pool.h"
+
+#include "io/mappedfile.h"
+#include "io/plyheader.h"
+#include "utils/pointcloud.h"
+
+namespace io
+{
+	/**
+		Loads a scalar from unaligned memory
+
+		@param data_ pointer to the scalar
+		@param swap_ reverses the order of the Bytes
+		@return scalar
+	*/
+	template <typename SourceType>
+	inline SourceType plyLoad(const char* data_, bool swap_)
+	{
+		SourceType value;
+		if (swap_) {
+			char bytes[sizeof(SourceType)];
+			for (size_t k = 0; k < sizeof(SourceType); ++k) {
+				bytes[k] = data_[sizeof(SourceType) - 1 - k];
+			}
+			std::memcpy(&value, bytes, sizeof(SourceType));
+		}
+		else {
+			std::memcpy(&value, data_, sizeof(SourceType));
+		}
+		return value;
+	}
+
+	/**
+		Converts a column of scalars
+
+		@param data_ pointer to the first scalar
+		@param stride_ distance between two scalars in Bytes
+		@param count_ number of scalars
+		@param swap_ reverses the order of the Bytes of every scalar
+		@param target_ pointer to the first converted value
+		@param targetStride_ distance between two converted values in Bytes
+	*/
+	template <typename SourceType, typename TargetType>
+	void plyConvert(const char* data_, size_t stride_, size_t count_, bool swap_, TargetType* target_, size_t targetStride_)
+	{
+		char* target = (char*)target_;
+		if (swap_) {
+			for (size_t i = 0; i < count_; ++i) {
+				*(TargetType*)(target + i*targetStride_) = (TargetType)plyLoad<SourceType>(data_ + i*stride_, 1);
+			}
+		}
+		else {
+			for (size_t i = 0; i < count_; ++i) {
+				*(TargetType*)(target + i*targetStride_) = (TargetType)plyLoad<SourceType>(data_ + i*stride_, 0);
+			}
+		}
+	}
+
+	/**
+		Converts a column of scalars of a type which is known at runtime
+
+		@param type_ type of the scalars in the file
+	*/
+	template <typename TargetType>
+	void plyConvert(PlyType type_, const char* data_, size_t stride_, size_t count_, bool swap_, TargetType* target_, size_t targetStride_)
+	{
+		switch (type_) {
+		case PLY_TYPE_INT8: plyConvert<int8_t>(data_, stride_, count_, swap_, target_, targetStride_); break;
+		case PLY_TYPE_UINT8: plyConvert<uint8_t>(data_, stride_, count_, swap_, target_, targetStride_); break;
+		case PLY_TYPE_INT16: plyConvert<int16_t>(data_, stride_, count_, swap_, target_, targetStride_); break;
+		case PLY_TYPE_UINT16: plyConvert<uint16_t>(data_, stride_, count_, swap_, target_, targetStride_); break;
+		case PLY_TYPE_INT32: plyConvert<int32_t>(data_, stride_, count_, swap_, target_, targetStride_); break;
+		case PLY_TYPE_UINT32: plyConvert<uint32_t>(data_, stride_, count_, swap_, target_, targetStride_); break;
+		case PLY_TYPE_FLOAT32: plyConvert<float>(data_, stride_, count_, swap_, target_, targetStride_); break;
+		case PLY_TYPE_FLOAT64: plyConvert<double>(data_, stride_, count_, swap_, target_, targetStride_); break;
+		default: break;
+		}
+	}
+
+	/**
+		Parses a number of an ASCII file. Numbers whose digits fit into the
+		mantissa of a double are converted exactly with a single multiplication
+		or division, all others are passed to strtod.
+
+		@param begin_ first character, moves behind the number
+		@param end_ end of the text
+		@param value_ receives the number
+		@return false when there is no number
+	*/
+	inline bool plyParse(const char*& begin_, const char* end_, double& value_)
+	{
+		static const double POWERS[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+			1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+		const char* p = begin_;
+		while (p < end_ && (*p == ' ' || *p == '\t')) ++p;
+
+		const char* start = p;
+		bool negative = 0;
+		if (p < end_ && (*p == '-' || *p == '+')) {
+			negative = *p == '-';
+			++p;
+		}
+
+		uint64_t mantissa = 0;
+		int digits = 0;
+		int exponent = 0;
+		bool any = 0;
+		for (; p < end_ && *p >= '0' && *p <= '9'; ++p, any = 1) {
+			if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) ++digits; }
+			else ++exponent;
+		}
+		if (p < end_ && *p == '.') {
+			for (++p; p < end_ && *p >= '0' && *p <= '9'; ++p, any = 1) {
+				if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) ++digits; --exponent; }
+			}
+		}
+		if (!any) {
+			return 0;
+		}
+		if (p < end_ && (*p == 'e' || *p == 'E')) {
+			const char* q = p + 1;
+			bool negativeExponent = 0;
+			if (q < end_ && (*q == '-' || *q == '+')) {
+				negativeExponent = *q == '-';
+				++q;
+			}
+			if (q < end_ && *q >= '0' && *q <= '9') {
+				int e = 0;
+				for (; q < end_ && *q >= '0' && *q <= '9'; ++q) {
+					e = e < 10000 ? e * 10 + (*q - '0') : e;
+				}
+				exponent += negativeExponent ? -e : e;
+				p = q;
+			}
+		}
+
+		if (mantissa > ((uint64_t)1 << 53) || exponent < -22 || exponent > 22) {
+			std::string text(start, p);
+			value_ = std::strtod(text.c_str(), NULL);
+		}
+		else {
+			value_ = exponent < 0 ? (double)mantissa / POWERS[-exponent] : (double)mantissa * POWERS[exponent];
+			if (negative) value_ = -value_;
+		}
+		begin_ = p;
+		return 1;
+	}
+
+	/**
+		PLY file which is mapped into memory. The vertex data is decoded or
+		parsed directly from the mapping, the rows are split among several threads.
+	*/
+	class PlyFile
+	{
+	public:
+
+		enum
+		{
+			/**
+				Number of rows which are converted by a thread at once
+			*/
+			CHUNK_SIZE = 16384,
+			/**
+				Minimal number of Bytes of an ASCII file which are parsed by a thread at once
+			*/
+			ASCII_CHUNK_SIZE = 1 << 20,
+			/**
+				Number of lines of a streamed chunk which are parsed by a thread at once
+			*/
+			ASCII_CHUNK_ROWS = 4096
+		};
+
+		/**
+			Constructor
+		*/
+		PlyFile()
+		{
+		}
+
+		/**
+			Maps a file and parses its header
+
+			@param stringfile_ path of the file
+			@return true when the file is a valid PLY file
+		*/
+		bool open(const char* stringfile_)
+		{
+			if (!file.open(stringfile_)) {
+				return 0;
+			}
+			if (!parsePlyHeader(file.getPtr(), file.getSize(), header)) {
+				file.close();
+				return 0;
+			}
+			return 1;
+		}
+
+		/**
+			Removes the mapping
+		*/
+		void close()
+		{
+			file.close();
+		}
+
+		/**
+			Returns the header
+
+			@return header of the file
+		*/
+		const PlyHeader& getHeader() const
+		{
+			return header;
+		}
+
+		/**
+			Decodes the vertices of a binary or ASCII file into a pointcloud, in the layout
+			of the pointcloud. Colors are read from red, green and blue or from
+			diffuse_red, diffuse_green and diffuse_blue.
+
+			@param pointcloud_ receives the points and colors
+			@param threads_ number of threads, 0 for the number of hardware threads
+			@return false when the file has no x, y and z or is malformed
+		*/
+		template <typename ElementType>
+		bool read(utils::Pointcloud<ElementType>& pointcloud_, int threads_ = 0) const
+		{
+			if (file.getPtr() && header.format == PLY_FORMAT_ASCII) {
+				return readAscii(pointcloud_, threads_);
+			}
+
+			const char* data;
+			const PlyElement* vertex;
+			if (!vertices(data, vertex)) {
+				return 0;
+			}
+
+			const PlyProperty* coordinates[3];
+			const PlyProperty* colors[3];
+			bool color;
+			if (!attributes(*vertex, coordinates, colors, color)) {
+				return 0;
+			}
+
+			size_t rows = vertex->count;
+			pointcloud_.setPoints(rows, 3);
+			if (color) {
+				pointcloud_.setColors(rows, 3);
+			}
+			if (rows == 0) {
+				return 1;
+			}
+
+			flann::ThreadPool workers(threads_);
+			decode(data, *vertex, coordinates, colors, color, rows, pointcloud_, workers);
+
+			return 1;
+		}
+
+		/**
+			Reads the vertices in chunks of a fixed number of rows and passes every
+			chunk to a callback, so that files which are larger than the memory can
+			be processed. The chunk is reused for all calls and the pages of the
+			file which have been read are released.
+
+			@param chunk_ number of rows of a chunk
+			@param callback_ is called with the chunk and the index of its first row,
+				returns false to stop reading
+			@param threads_ number of threads, 0 for the number of hardware threads
+			@return false when the file has no x, y and z or is malformed
+		*/
+		template <typename ElementType, typename Callback>
+		bool stream(size_t chunk_, Callback callback_, int threads_ = 0) const
+		{
+			const char* data;
+			const PlyElement* vertex;
+			bool ascii = file.getPtr() && header.format == PLY_FORMAT_ASCII;
+			if (ascii ? !asciiVertices(data, vertex) : !vertices(data, vertex)) {
+				return 0;
+			}
+
+			const PlyProperty* coordinates[3];
+			const PlyProperty* colors[3];
+			bool color;
+			if (!attributes(*vertex, coordinates, colors, color)) {
+				return 0;
+			}
+			std::vector<int> slots = asciiSlots(*vertex, coordinates, colors, color);
+
+			chunk_ = std::max(chunk_, (size_t)1);
+			const char* end = file.getPtr() + file.getSize();
+			std::vector<const char*> lines;
+			flann::ThreadPool workers(threads_);
+			utils::Pointcloud<ElementType> pointcloud;
+
+			for (size_t first = 0; first < vertex->count; first += chunk_) {
+				size_t rows = std::min(chunk_, vertex->count - first);
+				if (pointcloud.rows != rows) {
+					pointcloud.setPoints(rows, 3);
+					if (color) {
+						pointcloud.setColors(rows, 3);
+					}
+				}
+
+				const char* next;
+				if (ascii) {
+					/**
+						Find the lines of the chunk and parse them in parallel
+					*/
+					lines.resize(rows + 1);
+					lines[0] = data;
+					for (size_t i = 0; i < rows; ++i) {
+						if (lines[i] >= end) {
+							return 0;
+						}
+						lines[i + 1] = lineEnd(lines[i], end);
+					}
+
+					std::atomic<bool> valid(1);
+					std::atomic<size_t> index(0);
+					workers.run(workers.size(), [&](int, int) {
+						for (size_t begin = index.fetch_add(ASCII_CHUNK_ROWS); begin < rows; begin = index.fetch_add(ASCII_CHUNK_ROWS)) {
+							for (size_t i = begin; i < std::min(begin + ASCII_CHUNK_ROWS, rows); ++i) {
+								if (!parseLine(lines[i], lines[i + 1], *vertex, slots, pointcloud, i)) {
+									valid = 0;
+								}
+							}
+						}
+					});
+					if (!valid) {
+						return 0;
+					}
+					next = lines[rows];
+				}
+				else {
+					decode(data, *vertex, coordinates, colors, color, rows, pointcloud, workers);
+					next = data + rows * vertex->stride;
+				}
+
+				file.release(data - file.getPtr(), next - data);
+				data = next;
+
+				if (!callback_(pointcloud, first)) {
+					break;
+				}
+			}
+
+			return 1;
+		}
+
+		/**
+			Returns the points of a binary file without copying them. This is
+			only possible when x, y and z follow each other with the type
+			ElementType, in the byte order of the machine and aligned. The view
+			is valid as long as the file is open and must not be written.
+
+			@param matrix_ receives the view of the points
+			@return false when the layout of the file does not match
+		*/
+		template <typename ElementType>
+		bool view(flann::Matrix<ElementType>& matrix_) const
+		{
+			const char* data;
+			const PlyElement* vertex;
+			if (!vertices(data, vertex)) {
+				return 0;
+			}
+			if ((header.format == PLY_FORMAT_BINARY_LE) != plyLittleEndian()) {
+				return 0;
+			}
+
+			const PlyProperty* x = vertex->find("x");
+			const PlyProperty* y = vertex->find("y");
+			const PlyProperty* z = vertex->find("z");
+			PlyType type = std::is_same<ElementType, float>::value ? PLY_TYPE_FLOAT32 :
+				std::is_same<ElementType, double>::value ? PLY_TYPE_FLOAT64 : PLY_TYPE_NONE;
+			if (!x || !y || !z || type == PLY_TYPE_NONE || x->type != type || y->type != type || z->type != type) {
+				return 0;
+			}
+			if (y->offset != x->offset + sizeof(ElementType) || z->offset != y->offset + sizeof(ElementType)) {
+				return 0;
+			}
+
+			const char* first = data + x->offset;
+			if ((size_t)first % sizeof(ElementType) != 0 || vertex->stride % sizeof(ElementType) != 0) {
+				return 0;
+			}
+
+			matrix_ = flann::Matrix<ElementType>((ElementType*)first, vertex->count, 3, vertex->stride);
+			return 1;
+		}
+
+	private:
+
+		/**
+			Converts binary vertices into the first rows of a pointcloud, the rows
+			are split among the threads
+
+			@param data_ pointer to the first vertex
+			@param vertex_ vertex element
+			@param coordinates_ properties x, y and z
+			@param colors_ properties of the colors
+			@param color_ whether the colors are converted
+			@param rows_ number of vertices
+			@param pointcloud_ receives the points and colors
+			@param workers_ threads
+		*/
+		template <typename ElementType>
+		void decode(const char* data_, const PlyElement& vertex_, const PlyProperty* const* coordinates_, const PlyProperty* const* colors_,
+			bool color_, size_t rows_, utils::Pointcloud<ElementType>& pointcloud_, flann::ThreadPool& workers_) const
+		{
+			size_t pointStride = pointcloud_.layout == utils::POINTCLOUD_SOA ? sizeof(ElementType) : pointcloud_.points.stride;
+			bool swap = (header.format == PLY_FORMAT_BINARY_LE) != plyLittleEndian();
+			size_t stride = vertex_.stride;
+
+			std::atomic<size_t> next(0);
+			workers_.run(workers_.size(), [&](int, int) {
+				for (size_t begin = next.fetch_add(CHUNK_SIZE); begin < rows_; begin = next.fetch_add(CHUNK_SIZE)) {
+					size_t count = std::min((size_t)CHUNK_SIZE, rows_ - begin);
+					const char* row = data_ + begin*stride;
+
+					for (size_t j = 0; j < 3; ++j) {
+						plyConvert(coordinates_[j]->type, row + coordinates_[j]->offset, stride, count, swap,
+							&pointcloud_.coordinate(begin, j), pointStride);
+					}
+					if (color_) {
+						for (size_t j = 0; j < 3; ++j) {
+							plyConvert(colors_[j]->type, row + colors_[j]->offset, stride, count, swap,
+								pointcloud_.colors[begin] + j, pointcloud_.colors.stride);
+						}
+					}
+				}
+			});
+		}
+
+		/**
+			Finds the properties of the coordinates and colors of the vertices
+
+			@param vertex_ vertex element
+			@param coordinates_ receives the properties x, y and z
+			@param colors_ receives the properties of the colors
+			@param color_ receives whether the vertices have colors
+			@return false when the vertices have no x, y and z
+		*/
+		bool attributes(const PlyElement& vertex_, const PlyProperty** coordinates_, const PlyProperty** colors_, bool& color_) const
+		{
+			coordinates_[0] = vertex_.find("x");
+			coordinates_[1] = vertex_.find("y");
+			coordinates_[2] = vertex_.find("z");
+			if (!coordinates_[0] || !coordinates_[1] || !coordinates_[2]) {
+				return 0;
+			}
+
+			colors_[0] = vertex_.find("red");
+			colors_[1] = vertex_.find("green");
+			colors_[2] = vertex_.find("blue");
+			if (!colors_[0] || !colors_[1] || !colors_[2]) {
+				colors_[0] = vertex_.find("diffuse_red");
+				colors_[1] = vertex_.find("diffuse_green");
+				colors_[2] = vertex_.find("diffuse_blue");
+			}
+			color_ = colors_[0] && colors_[1] && colors_[2];
+			return 1;
+		}
+
+		/**
+			Parses the vertices of an ASCII file. The vertex lines are split into
+			chunks at line breaks. The threads first count the lines of their
+			chunks, which gives the first row of every chunk, and then parse the
+			chunks directly into the pointcloud.
+
+			@param pointcloud_ receives the points and colors
+			@param threads_ number of threads, 0 for the number of hardware threads
+			@return false when the file has no x, y and z or a line is malformed
+		*/
+		template <typename ElementType>
+		bool readAscii(utils::Pointcloud<ElementType>& pointcloud_, int threads_) const
+		{
+			const char* begin;
+			const char* end = file.getPtr() + file.getSize();
+			const PlyElement* vertex;
+
+			const PlyProperty* coordinates[3];
+			const PlyProperty* colors[3];
+			bool color;
+			if (!asciiVertices(begin, vertex) || !attributes(*vertex, coordinates, colors, color)) {
+				return 0;
+			}
+			std::vector<int> slots = asciiSlots(*vertex, coordinates, colors, color);
+
+			size_t rows = vertex->count;
+			pointcloud_.setPoints(rows, 3);
+			if (color) {
+				pointcloud_.setColors(rows, 3);
+			}
+			if (rows == 0) {
+				return 1;
+			}
+
+			flann::ThreadPool workers(threads_);
+			size_t count = std::max((size_t)1, std::min((size_t)(end - begin) / ASCII_CHUNK_SIZE, (size_t)workers.size() * 4));
+
+			/**
+				Chunk boundaries at line breaks
+			*/
+			std::vector<const char*> bounds(count + 1, end);
+			bounds[0] = begin;
+			for (size_t c = 1; c < count; ++c) {
+				const char* p = begin + (end - begin) * c / count;
+				bounds[c] = std::max(lineEnd(p, end), bounds[c - 1]);
+			}
+
+			std::vector<size_t> first(count + 1, 0);
+			std::atomic<size_t> next(0);
+			workers.run(workers.size(), [&](int, int) {
+				for (size_t c = next++; c < count; c = next++) {
+					size_t lines = 0;
+					for (const char* p = bounds[c]; p < bounds[c + 1]; p = lineEnd(p, bounds[c + 1])) {
+						++lines;
+					}
+					first[c + 1] = lines;
+				}
+			});
+			for (size_t c = 0; c < count; ++c) {
+				first[c + 1] += first[c];
+			}
+			if (first[count] < rows) {
+				return 0;
+			}
+
+			std::atomic<bool> valid(1);
+			next = 0;
+			workers.run(workers.size(), [&](int, int) {
+				for (size_t c = next++; c < count; c = next++) {
+					size_t row = first[c];
+					for (const char* p = bounds[c]; p < bounds[c + 1] && row < rows; ++row) {
+						const char* line = lineEnd(p, bounds[c + 1]);
+						if (!parseLine(p, line, *vertex, slots, pointcloud_, row)) {
+							valid = 0;
+						}
+						p = line;
+					}
+				}
+			});
+
+			return valid;
+		}
+
+		/**
+			Finds the first line of the vertices of an ASCII file by skipping the
+			lines of the elements in front of them
+
+			@param data_ receives the pointer to the first vertex
+			@param element_ receives the vertex element
+			@return false when the file has no vertices
+		*/
+		bool asciiVertices(const char*& data_, const PlyElement*& element_) const
+		{
+			data_ = file.getPtr() + header.size;
+			const char* end = file.getPtr() + file.getSize();
+
+			for (size_t i = 0; i < header.elements.size(); ++i) {
+				if (header.elements[i].name == "vertex") {
+					element_ = &header.elements[i];
+					return 1;
+				}
+				for (size_t j = 0; j < header.elements[i].count && data_ < end; ++j) {
+					data_ = lineEnd(data_, end);
+				}
+			}
+			return 0;
+		}
+
+		/**
+			Returns the slot of every property of an ASCII line: 0-2 coordinates,
+			3-5 colors and -1 for ignored properties
+
+			@param vertex_ vertex element
+			@param coordinates_ properties x, y and z
+			@param colors_ properties of the colors
+			@param color_ whether the colors are read
+			@return slots in the order of the properties
+		*/
+		static std::vector<int> asciiSlots(const PlyElement& vertex_, const PlyProperty* const* coordinates_, const PlyProperty* const* colors_, bool color_)
+		{
+			std::vector<int> slots(vertex_.properties.size(), -1);
+			for (size_t k = 0; k < vertex_.properties.size(); ++k) {
+				for (int j = 0; j < 3; ++j) {
+					if (&vertex_.properties[k] == coordinates_[j]) slots[k] = j;
+					if (color_ && &vertex_.properties[k] == colors_[j]) slots[k] = 3 + j;
+				}
+			}
+			return slots;
+		}
+
+		/**
+			Parses the line of a vertex
+
+			@param begin_ first character of the line
+			@param end_ end of the line
+			@param vertex_ vertex element
+			@param slots_ slot of every property
+			@param pointcloud_ receives the values
+			@param row_ index of the vertex
+			@return false when the line is malformed
+		*/
+		template <typename ElementType>
+		bool parseLine(const char* begin_, const char* end_, const PlyElement& vertex_, const std::vector<int>& slots_,
+			utils::Pointcloud<ElementType>& pointcloud_, size_t row_) const
+		{
+			double value;
+			for (size_t k = 0; k < vertex_.properties.size(); ++k) {
+				if (vertex_.properties[k].countType != PLY_TYPE_NONE) {
+					if (!plyParse(begin_, end_, value)) {
+						return 0;
+					}
+					for (int n = (int)value; n > 0; --n) {
+						if (!plyParse(begin_, end_, value)) {
+							return 0;
+						}
+					}
+					continue;
+				}
+
+				if (!plyParse(begin_, end_, value)) {
+					return 0;
+				}
+				int slot = slots_[k];
+				if (slot >= 3) {
+					pointcloud_.colors[row_][slot - 3] = (utils::uchar)value;
+				}
+				else if (slot >= 0) {
+					pointcloud_.coordinate(row_, slot) = (ElementType)value;
+				}
+			}
+			return 1;
+		}
+
+		/**
+			Returns the beginning of the next line
+
+			@param begin_ position inside of a line
+			@param end_ end of the text
+			@return position behind the next line break, end_ when there is none
+		*/
+		static const char* lineEnd(const char* begin_, const char* end_)
+		{
+			const char* p = (const char*)std::memchr(begin_, '\n', end_ - begin_);
+			return p ? p + 1 : end_;
+		}
+
+		/**
+			Finds the binary vertex data
+
+			@param data_ receives the pointer to the first vertex
+			@param element_ receives the vertex element
+			@return true when the file contains binary vertices of a fixed size
+		*/
+		bool vertices(const char*& data_, const PlyElement*& element_) const
+		{
+			if (!file.getPtr() || header.format == PLY_FORMAT_ASCII) {
+				return 0;
+			}
+
+			element_ = header.find("vertex");
+			size_t offset;
+			if (!element_ || element_->stride == 0 || !header.dataOffset("vertex", offset)) {
+				return 0;
+			}
+			if (offset + element_->count * element_->stride > file.getSize()) {
+				return 0;
+			}
+
+			data_ = file.getPtr() + offset;
+			return 1;
+		}
+
+		MappedFile file;
+		PlyHeader header;
+	};
+}
+
+#endif /* IO_PLYREADER_H_ */
@@ -0,0 +1,270 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+
+#ifndef IO_PLYWRITER_H_
+#define IO_PLYWRITER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "flann/util/thread_pool.h"
+
+#include "io/outputfile.h"
+#include "io/plyheader.h"
+#include "utils/matrix.h"
+#include "utils/pointcloud.h"
+
+namespace io
+{
+	/**
+		Stores a scalar into unaligned memory
+
+		@param data_ pointer to the target
+		@param value_ scalar
+		@param swap_ reverses the order of the Bytes
+	*/
+	template <typename ElementType>
+	inline void plyStore(char* data_, ElementType value_, bool swap_)
+	{
+		if (swap_) {
+			char bytes[sizeof(ElementType)];
+			std::memcpy(bytes, &value_, sizeof(ElementType));
+			for (size_t k = 0; k < sizeof(ElementType); ++k) {
+				data_[k] = bytes[sizeof(ElementType) - 1 - k];
+			}
+		}
+		else {
+			std::memcpy(data_, &value_, sizeof(ElementType));
+		}
+	}
+
+	/**
+		Writer for PLY files. The vertices are encoded in blocks by several
+		threads. Binary blocks have a fixed size and are written in parallel
+		to their final position, ASCII blocks are written in order.
+	*/
+	class PlyWriter
+	{
+	public:
+
+		enum
+		{
+			/**
+				Number of rows which are encoded by a thread at once
+			*/
+			CHUNK_SIZE = 16384
+		};
+
+		/**
+			Constructor
+
+			@param format_ encoding of the vertices
+			@param threads_ number of threads, 0 for the number of hardware threads
+		*/
+		PlyWriter(PlyFormat format_ = PLY_FORMAT_BINARY_LE, int threads_ = 0) : format(format_), threads(threads_)
+		{
+		}
+
+		/**
+			Writes the points and the colors of a pointcloud
+
+			@param stringfile_ path of the file
+			@param pointcloud_ pointcloud
+			@return true when the file has been written
+		*/
+		template <typename ElementType>
+		bool write(const char* stringfile_, const utils::Pointcloud<ElementType>& pointcloud_) const
+		{
+			const utils::Pointcloud<ElementType>& pointcloud = pointcloud_;
+			return vertices<ElementType>(stringfile_, pointcloud_.rows,
+				[&pointcloud](size_t i_, size_t j_) { return pointcloud.coordinate(i_, j_); },
+				pointcloud_.colors.rows > 0 ? &pointcloud_.colors : NULL);
+		}
+
+		/**
+			Writes the rows of a matrix with three columns
+
+			@param stringfile_ path of the file
+			@param dataset_ points
+			@return true when the file has been written
+		*/
+		template <typename ElementType>
+		bool write(const char* stringfile_, const utils::Matrix<ElementType>& dataset_) const
+		{
+			const utils::Matrix<ElementType>& dataset = dataset_;
+			return vertices<ElementType>(stringfile_, dataset_.rows,
+				[&dataset](size_t i_, size_t j_) { return dataset[i_][j_]; }, NULL);
+		}
+
+	private:
+
+		/**
+			Writes the header and the vertices
+
+			@param stringfile_ path of the file
+			@param rows_ number of vertices
+			@param point_ returns the coordinate j of the vertex i
+			@param colors_ colors of the vertices or NULL
+			@return true when the file has been written
+		*/
+		template <typename ElementType, typename Point>
+		bool vertices(const char* stringfile_, size_t rows_, Point point_, const utils::Matrix<utils::uchar>* colors_) const
+		{
+			OutputFile file;
+			if (!file.open(stringfile_)) {
+				return 0;
+			}
+
+			std::string head = header<ElementType>(rows_, colors_ != NULL);
+			if (!file.write(0, head.data(), head.size())) {
+				return 0;
+			}
+
+			size_t chunks = (rows_ + CHUNK_SIZE - 1) / CHUNK_SIZE;
+			flann::ThreadPool workers(threads);
+			std::atomic<bool> valid(1);
+
+			if (format != PLY_FORMAT_ASCII) {
+				/**
+					Every row has the same size, so every chunk knows its position
+				*/
+				size_t record = 3 * sizeof(ElementType) + (colors_ ? 3 : 0);
+				if (!file.resize(head.size() + rows_ * record)) {
+					return 0;
+				}
+
+				bool swap = (format == PLY_FORMAT_BINARY_LE) != plyLittleEndian();
+				std::atomic<size_t> next(0);
+				workers.run(workers.size(), [&](int, int) {
+					std::vector<char> buffer(CHUNK_SIZE * record);
+					for (size_t c = next++; c < chunks; c = next++) {
+						size_t begin = c * CHUNK_SIZE;
+						size_t count = std::min((size_t)CHUNK_SIZE, rows_ - begin);
+						char* p = buffer.data();
+						for (size_t i = begin; i < begin + count; ++i) {
+							for (size_t j = 0; j < 3; ++j, p += sizeof(ElementType)) {
+								plyStore<ElementType>(p, point_(i, j), swap);
+							}
+							if (colors_) {
+								std::memcpy(p, (*colors_)[i], 3);
+								p += 3;
+							}
+						}
+						if (!file.write(head.size() + begin * record, buffer.data(), count * record)) {
+							valid = 0;
+						}
+					}
+				});
+				return valid;
+			}
+
+			/**
+				Lines have different lengths, so the chunks are encoded in rounds
+				and written in order
+			*/
+			std::vector<std::string> buffers(workers.size());
+			size_t offset = head.size();
+			for (size_t first = 0; first < chunks; first += buffers.size()) {
+				size_t round = std::min(buffers.size(), chunks - first);
+				std::atomic<size_t> next(0);
+				workers.run(workers.size(), [&](int, int) {
+					for (size_t c = next++; c < round; c = next++) {
+						size_t begin = (first + c) * CHUNK_SIZE;
+						size_t count = std::min((size_t)CHUNK_SIZE, rows_ - begin);
+						std::string& buffer = buffers[c];
+						buffer.clear();
+
+						char line[128];
+						for (size_t i = begin; i < begin + count; ++i) {
+							int length = std::is_same<ElementType, float>::value ?
+								std::snprintf(line, sizeof(line), "%.9g %.9g %.9g", (double)point_(i, 0), (double)point_(i, 1), (double)point_(i, 2)) :
+								std::snprintf(line, sizeof(line), "%.17g %.17g %.17g", (double)point_(i, 0), (double)point_(i, 1), (double)point_(i, 2));
+							buffer.append(line, length);
+							if (colors_) {
+								length = std::snprintf(line, sizeof(line), " %u %u %u", (*colors_)[i][0], (*colors_)[i][1], (*colors_)[i][2]);
+								buffer.append(line, length);
+							}
+							buffer += '\n';
+						}
+					}
+				});
+
+				for (size_t c = 0; c < round; ++c) {
+					if (!file.write(offset, buffers[c].data(), buffers[c].size())) {
+						return 0;
+					}
+					offset += buffers[c].size();
+				}
+			}
+			return 1;
+		}
+
+		/**
+			Returns the header of a file with vertices
+
+			@param rows_ number of vertices
+			@param color_ whether the vertices have colors
+			@return header including end_header
+		*/
+		template <typename ElementType>
+		std::string header(size_t rows_, bool color_) const
+		{
+			static_assert(std::is_same<ElementType, float>::value || std::is_same<ElementType, double>::value,
+				"the coordinates of a PLY file are written as float or double");
+			const char* type = std::is_same<ElementType, float>::value ? "float" : "double";
+
+			std::ostringstream stream;
+			stream << "ply\n";
+			stream << "format " << (format == PLY_FORMAT_ASCII ? "ascii" : format == PLY_FORMAT_BINARY_LE ? "binary_little_endian" : "binary_big_endian") << " 1.0\n";
+			stream << "element vertex " << rows_ << "\n";
+			stream << "property " << type << " x\n";
+			stream << "property " << type << " y\n";
+			stream << "property " << type << " z\n";
+			if (color_) {
+				stream << "property uchar red\n";
+				stream << "property uchar green\n";
+				stream << "property uchar blue\n";
+			}
+			stream << "end_header\n";
+			return stream.str();
+		}
+
+		PlyFormat format;
+		int threads;
+	};
+}
+
+#endif /* IO_PLYWRITER_H_ */
@@ -32,9 +32,13 @@
 
 #include "utils/allocator.h"
 #include "utils/balancedtree.h"
+#include "utils/flatset.h"
 #include "utils/matrix.h"
+#include "utils/memorytracker.h"
 #include "utils/pointcloud.h"
+#include "utils/profiler.h"
 #include "utils/randomize.h"
 #include "utils/timer.h"
+#include "utils/tracer.h"
 
 #endif /* INCLUDE_PROJECT_H_ */
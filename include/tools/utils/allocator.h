@@ -30,103 +30,264 @@
 #ifndef UTILS_ALLOCATOR_H_
 #define UTILS_ALLOCATOR_H_
 
-#ifdef _DEBUG
-	#ifndef DEBUG_NEW
-		#define DEBUG_NEW new(_NORMAL_BLOCK, __FILE__, __LINE__)
-		#define new DEBUG_NEW
-	#endif
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#if defined(_WIN32)
+	#include <malloc.h>
+#elif defined(__linux__)
+	#include <sys/mman.h>
 #endif
 
+#include "utils/memorytracker.h"
+
 namespace utils
 
 {
+	/**
+		Allocates a memory area which starts at a multiple of the alignment
+
+		@param bytes_ size of the memory area in Bytes
+		@param alignment_ alignment in Bytes, power of two
+		@param counted_ receives whether the MemoryTracker has counted the area
+		@return pointer to the memory area
+	*/
+	inline void* alignedMalloc(size_t bytes_, size_t alignment_, bool& counted_)
+	{
+		alignment_ = std::max(alignment_, sizeof(void*));
+		size_t bytes = (bytes_ + alignment_ - 1) / alignment_ * alignment_;
+
+		void* pointer = nullptr;
+#if defined(_WIN32)
+		pointer = _aligned_malloc(bytes, alignment_);
+#else
+		if (posix_memalign(&pointer, alignment_, bytes) != 0) {
+			pointer = nullptr;
+		}
+#endif
+		if (!pointer) {
+			throw std::bad_alloc();
+		}
+		counted_ = MemoryTracker::allocated(bytes_);
+		return pointer;
+	}
+
+	/**
+		Frees a memory area which has been allocated by alignedMalloc()
+
+		@param pointer_ pointer to the memory area
+		@param bytes_ size of the memory area in Bytes as passed to alignedMalloc()
+		@param counted_ whether the MemoryTracker has counted the area
+	*/
+	inline void alignedFree(void* pointer_, size_t bytes_, bool counted_)
+	{
+#if defined(_WIN32)
+		_aligned_free(pointer_);
+#else
+		free(pointer_);
+#endif
+		if (counted_) {
+			MemoryTracker::freed(bytes_);
+		}
+	}
+
+	/**
+		Arena of equally sized elements which are addressed by their number. The
+		arena consists of blocks which double in size, block b holds size*2^b
+		elements, so the numbers stay valid when the arena grows and every element
+		can be found again from its number. Every block starts at a multiple of the
+		alignment, the elements inside a block are packed with a stride of chunk Bytes.
+
+		Allocations are thread-safe. Threads which allocate many elements pass their
+		own Cache, which reserves a run of numbers at once, so they do not contend
+		on the shared counter for every element.
+	*/
 	class Allocator {
 	
 	public:
-		size_t size;
-		size_t chunk;
-		int number;
+		enum
+		{
+			/**
+				Default alignment of the blocks in Bytes (cache line)
+			*/
+			ALIGNMENT = 64,
+			/**
+				Size of a huge page in Bytes
+			*/
+			HUGE_PAGE = 2 * 1024 * 1024,
+			/**
+				Number of elements which are reserved at once by a Cache
+			*/
+			CACHE_SIZE = 64,
+			/**
+				Maximal number of blocks
+			*/
+			MAX_BLOCKS = 48
+		};
 
+		/**
+			Run of reserved element numbers which belongs to a single thread
+		*/
+		struct Cache {
+			size_t begin;
+			size_t end;
 
-		void* base;
-		void* current;
+			Cache() : begin(0), end(0) {}
+		};
+
+		/**
+			Statistics of the arena
+		*/
+		struct Stats {
+			size_t blocks;
+			size_t elements;
+			size_t usedBytes;
+			size_t reservedBytes;
+		};
+
+		size_t size;
+		size_t chunk;
+		size_t alignment;
+		bool huge;
 
 		/**
 			Constructor
 		*/
 		Allocator()
 		{
-			size = 0;
-			chunk = 0;
-			number = 0;
-
-			base = nullptr;
-			current = nullptr;
+			init(0, 0, ALIGNMENT, false);
 		}
 
 		/**
 			Constructor
 
-			@param size_ number of elements
+			@param size_ number of elements of the first block
 			@param chunk_ size of the elements in Bytes
+			@param alignment_ alignment of the blocks in Bytes, power of two
+			@param huge_ blocks which are larger than a huge page are aligned to and
+				backed by huge pages where the system supports it
 		*/
-		Allocator(size_t size_, size_t chunk_) 
+		Allocator(size_t size_, size_t chunk_, size_t alignment_ = ALIGNMENT, bool huge_ = false)
 		{
-			size = size_;
-			chunk = chunk_;
-			number = 0;
+			init(size_, chunk_, alignment_, huge_);
+		}
 
-			base = (void*) new char[size*chunk];
-			current = base;
+		/**
+			Copy constructor, copies the allocated elements
+
+			@param other_ allocator which is copied
+		*/
+		Allocator(const Allocator& other_)
+		{
+			init(other_.size, other_.chunk, other_.alignment, other_.huge);
+
+			size_t count = other_.number.load();
+			number.store(count);
+			for (size_t b = 0; b < other_.blocks(); ++b) {
+				if (other_.blockCount(b) > 0) {
+					std::memcpy(address(blockOffset(b)), other_.block(b), other_.blockCount(b)*chunk);
+				}
+			}
+		}
+
+		/**
+			Move constructor
+
+			@param other_ allocator which is moved, it is empty afterwards
+		*/
+		Allocator(Allocator&& other_)
+		{
+			init(0, 0, ALIGNMENT, false);
+			swap(other_);
 		}
 
-		 /**
+		/**
+			Assignment operator
+
+			@param other_ allocator which is assigned
+			@return reference to this allocator
+		*/
+		Allocator& operator=(Allocator other_)
+		{
+			swap(other_);
+			return *this;
+		}
+
+		/**
 			Deconstructor
-		 */
-		~Allocator() {}
+		*/
+		~Allocator()
+		{
+			clear();
+		}
+
+		/**
+			Swap this allocator with another allocator
+
+			@param other_ allocator
+		*/
+		void swap(Allocator& other_)
+		{
+			std::swap(size, other_.size);
+			std::swap(chunk, other_.chunk);
+			std::swap(alignment, other_.alignment);
+			std::swap(huge, other_.huge);
+
+			number.store(other_.number.exchange(number.load()));
+			for (int b = 0; b < MAX_BLOCKS; ++b) {
+				directory[b].store(other_.directory[b].exchange(directory[b].load()));
+				std::swap(counted[b], other_.counted[b]);
+			}
+		}
 		
 		/**
 			Return a pointer to a memory area that can be used
 
-			@param chunk_ size of the element which is required in Bytes
 			@return pointer to the memory area
 		*/
 		void* allocate()
 		{
-			if (number == size) {
-				std::cout << __FILE__ << " Line " << __LINE__ << " " << number << std::endl;
-				exit(EXIT_FAILURE);
-			}
-
-			void* pointer = current;
-			current = (char*)current + chunk;
-
-			number = number + 1;
-			return pointer;
+			return address(number.fetch_add(1));
 		}
 
 		/**
 			Return a pointer to a memory area that can be used
 
-			@param chunk_ size of the element which is required in Bytes
 			@param number_ integer which specifies the location of the pointer
 			@return pointer to the memory area
 			@return number_ integer which specifies the location of the pointer
 		*/
 		void* allocate(int& number_) 
 		{
+			size_t current = number.fetch_add(1);
 
-			if (number == size) {
-				std::cout << __FILE__ << " Line " << __LINE__ << " " << number << std::endl;
-				exit(EXIT_FAILURE);
-			}
+			number_ = (int)current;
+			return address(current);
+		}
 
-			void* pointer = current;
-			current = (char*)current + chunk;
+		/**
+			Return a pointer to a memory area that can be used, the number is taken
+			from the cache of the calling thread
 
-			number_ = number;
-			number = number + 1;
-			return pointer;
+			@param number_ integer which specifies the location of the pointer
+			@param cache_ cache of the calling thread
+			@return pointer to the memory area
+			@return number_ integer which specifies the location of the pointer
+		*/
+		void* allocate(int& number_, Cache& cache_)
+		{
+			if (cache_.begin == cache_.end) {
+				cache_.begin = number.fetch_add(CACHE_SIZE);
+				cache_.end = cache_.begin + CACHE_SIZE;
+			}
+			size_t current = cache_.begin++;
+
+			number_ = (int)current;
+			return address(current);
 		}
 
 		/**
@@ -134,13 +295,16 @@ namespace utils
 		*/
 		void clear()
 		{
+			for (int b = 0; b < MAX_BLOCKS; ++b) {
+				char* pointer = directory[b].exchange(nullptr);
+				if (pointer) {
+					alignedFree(pointer, blockBytes(b), counted[b]);
+				}
+			}
+
 			size = 0;
 			chunk = 0;
-			number = 0;
-			
-			delete[] base;
-			base = nullptr;
-			current = nullptr;
+			number.store(0);
 		}
 
 		/**
@@ -148,56 +312,229 @@ namespace utils
 
 			@return number of Bytes that are used by this object
 		*/
-		size_t usedMemory() 
+		size_t usedMemory() const
 		{
-			return number*chunk;
+			return number.load()*chunk;
 		}
 
 		/**
-			Shows how much memory is remaining
+			Shows how much memory is remaining in the blocks which are allocated
 
 			@return number of Bytes that could be used
 		*/
-		size_t remainedMemory()
+		size_t remainedMemory() const
 		{
-			return (size - number)*chunk;
+			size_t capacity = blockOffset(blocks());
+			size_t count = number.load();
+			return count < capacity ? (capacity - count)*chunk : 0;
+		}
+
+		/**
+			Return statistics of the arena
+
+			@return number of blocks, elements and Bytes
+		*/
+		Stats stats() const
+		{
+			Stats stats;
+			stats.blocks = blocks();
+			stats.elements = number.load();
+			stats.usedBytes = usedMemory();
+			stats.reservedBytes = blockOffset(stats.blocks)*chunk;
+			return stats;
 		}
 
 		inline void* operator[](int number_)
 		{
-			return ((char*)base + chunk*number_);
+			return address(number_);
 		}
 
+		/**
+			Return a pointer to the first block
+
+			@return pointer to the first block
+		*/
 		void* ptr()
 		{
-			return base;
+			return directory[0].load();
+		}
+
+		/**
+			Return the number of allocated blocks
+
+			@return number of blocks
+		*/
+		size_t blocks() const
+		{
+			size_t b = 0;
+			while (b < MAX_BLOCKS && directory[b].load(std::memory_order_acquire)) {
+				++b;
+			}
+			return b;
+		}
+
+		/**
+			Return a pointer to a block
+
+			@param block_ index of the block
+			@return pointer to the block
+		*/
+		void* block(size_t block_) const
+		{
+			return directory[block_].load(std::memory_order_acquire);
 		}
+
+		/**
+			Return the number of the first element of a block
+
+			@param block_ index of the block
+			@return number of the first element
+		*/
+		size_t blockOffset(size_t block_) const
+		{
+			return size*((size_t(1) << block_) - 1);
+		}
+
+		/**
+			Return the number of allocated elements in a block
+
+			@param block_ index of the block
+			@return number of elements
+		*/
+		size_t blockCount(size_t block_) const
+		{
+			size_t first = blockOffset(block_);
+			size_t last = std::min(number.load(), blockOffset(block_ + 1));
+			return last > first ? last - first : 0;
+		}
+
+	private:
+
+		/**
+			Initialize an empty arena
+		*/
+		void init(size_t size_, size_t chunk_, size_t alignment_, bool huge_)
+		{
+			size = size_;
+			chunk = chunk_;
+			alignment = alignment_;
+			huge = huge_;
+
+			number.store(0);
+			for (int b = 0; b < MAX_BLOCKS; ++b) {
+				directory[b].store(nullptr);
+				counted[b] = false;
+			}
+		}
+
+		/**
+			Return the address of an element, allocates the block of the element if
+			it does not exist
+
+			@param number_ number of the element
+			@return pointer to the element
+		*/
+		void* address(size_t number_)
+		{
+			if (size == 0) {
+				throw std::bad_alloc();
+			}
+
+			size_t b = 0;
+			for (size_t q = number_ / size + 1; q > 1; q >>= 1) {
+				++b;
+			}
+			if (b >= MAX_BLOCKS) {
+				throw std::bad_alloc();
+			}
+
+			char* pointer = directory[b].load(std::memory_order_acquire);
+			if (!pointer) {
+				pointer = grow(b);
+			}
+			return pointer + (number_ - blockOffset(b))*chunk;
+		}
+
+		/**
+			Allocate all blocks up to a block
+
+			@param block_ index of the block
+			@return pointer to the block
+		*/
+		char* grow(size_t block_)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for (size_t b = 0; b <= block_; ++b) {
+				if (!directory[b].load(std::memory_order_relaxed)) {
+					directory[b].store(alignedAlloc(blockBytes(b), counted[b]), std::memory_order_release);
+				}
+			}
+			return directory[block_].load(std::memory_order_relaxed);
+		}
+
+		/**
+			Size of a block as it is allocated, blocks which are backed by huge
+			pages are rounded up to whole huge pages
+
+			@param block_ index of the block
+			@return size of the block in Bytes
+		*/
+		size_t blockBytes(size_t block_) const
+		{
+			size_t bytes = (size << block_)*chunk;
+			if (huge && bytes >= HUGE_PAGE) {
+				size_t align = std::max(alignment, (size_t)HUGE_PAGE);
+				bytes = (bytes + align - 1) / align * align;
+			}
+			return bytes;
+		}
+
+		/**
+			Allocate an aligned memory area
+
+			@param bytes_ size of the memory area in Bytes, see blockBytes()
+			@param counted_ receives whether the MemoryTracker has counted the area
+			@return pointer to the memory area
+		*/
+		char* alignedAlloc(size_t bytes_, bool& counted_)
+		{
+			size_t align = alignment;
+			if (huge && bytes_ >= HUGE_PAGE) {
+				align = std::max(align, (size_t)HUGE_PAGE);
+			}
+
+			void* pointer = alignedMalloc(bytes_, align, counted_);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+			if (huge && bytes_ >= HUGE_PAGE) {
+				madvise(pointer, bytes_, MADV_HUGEPAGE);
+			}
+#endif
+			return (char*)pointer;
+		}
+
+		/**
+			Number of the next element which is not reserved
+		*/
+		std::atomic<size_t> number;
+
+		/**
+			Pointers to the blocks
+		*/
+		std::atomic<char*> directory[MAX_BLOCKS];
+
+		/**
+			Whether the blocks have been counted by the MemoryTracker, written
+			under the mutex before the block is published
+		*/
+		bool counted[MAX_BLOCKS];
+
+		/**
+			Guards the allocation of new blocks
+		*/
+		std::mutex mutex;
 	};
 
 }
 
-/////////**
-////////	Overloading of the operator new - this operator offers a pointer to the allocated memory
-////////
-////////	@param allocator_ object which offers the allocated memory
-////////	@return pointer to the respective memory
-////////*/
-////////inline void* operator new(size_t size_, utils::Allocator& allocator_) 
-////////{
-////////	return allocator_.allocate();
-////////}
-////////
-/////////**
-////////	Overloading of the operator new - this operator offers a pointer to the allocated memory
-////////
-////////	@param allocator_ object which offers the allocated memory
-////////	@param number_ integer which specifies the location of the pointer
-////////	@return pointer to the respective memory
-////////	@return number_ integer which specifies the location of the pointer
-////////*/
-////////inline void* operator new(size_t size_, utils::Allocator& allocator_, int& number_)
-////////{
-////////	return allocator_.allocate(number_);
-////////}
-
 #endif /* UTILS_ALLOCATOR_H_ */
\ No newline at end of file
@@ -78,8 +78,8 @@ namespace utils
 		*/
 		~BalancedTree(void)
 		{
-			if (nodel != NULL) { nodel->~BalancedTree(); delete nodel; nodel = NULL;}
-			if (noder != NULL) { noder->~BalancedTree(); delete noder; noder = NULL;}
+			if (nodel != NULL) { delete nodel; nodel = NULL;}
+			if (noder != NULL) { delete noder; noder = NULL;}
 		}
 
 		/**
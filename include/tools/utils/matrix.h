@@ -30,36 +30,108 @@
 #ifndef UTILS_MATRIX_H_
 #define UTILS_MATRIX_H_
 
+#include <algorithm>
+#include <cstring>
+
+#include "flann/util/matrix.h"
+#include "utils/allocator.h"
+
 namespace utils
 {
-
+	/**
+		Matrix which owns its data. The data starts at a multiple of ALIGNMENT
+		Bytes and every row can be padded to a multiple of a number of Bytes,
+		e.g. rows of three floats padded to 16 Bytes. The padding is set to zero.
+	*/
 	template <typename ElementType>
 	class Matrix
 	{
 	public:
 
+		enum
+		{
+			/**
+				Alignment of the data array in Bytes
+			*/
+			ALIGNMENT = 64
+		};
+
 		size_t rows;
 		size_t cols;
+
+		/**
+			Distance between two rows in Bytes
+		*/
+		size_t stride;
+
 		ElementType* data;
 
 		/**
 			Constructor
 		*/
 		Matrix(void) :
-			rows(0), cols(0), data(NULL)
+			rows(0), cols(0), stride(0), data(NULL), counted(false)
 		{
 		}
 
 		/**
-			Constructor
+			Constructor, allocates the data array
 			
-			@param data row-array of a specific Type
 			@param rows
 			@param cols
+			@param padding_ rows are padded to a multiple of padding_ Bytes, 0 for no padding
+		*/
+		Matrix(size_t rows_, size_t cols_, size_t padding_ = 0) :
+			rows(rows_), cols(cols_), data(NULL), counted(false)
+		{
+			stride = cols*sizeof(ElementType);
+			if (padding_ > 0) {
+				stride = (stride + padding_ - 1) / padding_ * padding_;
+			}
+
+			if (rows*stride > 0) {
+				data = (ElementType*)alignedMalloc(rows*stride, ALIGNMENT, counted);
+				if (stride != cols*sizeof(ElementType)) {
+					std::memset(data, 0, rows*stride);
+				}
+			}
+		}
+
+		/**
+			Copy constructor, copies the data array
+
+			@param other_ matrix which is copied
+		*/
+		Matrix(const Matrix& other_) :
+			rows(other_.rows), cols(other_.cols), stride(other_.stride), data(NULL), counted(false)
+		{
+			if (other_.data) {
+				data = (ElementType*)alignedMalloc(rows*stride, ALIGNMENT, counted);
+				std::memcpy(data, other_.data, rows*stride);
+			}
+		}
+
+		/**
+			Move constructor
+
+			@param other_ matrix which is moved, it is empty afterwards
 		*/
-		Matrix(ElementType* data_, size_t rows_, size_t cols_) :
-			rows(rows_), cols(cols_), data(data_)
+		Matrix(Matrix&& other_) :
+			rows(0), cols(0), stride(0), data(NULL), counted(false)
 		{
+			swap(other_);
+		}
+
+		/**
+			Assignment operator
+
+			@param other_ matrix which is assigned
+			@return reference to this matrix
+		*/
+		Matrix& operator=(Matrix other_)
+		{
+			swap(other_);
+			return *this;
 		}
 
 		/**
@@ -67,14 +139,37 @@ namespace utils
 		*/
 		~Matrix()
 		{
+			clear();
+		}
+
+		/**
+			Swap this matrix with another matrix
+
+			@param other_ matrix
+		*/
+		void swap(Matrix& other_)
+		{
+			std::swap(rows, other_.rows);
+			std::swap(cols, other_.cols);
+			std::swap(stride, other_.stride);
+			std::swap(data, other_.data);
+			std::swap(counted, other_.counted);
 		}
 
 		/**
 			Deletes the data array
 		*/
-		void clear() const
+		void clear()
 		{
-			delete[] data;
+			if (data) {
+				alignedFree(data, rows*stride, counted);
+			}
+
+			rows = 0;
+			cols = 0;
+			stride = 0;
+			data = NULL;
+			counted = false;
 		}
 
 		/**
@@ -87,6 +182,17 @@ namespace utils
 			return (data);
 		}
 
+		/**
+			Returns a flann::Matrix which refers to the data array of this matrix.
+			Nothing is copied, the view is valid as long as this matrix is.
+
+			@return view of this matrix
+		*/
+		flann::Matrix<ElementType> view() const
+		{
+			return flann::Matrix<ElementType>(data, rows, cols, stride);
+		}
+
 		/**
 			Return the pointer of the indexth row
 			
@@ -94,11 +200,17 @@ namespace utils
 		*/
 		inline ElementType* operator[](size_t index) const
 		{
-			return data + index*cols;
+			return (ElementType*)((char*)data + index*stride);
 		}
 
+	private:
+
+		/**
+			Whether the data array has been counted by the MemoryTracker
+		*/
+		bool counted;
 	};
 
 }
 
-#endif UTILS_MATRIX_H_
\ No newline at end of file
+#endif /* UTILS_MATRIX_H_ */
@@ -0,0 +1,248 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef UTILS_PERFCOUNTERS_H_
+#define UTILS_PERFCOUNTERS_H_
+
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace utils
+{
+	/**
+		Hardware performance counters of the process, read with perf_event_open
+		on Linux. The counters are opened once and count the calling thread and
+		every thread it starts afterwards, a phase is measured by the difference
+		of two samples. Thread pools should therefore be created after the
+		counters, otherwise their workers are not counted.
+
+		A counter which the kernel or the hardware does not provide, e.g. in a
+		virtual machine or with a restrictive perf_event_paranoid, is marked as
+		invalid. On other systems no counter is valid.
+	*/
+	class PerfCounters
+	{
+	public:
+
+		enum Counter {
+			CYCLES,
+			INSTRUCTIONS,
+			LLC_MISSES,
+			BRANCH_MISSES,
+			DTLB_MISSES,
+			COUNTERS
+		};
+
+		/**
+			Values of all counters at a point in time or over a phase
+		*/
+		struct Sample {
+			double values[COUNTERS];
+			bool valid[COUNTERS];
+
+			Sample()
+			{
+				for (int i = 0; i < COUNTERS; i++) {
+					values[i] = 0;
+					valid[i] = false;
+				}
+			}
+
+			/**
+				Returns the counts of the phase from the other sample to this one
+			*/
+			Sample operator-(const Sample& other_) const
+			{
+				Sample result;
+				for (int i = 0; i < COUNTERS; i++) {
+					result.valid[i] = valid[i] && other_.valid[i];
+					result.values[i] = result.valid[i] ? values[i] - other_.values[i] : 0;
+				}
+				return result;
+			}
+
+			/**
+				Returns the counts per unit, e.g. per query
+			*/
+			Sample operator/(double units_) const
+			{
+				Sample result = *this;
+				for (int i = 0; i < COUNTERS; i++) {
+					result.values[i] = units_ > 0 ? values[i] / units_ : 0;
+				}
+				return result;
+			}
+		};
+
+		/**
+			Constructor, opens and starts the counters
+		*/
+		PerfCounters()
+		{
+			for (int i = 0; i < COUNTERS; i++) {
+				descriptors[i] = open(Counter(i));
+			}
+		}
+
+		/**
+			Deconstructor, closes the counters
+		*/
+		~PerfCounters()
+		{
+#if defined(__linux__)
+			for (int i = 0; i < COUNTERS; i++) {
+				if (descriptors[i] >= 0) {
+					close(descriptors[i]);
+				}
+			}
+#endif
+		}
+
+		PerfCounters(const PerfCounters&) = delete;
+		PerfCounters& operator=(const PerfCounters&) = delete;
+
+		/**
+			Returns whether at least one counter is valid
+
+			@return true if counters are available
+		*/
+		bool available() const
+		{
+			for (int i = 0; i < COUNTERS; i++) {
+				if (descriptors[i] >= 0) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/**
+			Reads all counters. If the kernel has to multiplex the counters, the
+			values are scaled up to the time the counter has been enabled.
+
+			@return current values
+		*/
+		Sample read() const
+		{
+			Sample sample;
+#if defined(__linux__)
+			for (int i = 0; i < COUNTERS; i++) {
+				/* value, time enabled, time running */
+				uint64_t values[3];
+				if (descriptors[i] < 0 || ::read(descriptors[i], values, sizeof(values)) != sizeof(values)) {
+					continue;
+				}
+				sample.valid[i] = true;
+				sample.values[i] = values[2] > 0 ? double(values[0]) * double(values[1]) / double(values[2]) : 0;
+			}
+#endif
+			return sample;
+		}
+
+		/**
+			Returns the name of a counter
+
+			@param counter_ counter
+			@return name
+		*/
+		static const char* name(Counter counter_)
+		{
+			switch (counter_) {
+			case CYCLES: return "cycles";
+			case INSTRUCTIONS: return "instructions";
+			case LLC_MISSES: return "llc_misses";
+			case BRANCH_MISSES: return "branch_misses";
+			case DTLB_MISSES: return "dtlb_misses";
+			default: return "unknown";
+			}
+		}
+
+	private:
+
+		/**
+			Opens a counter
+
+			@param counter_ counter
+			@return file descriptor, -1 if the counter is not available
+		*/
+		static int open(Counter counter_)
+		{
+#if defined(__linux__)
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			attr.inherit = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			switch (counter_) {
+			case CYCLES:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_CPU_CYCLES;
+				break;
+			case INSTRUCTIONS:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+				break;
+			case LLC_MISSES:
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+				break;
+			case BRANCH_MISSES:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+				break;
+			case DTLB_MISSES:
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+				break;
+			default:
+				return -1;
+			}
+
+			return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+			(void)counter_;
+			return -1;
+#endif
+		}
+
+		int descriptors[COUNTERS];
+	};
+}
+
+#endif /* UTILS_PERFCOUNTERS_H_ */
@@ -30,6 +30,11 @@
 #ifndef UTILS_POINTCLOUD_H_
 #define UTILS_POINTCLOUD_H_
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
 #include "utils/matrix.h"
 
 namespace utils
@@ -37,21 +42,54 @@ namespace utils
 
 	typedef unsigned char uchar;
 
+	/**
+		Memory layout of the points of a pointcloud
+	*/
+	enum PointcloudLayout {
+		/**
+			Array of structures, the coordinates of a point are stored together in points
+		*/
+		POINTCLOUD_AOS = 0,
+		/**
+			Structure of arrays, every coordinate axis is stored as a row of axes
+		*/
+		POINTCLOUD_SOA = 1
+	};
+
 	template <typename ElementType>
 	class Pointcloud {
 
 	public:
 
+		enum
+		{
+			/**
+				The rows of the points are padded to a multiple of PADDING Bytes,
+				so a point with three floats takes 16 Bytes
+			*/
+			PADDING = 16,
+			/**
+				The rows of the axes are padded to a multiple of AXIS_PADDING Bytes,
+				so every axis starts at a cache line
+			*/
+			AXIS_PADDING = 64
+		};
+
 		utils::Matrix<ElementType> points;
+		utils::Matrix<ElementType> axes;
 		utils::Matrix<uchar> colors;
 
 		size_t rows;
 		size_t cols;
 
+		PointcloudLayout layout;
+
 		/**
 		* Constructor
+		*
+		* @param layout_ memory layout of the points
 		*/
-		Pointcloud(void)
+		Pointcloud(PointcloudLayout layout_ = POINTCLOUD_AOS) : rows(0), cols(0), layout(layout_), stale(true)
 		{
 		}
 
@@ -60,13 +98,40 @@ namespace utils
 		*
 		* @param rows
 		* @param cols
+		* @param layout_ memory layout of the points
 		*/
-		Pointcloud(size_t rows_, size_t cols_)
+		Pointcloud(size_t rows_, size_t cols_, PointcloudLayout layout_ = POINTCLOUD_AOS) : layout(layout_), stale(true)
 		{
-			points = utils::Matrix<ElementType>(new ElementType[rows_*cols_], rows_, cols_);
+			setPoints(rows_, cols_);
+		}
 
-			rows = rows_;
-			cols = cols_;
+		/**
+		* Copy constructor
+		*
+		* @param other_ pointcloud which is copied
+		*/
+		Pointcloud(const Pointcloud& other_) :
+			points(other_.points), axes(other_.axes), colors(other_.colors), rows(other_.rows), cols(other_.cols),
+			layout(other_.layout), stale(other_.stale.load(std::memory_order_relaxed))
+		{
+		}
+
+		/**
+		* Assignment operator
+		*
+		* @param other_ pointcloud which is assigned
+		* @return reference to this pointcloud
+		*/
+		Pointcloud& operator=(const Pointcloud& other_)
+		{
+			points = other_.points;
+			axes = other_.axes;
+			colors = other_.colors;
+			rows = other_.rows;
+			cols = other_.cols;
+			layout = other_.layout;
+			stale.store(other_.stale.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			return *this;
 		}
 
 		/**
@@ -79,10 +144,12 @@ namespace utils
 		/**
 		* Deletes the point and color array
 		*/
-		void clear() const
+		void clear()
 		{
 			points.clear();
+			axes.clear();
 			colors.clear();
+			stale.store(true, std::memory_order_relaxed);
 		}
 
 		/**
@@ -103,10 +170,18 @@ namespace utils
 		*/
 		void setPoints(size_t rows_, size_t cols_)
 		{
-			points = utils::Matrix<ElementType>(new ElementType[rows_*cols_], rows_, cols_);
+			if (layout == POINTCLOUD_SOA) {
+				axes = utils::Matrix<ElementType>(cols_, rows_, AXIS_PADDING);
+				points.clear();
+			}
+			else {
+				points = utils::Matrix<ElementType>(rows_, cols_, PADDING);
+				axes.clear();
+			}
 
 			rows = rows_;
 			cols = cols_;
+			stale.store(true, std::memory_order_relaxed);
 		}
 
 		/**
@@ -117,11 +192,251 @@ namespace utils
 		*/
 		void setColors(size_t rows_, size_t cols_)
 		{
-			colors = utils::Matrix<uchar>(new uchar[rows_*cols_], rows_, cols_);
+			colors = utils::Matrix<uchar>(rows_, cols_);
+		}
+
+		/**
+		* Changes the memory layout, the points are copied into the new layout.
+		* Views of the points which have been returned before become invalid.
+		*
+		* @param layout_ memory layout of the points
+		*/
+		void setLayout(PointcloudLayout layout_)
+		{
+			if (layout_ == layout) {
+				return;
+			}
+
+			if (layout_ == POINTCLOUD_SOA) {
+				axes = utils::Matrix<ElementType>(cols, rows, AXIS_PADDING);
+				for (size_t i = 0; i < rows; ++i) {
+					for (size_t j = 0; j < cols; ++j) {
+						axes[j][i] = points[i][j];
+					}
+				}
+				points.clear();
+			}
+			else {
+				toPoints();
+				axes.clear();
+			}
+			layout = layout_;
+			stale.store(true, std::memory_order_relaxed);
+		}
+
+		/**
+		* Returns a coordinate of a point, which may be changed
+		*
+		* @param index_ index of the point
+		* @param axis_ index of the coordinate axis
+		* @return reference to the coordinate
+		*/
+		inline ElementType& coordinate(size_t index_, size_t axis_)
+		{
+			if (layout == POINTCLOUD_SOA) {
+				/* Only written if the flag changes, so threads which fill a cloud
+				do not contend on its cache line. */
+				if (!stale.load(std::memory_order_relaxed)) {
+					stale.store(true, std::memory_order_relaxed);
+				}
+				return axes[axis_][index_];
+			}
+			return points[index_][axis_];
+		}
+
+		/**
+		* Returns a coordinate of a point
+		*
+		* @param index_ index of the point
+		* @param axis_ index of the coordinate axis
+		* @return reference to the coordinate
+		*/
+		inline const ElementType& coordinate(size_t index_, size_t axis_) const
+		{
+			return layout == POINTCLOUD_SOA ? axes[axis_][index_] : points[index_][axis_];
+		}
+
+		/**
+		* Returns the array of a coordinate axis which may be changed, only in the
+		* structure of arrays layout
+		*
+		* @param axis_ index of the coordinate axis
+		* @return pointer to the array of the axis
+		*/
+		inline ElementType* axis(size_t axis_)
+		{
+			stale.store(true, std::memory_order_relaxed);
+			return axes[axis_];
+		}
+
+		/**
+		* Returns the array of a coordinate axis, only in the structure of arrays layout
+		*
+		* @param axis_ index of the coordinate axis
+		* @return pointer to the array of the axis
+		*/
+		inline const ElementType* axis(size_t axis_) const
+		{
+			return axes[axis_];
+		}
+
+		/**
+		* Returns the points as input of an index. In the array of structures layout
+		* nothing is copied. An index needs the coordinates of a point next to each
+		* other, so in the structure of arrays layout the axes are copied into
+		* points. They are only copied again after the axes have been changed, and
+		* into the same memory, so views which have been returned before stay
+		* valid as long as the size and the layout of the cloud do not change.
+		*
+		* @return view of the points
+		*/
+		flann::Matrix<ElementType> view()
+		{
+			if (layout == POINTCLOUD_SOA && stale.load(std::memory_order_relaxed)) {
+				toPoints();
+				stale.store(false, std::memory_order_relaxed);
+			}
+			return points.view();
+		}
+
+		/**
+		* Computes the axis aligned bounding box of the points
+		*
+		* @param low_ array of cols values which receives the minimum of every axis
+		* @param high_ array of cols values which receives the maximum of every axis
+		*/
+		void boundingBox(ElementType* low_, ElementType* high_) const
+		{
+			if (rows == 0) {
+				return;
+			}
+
+			for (size_t j = 0; j < cols; ++j) {
+				low_[j] = coordinate(0, j);
+				high_[j] = coordinate(0, j);
+			}
+
+			if (layout == POINTCLOUD_SOA) {
+				for (size_t j = 0; j < cols; ++j) {
+					const ElementType* values = axes[j];
+					ElementType low = low_[j];
+					ElementType high = high_[j];
+					for (size_t i = 0; i < rows; ++i) {
+						low = values[i] < low ? values[i] : low;
+						high = values[i] > high ? values[i] : high;
+					}
+					low_[j] = low;
+					high_[j] = high;
+				}
+			}
+			else {
+				for (size_t i = 0; i < rows; ++i) {
+					const ElementType* point = points[i];
+					for (size_t j = 0; j < cols; ++j) {
+						low_[j] = point[j] < low_[j] ? point[j] : low_[j];
+						high_[j] = point[j] > high_[j] ? point[j] : high_[j];
+					}
+				}
+			}
+		}
+
+		/**
+		* Computes the squared euclidean distance of every point to a query point
+		*
+		* @param query_ array of cols values
+		* @param dists_ array of rows values which receives the distances
+		*/
+		void distances(const ElementType* query_, ElementType* dists_) const
+		{
+			if (layout == POINTCLOUD_SOA) {
+				std::fill(dists_, dists_ + rows, ElementType(0));
+				for (size_t j = 0; j < cols; ++j) {
+					const ElementType* values = axes[j];
+					ElementType q = query_[j];
+					for (size_t i = 0; i < rows; ++i) {
+						ElementType diff = values[i] - q;
+						dists_[i] += diff * diff;
+					}
+				}
+			}
+			else {
+				for (size_t i = 0; i < rows; ++i) {
+					const ElementType* point = points[i];
+					ElementType dist = 0;
+					for (size_t j = 0; j < cols; ++j) {
+						ElementType diff = point[j] - query_[j];
+						dist += diff * diff;
+					}
+					dists_[i] = dist;
+				}
+			}
 		}
 
+		/**
+		* Assigns every point to a cubic voxel of the bounding box. The voxel of a
+		* point is (x + y*nx + z*nx*ny) for the voxel coordinates (x, y, z) and
+		* the number of voxels (nx, ny, ...) along every axis.
+		*
+		* @param size_ edge length of a voxel
+		* @param voxels_ receives the voxel of every point
+		* @return number of voxels of the bounding box
+		*/
+		size_t voxelize(ElementType size_, std::vector<size_t>& voxels_) const
+		{
+			voxels_.assign(rows, 0);
+			if (rows == 0) {
+				return 0;
+			}
+
+			std::vector<ElementType> low(cols), high(cols);
+			boundingBox(&low[0], &high[0]);
+
+			ElementType scale = ElementType(1) / size_;
+			size_t factor = 1;
+			for (size_t j = 0; j < cols; ++j) {
+				size_t count = (size_t)std::floor((high[j] - low[j]) * scale) + 1;
+
+				if (layout == POINTCLOUD_SOA) {
+					const ElementType* values = axes[j];
+					for (size_t i = 0; i < rows; ++i) {
+						voxels_[i] += (size_t)((values[i] - low[j]) * scale) * factor;
+					}
+				}
+				else {
+					for (size_t i = 0; i < rows; ++i) {
+						voxels_[i] += (size_t)((points[i][j] - low[j]) * scale) * factor;
+					}
+				}
+				factor *= count;
+			}
+			return factor;
+		}
+
+	private:
+
+		/**
+			The axes have been changed since they have been copied into points,
+			atomic since threads which fill a cloud may set it concurrently
+		*/
+		std::atomic<bool> stale;
+
+		/**
+		* Copies the axes into points, the memory of points is reused if it has
+		* the size of the cloud
+		*/
+		void toPoints()
+		{
+			if (points.rows != rows || points.cols != cols || !points.getPtr()) {
+				points = utils::Matrix<ElementType>(rows, cols, PADDING);
+			}
+			for (size_t i = 0; i < rows; ++i) {
+				for (size_t j = 0; j < cols; ++j) {
+					points[i][j] = axes[j][i];
+				}
+			}
+		}
 	};
 
 }
 
-#endif /* UTILS_POINTCLOUD_H_ */
\ No newline at end of file
+#endif /* UTILS_POINTCLOUD_H_ */
@@ -0,0 +1,270 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef UTILS_PROFILER_H_
+#define UTILS_PROFILER_H_
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "utils/memorytracker.h"
+#include "utils/timer.h"
+#include "utils/tracer.h"
+
+namespace utils
+{
+	/**
+		Collects the wall time of named phases of the program. A phase is measured
+		by a Phase object from its construction to its destruction. Phases which
+		are started while another phase of the same thread is running are nested,
+		their name is the path of all running phases, e.g. "search/upload".
+
+		Phases with the same name are aggregated over all calls and all threads.
+		Every thread has its own path, so a phase started by a worker thread is
+		not nested into the phase of the thread which started the worker.
+
+		If the global Tracer is enabled, every phase is also recorded as a span
+		of the timeline of its thread. If the MemoryTracker is enabled, the
+		allocations of the thread which runs a phase are added up as well.
+	*/
+	class Profiler
+	{
+	public:
+
+		/**
+			Aggregated measurements of a phase
+		*/
+		struct Record {
+			size_t calls;
+			double total;
+			double min;
+			double max;
+			std::set<std::thread::id> threads;
+			size_t allocations;
+			size_t bytes;
+
+			Record() : calls(0), total(0), min(0), max(0), allocations(0), bytes(0) {}
+		};
+
+		/**
+			Measures a phase from its construction to its destruction
+		*/
+		class Phase
+		{
+		public:
+
+			/**
+				Constructor, starts the phase
+
+				@param name_ name of the phase
+				@param profiler_ profiler which receives the measurement
+			*/
+			Phase(const std::string& name_, Profiler& profiler_ = Profiler::global()) :
+				profiler(profiler_), running(1)
+			{
+				std::string& current = path();
+				length = current.size();
+				if (!current.empty()) {
+					current += "/";
+				}
+				current += name_;
+				name = current;
+
+				timer.start();
+			}
+
+			/**
+				Deconstructor, stops the phase if it is running
+			*/
+			~Phase()
+			{
+				stop();
+			}
+
+			/**
+				Stops the phase
+
+				@return seconds since the phase has been started
+			*/
+			double stop()
+			{
+				Tracer::Clock::time_point end = Tracer::Clock::now();
+				double seconds = std::chrono::duration<double>(end - timer.time).count();
+				if (running) {
+					running = 0;
+					profiler.add(name, seconds, allocations.allocations(), allocations.bytes());
+					Tracer::global().span(name.c_str() + (length ? length + 1 : 0), timer.time, end);
+					path().resize(length);
+				}
+				return seconds;
+			}
+
+		private:
+
+			/**
+				Path of the running phases of the calling thread
+			*/
+			static std::string& path()
+			{
+				static thread_local std::string current;
+				return current;
+			}
+
+			Profiler& profiler;
+			std::string name;
+			size_t length;
+			bool running;
+			MemoryTracker::Scope allocations;
+			Timer timer;
+		};
+
+		/**
+			Returns the profiler which is shared by the whole program
+
+			@return reference to the profiler
+		*/
+		static Profiler& global()
+		{
+			static Profiler profiler;
+			return profiler;
+		}
+
+		/**
+			Adds a measurement of a phase
+
+			@param name_ path of the phase
+			@param seconds_ wall time of the phase
+			@param allocations_ number of allocations of the phase
+			@param bytes_ Bytes allocated by the phase
+		*/
+		void add(const std::string& name_, double seconds_, size_t allocations_ = 0, size_t bytes_ = 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			Record& record = records[name_];
+			record.min = record.calls ? std::min(record.min, seconds_) : seconds_;
+			record.max = record.calls ? std::max(record.max, seconds_) : seconds_;
+			record.total += seconds_;
+			record.calls++;
+			record.threads.insert(std::this_thread::get_id());
+			record.allocations += allocations_;
+			record.bytes += bytes_;
+		}
+
+		/**
+			Removes all measurements
+		*/
+		void clear()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			records.clear();
+		}
+
+		/**
+			Returns the measurements of all phases, ordered by their path
+
+			@return measurements
+		*/
+		std::map<std::string, Record> getRecords() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return records;
+		}
+
+		/**
+			Writes a table with the measurements of all phases
+
+			@param stream_ stream which receives the table
+		*/
+		void print(std::ostream& stream_ = std::cout) const
+		{
+			std::map<std::string, Record> copy = getRecords();
+
+			bool memory = MemoryTracker::enabled();
+			stream_ << "phase calls threads total[s] mean[s] min[s] max[s]" << (memory ? " allocations bytes" : "") << std::endl;
+			for (std::map<std::string, Record>::const_iterator it = copy.begin(); it != copy.end(); ++it) {
+				const Record& record = it->second;
+				stream_ << it->first << " " << record.calls << " " << record.threads.size() << " "
+					<< record.total << " " << record.total / record.calls << " "
+					<< record.min << " " << record.max;
+				if (memory) {
+					stream_ << " " << record.allocations << " " << record.bytes;
+				}
+				stream_ << std::endl;
+			}
+		}
+
+		/**
+			Writes the measurements of all phases as JSON
+
+			@param stream_ stream which receives the report
+		*/
+		void report(std::ostream& stream_) const
+		{
+			std::map<std::string, Record> copy = getRecords();
+
+			stream_ << "{\"phases\":[";
+			for (std::map<std::string, Record>::const_iterator it = copy.begin(); it != copy.end(); ++it) {
+				const Record& record = it->second;
+				stream_ << (it == copy.begin() ? "" : ",") << std::endl
+					<< "{\"name\":\"";
+				Tracer::escape(stream_, it->first.c_str());
+				stream_ << "\""
+					<< ",\"calls\":" << record.calls
+					<< ",\"threads\":" << record.threads.size()
+					<< ",\"total\":" << record.total
+					<< ",\"mean\":" << record.total / record.calls
+					<< ",\"min\":" << record.min
+					<< ",\"max\":" << record.max
+					<< ",\"allocations\":" << record.allocations
+					<< ",\"bytes\":" << record.bytes << "}";
+			}
+			stream_ << std::endl << "]}" << std::endl;
+		}
+
+	private:
+
+		/**
+			Measurements ordered by the path of the phase
+		*/
+		std::map<std::string, Record> records;
+
+		/**
+			Guards the measurements
+		*/
+		mutable std::mutex mutex;
+	};
+}
+
+#endif /* UTILS_PROFILER_H_ */
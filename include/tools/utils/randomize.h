@@ -31,14 +31,35 @@
 #ifndef UTILS_RANDOMIZE_H_
 #define UTILS_RANDOMIZE_H_
 
+#include <ctime>
+#include <type_traits>
+
+#include "flann/util/random.h"
+
 namespace utils
 {
 	/**
-		Seeds the random number generator
+		The functions draw from flann::random_engine(), the generator of the
+		calling thread, so they can be used by several threads at once and
+		share their seed with the index builders
+	*/
+
+	/**
+		Seeds the random number generator with the current time
 	*/
 	inline void rand_seed()
 	{
-		srand(time(NULL));
+		flann::seed_random((unsigned int)time(NULL));
+	}
+
+	/**
+		Seeds the random number generator
+
+		@param seed_ random seed
+	*/
+	inline void rand_seed(unsigned int seed_)
+	{
+		flann::seed_random(seed_);
 	}
 
 	/**
@@ -50,7 +71,7 @@ namespace utils
 	*/
 	inline double rand_double(double high = 1.0, double low = 0)
 	{
-		return low + (double)((high-low) * (std::rand() / (RAND_MAX + 1.0)));
+		return low + (high - low) * flann::random_engine().real();
 	}
 
 	/**
@@ -62,7 +83,7 @@ namespace utils
 	*/
 	inline double rand_float(float high = 1.0, float low = 0)
 	{
-		return low + (float)((high - low) * (std::rand() / (RAND_MAX + 1.0)));
+		return low + (float)((high - low) * flann::random_engine().real());
 	}
 
 	/**
@@ -74,7 +95,7 @@ namespace utils
 	*/
 	inline int rand_int(int high = RAND_MAX, int low = 0)
 	{
-		return low + (int)((high - low) * (std::rand() / (RAND_MAX + 1.0)));
+		return low + (int)flann::random_engine().uniform((unsigned int)(high - low));
 	}
 
 	template <typename ElementType>
@@ -98,26 +119,8 @@ namespace utils
 			}
 		}
 
-		return low + (ElementType)((high - low) * (std::rand() / (RAND_MAX + 1.0)));
+		return low + (ElementType)((high - low) * flann::random_engine().real());
 	}
 }
 
-/**
-	You can extend RAND_MAX by selecting two random numbers a and b and compute a*(RAND_MAX+1)+b.
-	So that you get numbers between [0,32767^2(1073676289)]. But this is still less than the maximum value 
-	of integer (2147483647).
-
-	RAND_MAX is 2^16 = 2 Byte. To get a random number with 2^32 = 4 Byte. You have to generate four 8 bit numbers 
-	and shift them with a manifold of 8 bit. 
-
-	ElementType a = 0;
-	for ( i = sizeof(ElementType)-1; i>=0; i++){
-		a |= rand(unsigned char [0..256]) << i*8;
-	}
-
-	When ElementType is a signed data type the random number has to be subtracted with 2^(8*sizeof(ElementType)-1). 
-	When the data type is queried there have to be set a flag whether it si a unsigned data type
-	
-*/
-
 #endif /* UTILS_RANDOMIZE_H_ */
\ No newline at end of file
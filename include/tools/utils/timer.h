@@ -31,22 +31,27 @@
 #ifndef UTILS_TIMER_H_
 #define UTILS_TIMER_H_
 
-#include <time.h>
+#include <chrono>
 
 namespace utils
 {
+	/**
+		Measures wall time with a steady clock, so time spent in other threads
+		is not added up as with clock()
+	*/
 	class Timer
 	{
 
 	public:
 
-		clock_t time;
+		std::chrono::steady_clock::time_point time;
 
 		/**
 		* Constructor
 		*/
 		Timer()
 		{
+			start();
 		}
 
 		/**
@@ -61,15 +66,17 @@ namespace utils
 		*/
 		void start()
 		{
-			time = (double) clock();
+			time = std::chrono::steady_clock::now();
 		}
 
 		/**
 		* Stops the timer
+		*
+		* @return seconds since the timer has been started
 		*/
-		double stop()
+		double stop() const
 		{
-			return ((double)clock() - time) / CLOCKS_PER_SEC;
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - time).count();
 		}
 	};
 
@@ -0,0 +1,448 @@
+/***********************************************************************
+* Software License Agreement (BSD License)
+*
+* Copyright 2017  Wolfgang Brandenburger. All rights reserved.
+*
+* THE BSD LICENSE
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*************************************************************************/
+
+#ifndef UTILS_TRACER_H_
+#define UTILS_TRACER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "flann/util/thread_pool.h"
+#include "flann/util/thread_registry.h"
+
+namespace utils
+{
+	/**
+		Records spans and counters of all threads as a timeline which can be
+		written in the Chrome trace event format and be opened with
+		chrome://tracing or Perfetto.
+
+		Every thread writes into its own ring buffer without taking a lock, only
+		the first event of a thread registers its buffer in a flann::ThreadRegistry.
+		If a buffer is full the oldest events are overwritten. The tracer is disabled by default, then an
+		event costs a single atomic load.
+
+		While the global tracer is enabled, the share of a batch of every thread
+		of a flann::ThreadPool is recorded as a "job" span and the number of busy
+		threads as a counter, so idle workers and stragglers show up in the
+		timeline.
+
+		The buffers are read by write(), which should be called when the traced
+		threads are idle, otherwise events which are overwritten at the same time
+		may be garbled.
+	*/
+	class Tracer
+	{
+	public:
+
+		typedef std::chrono::steady_clock Clock;
+
+		enum
+		{
+			/**
+				Number of characters of a name which are stored with an event
+			*/
+			NAME_SIZE = 32,
+			/**
+				Default number of events of the buffer of a thread
+			*/
+			DEFAULT_CAPACITY = 1 << 14
+		};
+
+		/**
+			Event of the timeline, a complete span ('X') or a counter ('C')
+		*/
+		struct Event {
+			char name[NAME_SIZE];
+			char type;
+			double begin;
+			double duration;
+			double value;
+		};
+
+		/**
+			Records a span from its construction to its destruction
+		*/
+		class Span
+		{
+		public:
+
+			/**
+				Constructor, starts the span
+
+				@param name_ name of the span
+				@param tracer_ tracer which receives the span
+			*/
+			Span(const char* name_, Tracer& tracer_ = Tracer::global()) :
+				tracer(tracer_), name(name_), begin(Clock::now())
+			{
+			}
+
+			/**
+				Deconstructor, records the span
+			*/
+			~Span()
+			{
+				tracer.span(name, begin, Clock::now());
+			}
+
+		private:
+
+			Tracer& tracer;
+			const char* name;
+			Clock::time_point begin;
+		};
+
+		/**
+			Constructor, the tracer is disabled
+		*/
+		Tracer() :
+			active(false), capacity(DEFAULT_CAPACITY), epoch(Clock::now())
+		{
+		}
+
+		/**
+			Returns the tracer which is shared by the whole program
+
+			@return reference to the tracer
+		*/
+		static Tracer& global()
+		{
+			static Tracer tracer;
+			return tracer;
+		}
+
+		/**
+			Starts to record events
+
+			@param capacity_ number of events of the buffer of a thread which is
+				registered from now on
+		*/
+		void enable(size_t capacity_ = DEFAULT_CAPACITY)
+		{
+			capacity.store(capacity_ > 0 ? capacity_ : 1);
+			active.store(true);
+			if (this == &global()) {
+				flann::ThreadPool::setObserver(&JobObserver::instance());
+			}
+		}
+
+		/**
+			Stops to record events, the recorded events are kept
+		*/
+		void disable()
+		{
+			active.store(false);
+			if (this == &global()) {
+				flann::ThreadPool::setObserver(nullptr);
+			}
+		}
+
+		/**
+			Returns whether events are recorded
+
+			@return true if the tracer is enabled
+		*/
+		bool enabled() const
+		{
+			return active.load(std::memory_order_relaxed);
+		}
+
+		/**
+			Records a span of the calling thread
+
+			@param name_ name of the span
+			@param begin_ start of the span
+			@param end_ end of the span
+		*/
+		void span(const char* name_, Clock::time_point begin_, Clock::time_point end_)
+		{
+			if (!enabled()) {
+				return;
+			}
+			Event event;
+			setName(event, name_);
+			event.type = 'X';
+			event.begin = microseconds(begin_);
+			event.duration = std::chrono::duration<double, std::micro>(end_ - begin_).count();
+			event.value = 0;
+			Buffer* current = buffer();
+			if (current) {
+				current->push(event);
+			}
+		}
+
+		/**
+			Records the value of a counter, the timeline shows the counter as a
+			graph which changes at every call
+
+			@param name_ name of the counter
+			@param value_ value of the counter from now on
+		*/
+		void counter(const char* name_, double value_)
+		{
+			if (!enabled()) {
+				return;
+			}
+			Event event;
+			setName(event, name_);
+			event.type = 'C';
+			event.begin = microseconds(Clock::now());
+			event.duration = 0;
+			event.value = value_;
+			Buffer* current = buffer();
+			if (current) {
+				current->push(event);
+			}
+		}
+
+		/**
+			Names the calling thread in the timeline
+
+			@param name_ name of the thread
+		*/
+		void setThreadName(const std::string& name_)
+		{
+			if (!enabled()) {
+				return;
+			}
+			Buffer* current = buffer();
+			if (current) {
+				std::lock_guard<std::mutex> lock(mutex);
+				current->name = name_;
+			}
+		}
+
+		/**
+			Removes all events, the buffers stay registered to their threads
+		*/
+		void clear()
+		{
+			std::vector<std::shared_ptr<Slot>> entries = buffers.entries();
+			for (size_t i = 0; i < entries.size(); i++) {
+				entries[i]->head.store(0);
+			}
+		}
+
+		/**
+			Writes the recorded events in the Chrome trace event format
+
+			@param stream_ stream which receives the trace
+		*/
+		void write(std::ostream& stream_) const
+		{
+			std::vector<std::shared_ptr<Slot>> entries = buffers.entries();
+			std::lock_guard<std::mutex> lock(mutex);
+
+			/* Timestamps are microseconds, they need all digits after some seconds. */
+			std::ios::fmtflags flags = stream_.flags();
+			std::streamsize precision = stream_.precision();
+			stream_ << std::fixed << std::setprecision(3);
+
+			size_t dropped = 0;
+			bool first = true;
+			stream_ << "{\"traceEvents\":[";
+			for (size_t i = 0; i < entries.size(); i++) {
+				const Buffer& current = *entries[i];
+				size_t head = current.head.load(std::memory_order_acquire);
+				size_t size = current.events.size();
+				size_t begin = head > size ? head - size : 0;
+				dropped += begin;
+
+				stream_ << (first ? "" : ",") << std::endl
+					<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << i
+					<< ",\"args\":{\"name\":\"";
+				std::string name = current.name.empty() ? "thread " + std::to_string(i) : current.name;
+				escape(stream_, name.c_str());
+				stream_ << "\"}}";
+				first = false;
+
+				for (size_t j = begin; j < head; j++) {
+					const Event& event = current.events[j % size];
+					stream_ << "," << std::endl << "{\"name\":\"";
+					escape(stream_, event.name);
+					stream_ << "\",\"ph\":\"" << event.type << "\",\"pid\":0,\"tid\":" << i
+						<< ",\"ts\":" << event.begin;
+					if (event.type == 'X') {
+						stream_ << ",\"dur\":" << event.duration;
+					}
+					else {
+						stream_ << ",\"args\":{\"value\":" << event.value << "}";
+					}
+					stream_ << "}";
+				}
+			}
+			stream_ << std::endl << "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":" << dropped << "}}" << std::endl;
+
+			stream_.flags(flags);
+			stream_.precision(precision);
+		}
+
+		/**
+			Writes a string with the characters escaped which are not allowed in
+			a JSON string, control characters are dropped
+
+			@param stream_ stream which receives the string
+			@param string_ string
+		*/
+		static void escape(std::ostream& stream_, const char* string_)
+		{
+			for (; *string_; string_++) {
+				if (*string_ == '"' || *string_ == '\\') {
+					stream_ << '\\' << *string_;
+				}
+				else if ((unsigned char)*string_ >= 0x20) {
+					stream_ << *string_;
+				}
+			}
+		}
+
+	private:
+
+		/**
+			Ring buffer of the events of a single thread, only the owning thread
+			writes into it
+		*/
+		struct Buffer {
+			std::vector<Event> events;
+			std::atomic<size_t> head;
+			/** name of the thread, guarded by the mutex of the tracer */
+			std::string name;
+
+			Buffer(size_t capacity_) :
+				events(capacity_), head(0)
+			{
+			}
+
+			void push(const Event& event_)
+			{
+				size_t position = head.load(std::memory_order_relaxed);
+				events[position % events.size()] = event_;
+				head.store(position + 1, std::memory_order_release);
+			}
+		};
+
+		typedef flann::ThreadRegistry<Buffer>::Slot Slot;
+
+		/**
+			Returns the buffer of the calling thread, registers it on the first call
+
+			@return buffer, nullptr while the thread registers or after it has
+				released its buffer
+		*/
+		Buffer* buffer()
+		{
+			return buffers.local(capacity.load(std::memory_order_relaxed));
+		}
+
+		/**
+			Records the batches of the thread pools in the global tracer
+		*/
+		class JobObserver : public flann::ThreadPool::Observer
+		{
+		public:
+
+			JobObserver() : busy(0) {}
+
+			static JobObserver& instance()
+			{
+				static JobObserver observer;
+				return observer;
+			}
+
+			void begin(int, int)
+			{
+				starts().push_back(Clock::now());
+				global().counter("busy threads", busy.fetch_add(1) + 1);
+			}
+
+			void end(int, int)
+			{
+				Clock::time_point end = Clock::now();
+				global().span("job", starts().back(), end);
+				starts().pop_back();
+				global().counter("busy threads", busy.fetch_sub(1) - 1);
+			}
+
+		private:
+
+			/**
+				Starts of the jobs of the calling thread, a job may run a batch of
+				another pool on the same thread
+			*/
+			static std::vector<Clock::time_point>& starts()
+			{
+				static thread_local std::vector<Clock::time_point> stack;
+				return stack;
+			}
+
+			/**
+				Number of threads of all pools which execute a batch at the moment
+			*/
+			std::atomic<int> busy;
+		};
+
+		/**
+			Copies a name into an event, long names are truncated
+		*/
+		static void setName(Event& event_, const char* name_)
+		{
+			std::strncpy(event_.name, name_, NAME_SIZE - 1);
+			event_.name[NAME_SIZE - 1] = '\0';
+		}
+
+		double microseconds(Clock::time_point time_) const
+		{
+			return std::chrono::duration<double, std::micro>(time_ - epoch).count();
+		}
+
+		std::atomic<bool> active;
+		std::atomic<size_t> capacity;
+		Clock::time_point epoch;
+
+		/**
+			Buffers of all threads which have recorded an event
+		*/
+		flann::ThreadRegistry<Buffer> buffers;
+
+		/**
+			Guards the names of the threads
+		*/
+		mutable std::mutex mutex;
+	};
+}
+
+#endif /* UTILS_TRACER_H_ */
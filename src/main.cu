@@ -1,52 +1,120 @@
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <thread>
 
+/* The global operators new and delete report to utils::MemoryTracker. */
+#define FLANN_MEMORY_TRACKER_OPERATORS
+#include "tools/utils/memorytracker.h"
+
 #include "flann/flann.h"
 #include "flann/flann.hpp"
 
 #include "tools/project.h"
 #include "tools/io.h"
-
-#define _CRTDBG_MAP_ALLOC
-#include <stdlib.h>
-#include <crtdbg.h>
-#ifdef _DEBUG
-	#ifndef DEBUG_NEW
-		#define DEBUG_NEW new(_NORMAL_BLOCK, __FILE__, __LINE__)
-		#define new DEBUG_NEW
-	#endif
-#endif
+#include "tools/benchmark.h"
 
 int main(int argc, char* argv[]) {
-	_CrtSetReportMode(_CRT_ERROR, _CRTDBG_MODE_DEBUG);
-	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
-
 
 	std::cout << "----------------------- Main -----------------------" << std::endl;;
 
 	int i = 0;
 	int cores = (unsigned int)std::thread::hardware_concurrency();
+	int benchmarkset = 0;
+	std::string profile;
+	std::string trace;
+	bool memory = false;
+	std::string cache;
+	std::string benchmarksearch;
+	benchmark::SearchSweep sweep;
 	while (i < argc) {
 		if (!strcmp(argv[i], "--cores")) {
 			i++;
 			cores = std::stoi(argv[i]);
 		}
+		else if (!strcmp(argv[i], "--benchmark-set")) {
+			i++;
+			benchmarkset = std::stoi(argv[i]);
+		}
+		else if (!strcmp(argv[i], "--profile")) {
+			i++;
+			profile = argv[i];
+		}
+		else if (!strcmp(argv[i], "--trace")) {
+			i++;
+			trace = argv[i];
+		}
+		else if (!strcmp(argv[i], "--memory")) {
+			memory = true;
+		}
+		else if (!strcmp(argv[i], "--cache")) {
+			i++;
+			cache = argv[i];
+		}
+		else if (!strcmp(argv[i], "--benchmark-search")) {
+			i++;
+			benchmarksearch = argv[i];
+		}
+		else if (!strncmp(argv[i], "--sweep-", 8)) {
+			i++;
+			sweep.set(argv[i - 1] + 8, argv[i]);
+		}
 		i++;
 	}
 
+	if (memory) {
+		utils::MemoryTracker::enable();
+	}
+
+	if (!trace.empty()) {
+		utils::Tracer::global().enable();
+		utils::Tracer::global().setThreadName("main");
+	}
+
+	if (benchmarkset > 0) {
+		benchmark::orderedset(benchmarkset);
+		return(0);
+	}
+
+	if (!benchmarksearch.empty()) {
+		std::vector<benchmark::SearchResult> results = benchmark::search(sweep);
+		if (sweep.recall) {
+			benchmark::printPareto(results);
+		}
+		std::ofstream stream(benchmarksearch.c_str());
+		if (benchmarksearch.size() > 4 && benchmarksearch.compare(benchmarksearch.size() - 4, 4, ".csv") == 0) {
+			benchmark::writeCsv(results, stream);
+		}
+		else {
+			benchmark::writeJson(results, stream);
+		}
+		return(0);
+	}
+
 	char *file = "C:/Users/Wolfgang Brandenburg/OneDrive/Dokumente/3DModelle/Sonstiges/plane.ply";
 
-	utils::Timer time;
 	utils::Pointcloud<float> pointcloud;
 
-	time.start();
-	if (io::readply<float>(file, pointcloud)) {
-		std::cout << "File with " << pointcloud.points.rows << " point has been read in "
-			<< time.stop() << " s into Pointcloud" << std::endl;
+	utils::Profiler::Phase read("read");
+	io::CacheFile cachefile;
+	if (!cache.empty() && cachefile.open(cache.c_str()) && cachefile.read(pointcloud)) {
+		std::cout << "Cache with " << pointcloud.rows << " point has been read in "
+			<< read.stop() << " s into Pointcloud" << std::endl;
 	}
+	else if (io::readply<float>(file, pointcloud)) {
+		std::cout << "File with " << pointcloud.rows << " point has been read in "
+			<< read.stop() << " s into Pointcloud" << std::endl;
 
-	flann::Matrix<float> pointcloudflann(pointcloud.getPointsPtr(), pointcloud.rows, pointcloud.cols);
+		if (!cache.empty()) {
+			cachefile.close();
+			io::CacheWriter().write(cache.c_str(), pointcloud);
+		}
+	}
+	read.stop();
+	cachefile.close();
+	utils::Tracer::global().counter("points", (double)pointcloud.rows);
+
+	flann::Matrix<float> pointcloudflann = pointcloud.view();
 
 
 
@@ -104,19 +172,19 @@ int main(int argc, char* argv[]) {
 	}
 
 	// build index and perform knn-search
-	time.start();
+	utils::Profiler::Phase build("build");
 	flann::Index<flann::L2<float>> index(pointcloudflann, flann::KDTreeCudaIndexParams(5));
 	index.buildIndex();
 
-	std::cout << "kd-tree has been built in " << time.stop() << " s" << std::endl;
+	std::cout << "kd-tree has been built in " << build.stop() << " s" << std::endl;
 
 	flann::SearchParams params;
 	params.checks = 32;
 	params.cores = cores;
 
-	time.start();
+	utils::Profiler::Phase search("search");
 	index.knnSearch(query, indices, dists, nn, params);
-	std::cout << "search has been performed in " << time.stop() << " s" << std::endl;
+	std::cout << "search has been performed in " << search.stop() << " s" << std::endl;
 
 	utils::rand_seed();
 	for (int i = 0; i < indices.rows; i++) {
@@ -130,12 +198,31 @@ int main(int argc, char* argv[]) {
 		}
 	}
 
+	utils::Profiler::Phase write("write");
 	io::writeply("C:/Users/Wolfgang Brandenburg/OneDrive/Dokumente/3DModelle/Sonstiges/planeOut.ply", pointcloud);
+	write.stop();
+
+	utils::Profiler::global().print();
+	if (!profile.empty()) {
+		std::ofstream stream(profile.c_str());
+		utils::Profiler::global().report(stream);
+	}
+	if (!trace.empty()) {
+		std::ofstream stream(trace.c_str());
+		utils::Tracer::global().write(stream);
+	}
 
 	// destroy the flann::matrix
 	pointcloud.clear();
 	delete[] indices.ptr();
 	delete[] dists.ptr();
+	delete[] query.ptr();
+
+	/* Memory which is still allocated here has leaked, except for the index
+	and the matrices of this scope which are freed at the return. */
+	if (memory) {
+		utils::MemoryTracker::print();
+	}
 
 	return(0);
 }
\ No newline at end of file